@@ -0,0 +1,89 @@
+/**
+ * @file aggregator.c
+ * @brief Wall-clock aligned window statistics using Welford's online algorithm
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aggregator.h"
+
+/**
+ * @brief Start of the window containing now, aligned to a multiple of window_s
+ */
+static int64_t window_floor(int64_t now, uint32_t window_s)
+{
+    int64_t start = now - (now % (int64_t)window_s);
+    if (now < 0 && now % (int64_t)window_s != 0) {
+        start -= window_s;
+    }
+    return start;
+}
+
+esp_err_t aggregator_init(aggregator_t* agg, uint32_t window_s, uint8_t reg_count, int64_t now)
+{
+    memset(agg, 0, sizeof(*agg));
+    agg->stats = calloc(reg_count, sizeof(agg_stat_t));
+    if (agg->stats == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    agg->window_s = window_s;
+    agg->reg_count = reg_count;
+    aggregator_roll(agg, now);
+
+    // Booting mid-window: the first summary does not cover the full window
+    agg->partial = (now != agg->window_start);
+    return ESP_OK;
+}
+
+bool aggregator_window_elapsed(const aggregator_t* agg, int64_t now)
+{
+    return now >= agg->window_start + (int64_t)agg->window_s;
+}
+
+void aggregator_roll(aggregator_t* agg, int64_t now)
+{
+    memset(agg->stats, 0, agg->reg_count * sizeof(agg_stat_t));
+    agg->window_start = window_floor(now, agg->window_s);
+    agg->partial = false;
+}
+
+void aggregator_add_value(aggregator_t* agg, uint8_t index, float value)
+{
+    if (index >= agg->reg_count || isnan(value)) {
+        return;
+    }
+
+    agg_stat_t* stat = &agg->stats[index];
+    if (stat->count == 0) {
+        stat->min = value;
+        stat->max = value;
+    } else {
+        if (value < stat->min) stat->min = value;
+        if (value > stat->max) stat->max = value;
+    }
+    stat->last = value;
+
+    // Welford: numerically stable single-pass mean/variance
+    stat->count++;
+    const double delta = value - stat->mean;
+    stat->mean += delta / stat->count;
+    stat->m2 += delta * (value - stat->mean);
+}
+
+void aggregator_add(aggregator_t* agg, const float* values, uint64_t valid)
+{
+    for (uint8_t i = 0; i < agg->reg_count; i++) {
+        if (valid & (1ULL << i)) {
+            aggregator_add_value(agg, i, values[i]);
+        }
+    }
+}
+
+double aggregator_stddev(const agg_stat_t* stat)
+{
+    if (stat->count < 2) {
+        return 0.0;
+    }
+    return sqrt(stat->m2 / (stat->count - 1));
+}
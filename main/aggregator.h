@@ -0,0 +1,83 @@
+/**
+ * @file aggregator.h
+ * @brief Streaming per-register window statistics (min/max/mean/stddev/last)
+ *
+ * Keeps O(1) memory per register regardless of poll rate: Welford's online
+ * algorithm for mean and variance plus min, max and last value. Windows are
+ * aligned to multiples of their length on the wall clock (e.g. :00, :15, :30,
+ * :45 for 15 minutes), so summaries from different devices line up.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Running statistics of one register within the current window
+ */
+typedef struct {
+    uint32_t count;
+    float min;
+    float max;
+    float last;
+    double mean;
+    double m2;          // Sum of squared deviations from the mean (Welford)
+} agg_stat_t;
+
+/**
+ * @brief One aggregation window over all registers of a profile
+ */
+typedef struct {
+    uint32_t window_s;          // Window length in seconds
+    int64_t window_start;       // Wall-clock start of the current window (epoch s)
+    bool partial;               // Current window started mid-way (first window after boot)
+    uint8_t reg_count;
+    agg_stat_t* stats;          // reg_count entries
+} aggregator_t;
+
+/**
+ * @brief Allocate the statistics for reg_count registers and start the first window
+ *
+ * @param window_s  Window length in seconds
+ * @param reg_count Number of registers in the active profile
+ * @param now       Current wall-clock time (epoch s)
+ * @return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t aggregator_init(aggregator_t* agg, uint32_t window_s, uint8_t reg_count, int64_t now);
+
+/**
+ * @brief Check whether the current window has ended
+ *
+ * When this returns true the caller publishes the window and then calls
+ * aggregator_roll() before adding the next sample.
+ */
+bool aggregator_window_elapsed(const aggregator_t* agg, int64_t now);
+
+/**
+ * @brief Reset all statistics and start the window containing now
+ */
+void aggregator_roll(aggregator_t* agg, int64_t now);
+
+/**
+ * @brief Add one sample of a single register
+ */
+void aggregator_add_value(aggregator_t* agg, uint8_t index, float value);
+
+/**
+ * @brief Add a full reading; registers whose bit in valid is clear are skipped
+ */
+void aggregator_add(aggregator_t* agg, const float* values, uint64_t valid);
+
+/**
+ * @brief Sample standard deviation of a register's window (0 for fewer than 2 samples)
+ */
+double aggregator_stddev(const agg_stat_t* stat);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,226 @@
+/**
+ * @file burst_capture.c
+ * @brief Burst command validation and the XOR/varint sample encoder
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cJSON.h"
+#include "esp_heap_caps.h"
+#include "burst_capture.h"
+
+#define BURST_COUNT_OFFSET      6           // Sample count field in the header
+#define BURST_DEFAULT_DURATION_S 30
+
+esp_err_t burst_capture_init(burst_capture_t* capture, size_t capacity)
+{
+    memset(capture, 0, sizeof(*capture));
+    capture->arena = heap_caps_malloc(capacity, MALLOC_CAP_8BIT);
+    if (capture->arena == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    capture->capacity = capacity;
+    return ESP_OK;
+}
+
+/**
+ * @brief Add a register to the request, keeping indices ascending and unique
+ */
+static bool request_add_reg(burst_request_t* out, uint8_t index)
+{
+    int pos = 0;
+    while (pos < out->reg_count && out->regs[pos] < index) {
+        pos++;
+    }
+    if (pos < out->reg_count && out->regs[pos] == index) {
+        return true;
+    }
+    if (out->reg_count >= BURST_MAX_REGS) {
+        return false;
+    }
+    memmove(&out->regs[pos + 1], &out->regs[pos], out->reg_count - pos);
+    out->regs[pos] = index;
+    out->reg_count++;
+    return true;
+}
+
+esp_err_t burst_request_parse(const char* json, int len, const meter_profile_t* profile,
+                              uint32_t max_duration_s, burst_request_t* out,
+                              char* error, size_t error_size)
+{
+    memset(out, 0, sizeof(*out));
+    out->id = -1;
+    out->duration_ms = BURST_DEFAULT_DURATION_S * 1000;
+    if (out->duration_ms > max_duration_s * 1000) {
+        out->duration_ms = max_duration_s * 1000;
+    }
+    error[0] = '\0';
+
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (root == NULL || !cJSON_IsObject(root)) {
+        snprintf(error, error_size, "payload must be a JSON object");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool ok = true;
+    const cJSON* registers = NULL;
+    const cJSON* item;
+    cJSON_ArrayForEach(item, root) {
+        if (strcmp(item->string, "duration_s") == 0) {
+            const double value = cJSON_IsNumber(item) ? item->valuedouble : -1.0;
+            ok = value >= 1 && value <= max_duration_s && value == (double)(uint32_t)value;
+            if (ok) {
+                out->duration_ms = (uint32_t)value * 1000;
+            } else {
+                snprintf(error, error_size, "duration_s must be an integer in 1..%lu", (unsigned long)max_duration_s);
+            }
+        } else if (strcmp(item->string, "registers") == 0) {
+            ok = cJSON_IsArray(item) && cJSON_GetArraySize(item) > 0;
+            registers = item;
+            if (!ok) {
+                snprintf(error, error_size, "registers must be a non-empty array of topic names");
+            }
+        } else if (strcmp(item->string, "id") == 0) {
+            const double value = cJSON_IsNumber(item) ? item->valuedouble : -1.0;
+            ok = value >= 0 && value <= INT32_MAX && value == (double)(int32_t)value;
+            if (ok) {
+                out->id = (int32_t)value;
+            } else {
+                snprintf(error, error_size, "id must be a non-negative integer");
+            }
+        } else {
+            snprintf(error, error_size, "unknown key %.32s", item->string);
+            ok = false;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+
+    if (ok && registers != NULL) {
+        cJSON_ArrayForEach(item, registers) {
+            int index = -1;
+            for (int i = 0; cJSON_IsString(item) && i < profile->reg_count; i++) {
+                if (strcmp(profile->regs[i].topic, item->valuestring) == 0) {
+                    index = i;
+                    break;
+                }
+            }
+            if (index < 0) {
+                snprintf(error, error_size, "unknown register %.32s",
+                         cJSON_IsString(item) ? item->valuestring : "(not a string)");
+                ok = false;
+            } else if (!request_add_reg(out, (uint8_t)index)) {
+                snprintf(error, error_size, "at most %d registers per burst", BURST_MAX_REGS);
+                ok = false;
+            }
+            if (!ok) {
+                break;
+            }
+        }
+    } else if (ok) {
+        // Default: every active power and current register of the profile
+        for (int i = 0; i < profile->reg_count; i++) {
+            const uint8_t quantity = profile->regs[i].quantity;
+            if ((quantity == QTY_ACTIVE_POWER || quantity == QTY_CURRENT) && !request_add_reg(out, (uint8_t)i)) {
+                break;
+            }
+        }
+    }
+    cJSON_Delete(root);
+
+    return ok ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+void burst_capture_start(burst_capture_t* capture, const meter_profile_t* profile,
+                         const burst_request_t* request, int64_t start_utc_ms)
+{
+    uint8_t* p = capture->arena;
+    memcpy(p, "SDMB", 4);
+    p[4] = BURST_FORMAT_VERSION;
+    p[5] = request->reg_count;
+    put_u32(p + BURST_COUNT_OFFSET, 0);
+    put_u32(p + 10, (uint32_t)start_utc_ms);
+    put_u32(p + 14, (uint32_t)((uint64_t)start_utc_ms >> 32));
+    size_t len = 18;
+    for (int i = 0; i < request->reg_count; i++) {
+        const char* topic = profile->regs[request->regs[i]].topic;
+        const size_t topic_len = strlen(topic) + 1;
+        if (len + topic_len <= capture->capacity) {
+            memcpy(p + len, topic, topic_len);
+            len += topic_len;
+        }
+    }
+
+    capture->len = len;
+    capture->reg_count = request->reg_count;
+    capture->sample_count = 0;
+    capture->last_ms = 0;
+    memset(capture->prev_bits, 0, sizeof(capture->prev_bits));
+}
+
+/**
+ * @brief Bytes needed for a value with its leading zero bytes removed
+ */
+static uint8_t significant_bytes(uint32_t v)
+{
+    uint8_t n = 0;
+    while (v != 0) {
+        n++;
+        v >>= 8;
+    }
+    return n;
+}
+
+bool burst_capture_add(burst_capture_t* capture, uint32_t offset_ms, const float* values)
+{
+    const size_t worst_case = 5 + (capture->reg_count + 1) / 2 + 4 * capture->reg_count;
+    if (capture->len + worst_case > capture->capacity) {
+        return false;
+    }
+
+    uint8_t* p = capture->arena + capture->len;
+    for (uint32_t delta = offset_ms - capture->last_ms; ; delta >>= 7) {
+        if (delta < 0x80) {
+            *p++ = (uint8_t)delta;
+            break;
+        }
+        *p++ = (uint8_t)(delta | 0x80);
+    }
+    capture->last_ms = offset_ms;
+
+    for (int i = 0; i < capture->reg_count; i += 2) {
+        uint8_t* counts = p++;
+        *counts = 0;
+        for (int j = i; j < i + 2 && j < capture->reg_count; j++) {
+            uint32_t bits;
+            memcpy(&bits, &values[j], sizeof(bits));
+            uint32_t x = bits ^ capture->prev_bits[j];
+            capture->prev_bits[j] = bits;
+
+            const uint8_t n = significant_bytes(x);
+            *counts |= (uint8_t)(n << (j == i ? 4 : 0));
+            for (; x != 0; x >>= 8) {
+                *p++ = (uint8_t)x;
+            }
+        }
+    }
+
+    capture->len = p - capture->arena;
+    capture->sample_count++;
+    put_u32(capture->arena + BURST_COUNT_OFFSET, capture->sample_count);
+    return true;
+}
+
+size_t burst_capture_raw_size(const burst_capture_t* capture)
+{
+    return (size_t)capture->sample_count * (4 + 4 * capture->reg_count);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file burst_capture.h
+ * @brief High-rate capture of a few registers into a preallocated RAM arena
+ *
+ * A command on <prefix>/cmd/burst switches the poller into a tight block-read
+ * loop for a chosen subset of registers for up to a minute:
+ *
+ *   {"duration_s":30,"registers":["active_power","current"],"id":7}
+ *
+ * "registers" takes the profile's topic names and defaults to all active power
+ * and current registers; "id" is optional and echoed on <prefix>/burst/state.
+ *
+ * Samples are compressed while they are captured, straight into an arena that
+ * is allocated once at boot, so a burst never touches the heap. The arena is
+ * uploaded as one binary blob on <prefix>/burst/data, little-endian:
+ *
+ *   "SDMB" | u8 version | u8 register count | u32 sample count
+ *          | i64 start time (UTC ms, 0 = clock not set)
+ *          | one NUL-terminated topic name per register
+ *          | samples
+ *
+ * Each sample is the varint milliseconds since the previous sample (since the
+ * start for the first), then the registers in pairs: one byte holding the byte
+ * counts (0..4) of the two values in its high and low nibble, followed by those
+ * bytes. A value is the XOR of its IEEE754 bits with the register's previous
+ * value, sent least significant byte first with leading zero bytes left off;
+ * consecutive readings share sign, exponent and top mantissa bits, so most
+ * values take one or two bytes instead of four. The encoding is lossless.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "meter_profiles.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BURST_MAX_REGS          8           // Registers per burst
+#define BURST_FORMAT_VERSION    1
+
+/**
+ * @brief A validated burst command
+ */
+typedef struct {
+    uint32_t duration_ms;
+    uint8_t reg_count;
+    uint8_t regs[BURST_MAX_REGS];       // Profile register indices, ascending
+    int32_t id;                         // Echoed command id, -1 for none
+} burst_request_t;
+
+/**
+ * @brief Capture arena and encoder state
+ *
+ * Filled by the acquisition task only; the publisher reads it once the
+ * capture is finished.
+ */
+typedef struct {
+    uint8_t* arena;
+    size_t capacity;
+    size_t len;                         // Bytes of blob written so far
+    uint8_t reg_count;
+    uint32_t sample_count;
+    uint32_t last_ms;                   // Offset of the previous sample
+    uint32_t prev_bits[BURST_MAX_REGS]; // Previous value of each register, as raw bits
+} burst_capture_t;
+
+/**
+ * @brief Allocate the arena; called once at boot
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM
+ */
+esp_err_t burst_capture_init(burst_capture_t* capture, size_t capacity);
+
+/**
+ * @brief Validate a cmd/burst payload against the active profile
+ *
+ * @param json           Command payload (need not be NUL-terminated)
+ * @param len            Payload length
+ * @param profile        Active meter profile
+ * @param max_duration_s Longest burst allowed
+ * @param out            Receives the request; its id is filled even on error
+ * @param error          Receives a short description of the first problem found; unknown
+ *                       keys and register names are quoted raw
+ * @param error_size     Size of error
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a schema violation
+ */
+esp_err_t burst_request_parse(const char* json, int len, const meter_profile_t* profile,
+                              uint32_t max_duration_s, burst_request_t* out,
+                              char* error, size_t error_size);
+
+/**
+ * @brief Reset the arena and write the blob header
+ *
+ * @param start_utc_ms Wall-clock time of the first sample, 0 if unknown
+ */
+void burst_capture_start(burst_capture_t* capture, const meter_profile_t* profile,
+                         const burst_request_t* request, int64_t start_utc_ms);
+
+/**
+ * @brief Append one sample
+ *
+ * @param offset_ms Milliseconds since the start of the burst, non-decreasing
+ * @param values    One value per requested register, in request order
+ * @return false when the arena cannot take another sample (nothing written)
+ */
+bool burst_capture_add(burst_capture_t* capture, uint32_t offset_ms, const float* values);
+
+/**
+ * @brief Bytes the same samples take as uncompressed u32 offset plus float32 values
+ */
+size_t burst_capture_raw_size(const burst_capture_t* capture);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file clock_discipline.c
+ * @brief Frequency-locked monotonic-to-UTC mapping
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clock_discipline.h"
+
+#define CLOCK_STEP_THRESHOLD_US     1000000     // Larger offsets are a step, not drift
+#define CLOCK_MIN_RATE_INTERVAL_US  60000000    // Shorter sync intervals are too noisy for a rate estimate
+#define CLOCK_RATE_GAIN             0.5         // Fraction of the measured rate error applied per sync
+#define CLOCK_MAX_RATE_PPM          500.0       // Far beyond any crystal; larger estimates are noise
+
+void clock_discipline_init(clock_discipline_t* cd, uint32_t base_uncertainty_us, uint32_t drift_ppm,
+                           int64_t stale_after_us)
+{
+    memset(cd, 0, sizeof(*cd));
+    cd->base_uncertainty_us = base_uncertainty_us;
+    cd->drift_ppm = drift_ppm;
+    cd->stale_after_us = stale_after_us;
+}
+
+/**
+ * @brief UTC predicted by the current mapping, without sync checks
+ */
+static int64_t predict_utc(const clock_discipline_t* cd, int64_t mono_us)
+{
+    const int64_t elapsed = mono_us - cd->ref_mono_us;
+    return cd->ref_utc_us + elapsed + (int64_t)llround(elapsed * cd->rate_ppm * 1e-6);
+}
+
+void clock_discipline_update(clock_discipline_t* cd, int64_t mono_us, int64_t utc_us)
+{
+    if (cd->sync_count > 0) {
+        const int64_t interval = mono_us - cd->ref_mono_us;
+        const int64_t offset = utc_us - predict_utc(cd, mono_us);
+        cd->last_offset_us = offset;
+
+        // Both reference pairs carry up to the base uncertainty, plus the bounded drift in between
+        const int64_t expected = 2 * (int64_t)cd->base_uncertainty_us + llabs(interval) * cd->drift_ppm / 1000000;
+        const bool beyond = llabs(offset) > expected;
+        const bool repeated = beyond && cd->phase_corrected && (offset < 0) == (cd->phase_offset_us < 0);
+
+        cd->phase_corrected = false;
+        if (llabs(offset) >= CLOCK_STEP_THRESHOLD_US) {
+            // Time source stepped (or first real sync after a bogus one): start over
+            cd->rate_ppm = 0;
+        } else if (beyond && !repeated) {
+            // More than drift can explain: the source moved its phase. Take the new
+            // reference as is; only the same excess twice in a row counts as drift.
+            cd->phase_corrected = true;
+            cd->phase_offset_us = offset;
+        } else if (interval >= CLOCK_MIN_RATE_INTERVAL_US) {
+            cd->rate_ppm += CLOCK_RATE_GAIN * (double)offset / (double)interval * 1e6;
+            if (cd->rate_ppm > CLOCK_MAX_RATE_PPM) cd->rate_ppm = CLOCK_MAX_RATE_PPM;
+            if (cd->rate_ppm < -CLOCK_MAX_RATE_PPM) cd->rate_ppm = -CLOCK_MAX_RATE_PPM;
+        }
+    }
+
+    cd->ref_mono_us = mono_us;
+    cd->ref_utc_us = utc_us;
+    cd->sync_count++;
+}
+
+bool clock_discipline_to_utc(const clock_discipline_t* cd, int64_t mono_us, int64_t* utc_us,
+                             uint32_t* uncertainty_us)
+{
+    if (cd->sync_count == 0) {
+        return false;
+    }
+
+    *utc_us = predict_utc(cd, mono_us);
+    if (uncertainty_us != NULL) {
+        const int64_t age = llabs(mono_us - cd->ref_mono_us);
+        const int64_t bound = cd->base_uncertainty_us + age * cd->drift_ppm / 1000000;
+        *uncertainty_us = bound > UINT32_MAX ? UINT32_MAX : (uint32_t)bound;
+    }
+    return true;
+}
+
+clock_sync_state_t clock_discipline_state(const clock_discipline_t* cd, int64_t now_mono_us)
+{
+    if (cd->sync_count == 0) {
+        return CLOCK_SYNC_NONE;
+    }
+    return (now_mono_us - cd->ref_mono_us > cd->stale_after_us) ? CLOCK_SYNC_STALE : CLOCK_SYNC_SYNCED;
+}
+
+const char* clock_sync_state_name(clock_sync_state_t state)
+{
+    switch (state) {
+        case CLOCK_SYNC_SYNCED: return "synced";
+        case CLOCK_SYNC_STALE:  return "stale";
+        default:                return "none";
+    }
+}
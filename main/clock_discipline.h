@@ -0,0 +1,97 @@
+/**
+ * @file clock_discipline.h
+ * @brief Monotonic-to-UTC clock mapping disciplined by periodic time syncs
+ *
+ * Samples are stamped on the monotonic esp_timer clock, which never jumps. Each
+ * SNTP sync contributes one (monotonic, UTC) reference pair; the mapping keeps
+ * the latest pair plus an estimate of the monotonic clock's frequency error, so
+ * UTC can be computed for any monotonic timestamp together with an uncertainty
+ * bound that grows with the age of the last sync.
+ *
+ * Pure C with no ESP-IDF dependencies, so it builds and runs unchanged on the
+ * host and can be driven by sync pairs from a local NTP stand-in.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Quality of the UTC mapping
+ */
+typedef enum {
+    CLOCK_SYNC_NONE = 0,    // Never synced, timestamps are time since boot
+    CLOCK_SYNC_SYNCED,      // Synced within the expected interval
+    CLOCK_SYNC_STALE,       // Synced before, but the last sync is overdue
+} clock_sync_state_t;
+
+/**
+ * @brief Clock discipline state
+ */
+typedef struct {
+    int64_t ref_mono_us;            // Monotonic time of the last sync
+    int64_t ref_utc_us;             // UTC at the last sync (epoch us)
+    double rate_ppm;                // Estimated monotonic clock frequency error
+    int64_t last_offset_us;         // Prediction error corrected by the last sync
+    int64_t phase_offset_us;        // Offset of the last sync taken as a phase correction
+    bool phase_corrected;           // The last sync left the rate alone as a phase correction
+    uint32_t sync_count;
+
+    uint32_t base_uncertainty_us;   // Uncertainty of a single sync
+    uint32_t drift_ppm;             // Bound on residual drift between syncs
+    int64_t stale_after_us;         // Age after which the mapping is reported stale
+} clock_discipline_t;
+
+/**
+ * @brief Reset the discipline to the unsynced state
+ *
+ * @param base_uncertainty_us Uncertainty of a single sync
+ * @param drift_ppm           Residual drift bound used to widen the uncertainty with age
+ * @param stale_after_us      Sync age after which the state becomes CLOCK_SYNC_STALE
+ */
+void clock_discipline_init(clock_discipline_t* cd, uint32_t base_uncertainty_us, uint32_t drift_ppm,
+                           int64_t stale_after_us);
+
+/**
+ * @brief Feed one sync reference pair
+ *
+ * Offsets of a second or more are a clock step and reset the frequency
+ * estimate. Offsets larger than twice the base uncertainty plus the drift
+ * bound over the sync interval are a phase correction of the time source and
+ * leave the estimate alone, unless the previous sync saw the same excess in
+ * the same direction (a clock drifting beyond the bound). Other offsets are
+ * drift and refine the estimate.
+ *
+ * @param mono_us Monotonic time at which utc_us was valid
+ * @param utc_us  UTC from the time source (epoch us)
+ */
+void clock_discipline_update(clock_discipline_t* cd, int64_t mono_us, int64_t utc_us);
+
+/**
+ * @brief Map a monotonic timestamp to UTC
+ *
+ * @param mono_us        Monotonic timestamp
+ * @param utc_us         UTC result (epoch us)
+ * @param uncertainty_us Optional uncertainty bound of the result
+ * @return false if the clock was never synced (outputs untouched)
+ */
+bool clock_discipline_to_utc(const clock_discipline_t* cd, int64_t mono_us, int64_t* utc_us,
+                             uint32_t* uncertainty_us);
+
+/**
+ * @brief Current quality of the mapping
+ */
+clock_sync_state_t clock_discipline_state(const clock_discipline_t* cd, int64_t now_mono_us);
+
+/**
+ * @brief Short name of a sync state for logs and payloads ("none", "synced", "stale")
+ */
+const char* clock_sync_state_name(clock_sync_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
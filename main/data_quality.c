@@ -0,0 +1,145 @@
+/**
+ * @file data_quality.c
+ * @brief Per-register quality grading and median-of-3 spike filter
+ */
+
+#include <math.h>
+#include <string.h>
+#include "data_quality.h"
+
+#define DQ_NO_HELD              0xFF
+#define DQ_SPIKE_MIN_COUNTS     10      // Smallest departure that counts, in display resolution steps
+
+void dq_filter_init(dq_filter_t* dq, const meter_profile_t* profile, bool spike_filter,
+                    uint16_t spike_threshold_pct, uint8_t stale_cycles)
+{
+    memset(dq, 0, sizeof(*dq));
+    dq->profile = profile;
+    dq->spike_filter = spike_filter;
+    dq->spike_threshold_pct = spike_threshold_pct;
+    dq->stale_cycles = stale_cycles < DQ_NO_HELD ? stale_cycles : DQ_NO_HELD - 1;
+    for (int i = 0; i < METER_MAX_REGISTERS; i++) {
+        dq->regs[i].held_age = DQ_NO_HELD;
+    }
+}
+
+bool dq_in_range(const meter_register_t* reg, float value)
+{
+    if (!isfinite(value)) {
+        return false;
+    }
+    switch (reg->quantity) {
+        case QTY_VOLTAGE:
+            return value >= 0 && value <= 500;
+        case QTY_FREQUENCY:
+            return value >= 45 && value <= 65;
+        case QTY_POWER_FACTOR:
+            return value >= -1.1f && value <= 1.1f;
+        default:
+            return true;
+    }
+}
+
+static float median3(float a, float b, float c)
+{
+    if (a > b) {
+        const float t = a;
+        a = b;
+        b = t;
+    }
+    // With a <= b the median is c clamped to [a, b]
+    return c <= a ? a : (c >= b ? b : c);
+}
+
+/**
+ * @brief Whether two values are further apart than the spike threshold around reference
+ */
+static bool departs(const dq_filter_t* dq, const meter_register_t* reg, float a, float b, float reference)
+{
+    const float resolution = powf(10.0f, -(float)reg->precision);
+    float limit = fabsf(reference) * dq->spike_threshold_pct / 100.0f;
+    if (limit < DQ_SPIKE_MIN_COUNTS * resolution) {
+        limit = DQ_SPIKE_MIN_COUNTS * resolution;
+    }
+    return fabsf(a - b) > limit;
+}
+
+int dq_filter_apply(dq_filter_t* dq, float* values, uint64_t* valid, uint8_t* quality)
+{
+    int flagged = 0;
+    for (int i = 0; i < dq->profile->reg_count; i++) {
+        const meter_register_t* reg = &dq->profile->regs[i];
+        dq_register_t* r = &dq->regs[i];
+        const uint64_t bit = 1ULL << i;
+
+        if (!(*valid & bit)) {
+            // Not read: hold the last value for a while, then give up on it
+            r->window_count = 0;
+            if (r->held_age != DQ_NO_HELD && r->held_age < dq->stale_cycles) {
+                r->held_age++;
+                values[i] = r->held;
+                quality[i] = DQ_STALE;
+            } else {
+                r->held_age = DQ_NO_HELD;
+                values[i] = NAN;
+                quality[i] = DQ_FAILED;
+            }
+            flagged++;
+            continue;
+        }
+
+        const float raw = values[i];
+        if (!dq_in_range(reg, raw)) {
+            *valid &= ~bit;
+            if (r->held_age != DQ_NO_HELD && r->held_age < DQ_NO_HELD - 1) {
+                r->held_age++;
+            }
+            quality[i] = DQ_OUT_OF_RANGE;
+            flagged++;
+            continue;
+        }
+
+        quality[i] = DQ_GOOD;
+        if (dq->spike_filter && r->window_count == 2) {
+            const float median = median3(r->window[0], r->window[1], raw);
+            if (!departs(dq, reg, r->window[0], r->window[1], median) && departs(dq, reg, raw, median, median)) {
+                values[i] = median;
+                quality[i] = DQ_SPIKE_FILTERED;
+                flagged++;
+            }
+        }
+
+        // The window keeps raw reads so a genuine step passes on its second read
+        r->window[1] = r->window[0];
+        r->window[0] = raw;
+        if (r->window_count < 2) {
+            r->window_count++;
+        }
+        r->held = values[i];
+        r->held_age = 0;
+    }
+    return flagged;
+}
+
+char dq_quality_letter(dq_quality_t quality)
+{
+    static const char LETTERS[DQ_COUNT] = { 'G', 'S', 'F', 'R', 'M' };
+    return quality < DQ_COUNT ? LETTERS[quality] : '?';
+}
+
+const char* dq_quality_name(dq_quality_t quality)
+{
+    static const char* const NAMES[DQ_COUNT] = { "good", "stale", "failed", "out_of_range", "spike_filtered" };
+    return quality < DQ_COUNT ? NAMES[quality] : "unknown";
+}
+
+uint64_t dq_flag_mask(const uint8_t* quality, uint8_t reg_count)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < reg_count; i++) {
+        if (quality[i] == DQ_SPIKE_FILTERED || quality[i] == DQ_OUT_OF_RANGE) {
+            mask |= 1ULL << i;
+        }
+    }
+    return mask;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file data_quality.h
+ * @brief Per-register quality of a reading: plausibility check, stale hold, median-of-3 spike filter
+ *
+ * Every register of a reading gets one quality code. A value that was read
+ * and is physically plausible is good, or spike-filtered when it departs
+ * from a stable recent history and the median of the last three reads takes
+ * its place. An implausible value (NaN, voltage above 500 V, frequency
+ * outside 45-65 Hz, |PF| above 1.1) is out of range and withheld. A register
+ * that was not read keeps its last published value for a few cycles as
+ * stale, then becomes failed.
+ *
+ * Only good and spike-filtered registers stay set in the reading's valid
+ * mask, so statistics, energy integration and the binary columns see fresh
+ * values only; a stale value sits in values[] with its bit clear.
+ *
+ * Like sample_codec.c this has no ESP-IDF dependencies.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "meter_profiles.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    DQ_GOOD = 0,                // Read this cycle and plausible
+    DQ_STALE,                   // Not read this cycle, last value held
+    DQ_FAILED,                  // Not read, nothing to hold
+    DQ_OUT_OF_RANGE,            // Read but implausible, withheld
+    DQ_SPIKE_FILTERED,          // Read, replaced by the median of the last three reads
+    DQ_COUNT
+} dq_quality_t;
+
+/**
+ * @brief History of one register
+ */
+typedef struct {
+    float window[2];            // Previous two plausible reads, newest first (raw, not filtered)
+    float held;                 // Last good or filtered value
+    uint8_t window_count;
+    uint8_t held_age;           // Cycles since held was set, 0xFF when there is none
+} dq_register_t;
+
+/**
+ * @brief Filter state of a profile
+ *
+ * Owned by the acquisition task; not thread-safe.
+ */
+typedef struct {
+    const meter_profile_t* profile;
+    bool spike_filter;
+    uint16_t spike_threshold_pct;
+    uint8_t stale_cycles;
+    dq_register_t regs[METER_MAX_REGISTERS];
+} dq_filter_t;
+
+/**
+ * @brief Reset the history
+ *
+ * @param spike_filter        Replace spikes with the median of the last three reads
+ * @param spike_threshold_pct Departure from the median, in percent of it, that makes a spike
+ * @param stale_cycles        Cycles a register that was not read keeps its last value
+ */
+void dq_filter_init(dq_filter_t* dq, const meter_profile_t* profile, bool spike_filter,
+                    uint16_t spike_threshold_pct, uint8_t stale_cycles);
+
+/**
+ * @brief Whether a value is physically plausible for its register
+ */
+bool dq_in_range(const meter_register_t* reg, float value);
+
+/**
+ * @brief Grade a reading and apply the stale hold and the spike filter in place
+ *
+ * A read counts as a spike when the previous two reads agree with each other
+ * and the new one departs from the median of the three by more than the
+ * threshold (and by more than ten counts of display resolution, so a value
+ * resting at zero is not flagged for every flicker). A genuine step is
+ * therefore published one cycle late.
+ *
+ * @param values  Profile-indexed values as read; filtered and held values are written back
+ * @param valid   Registers read this cycle; out-of-range ones are cleared
+ * @param quality Receives a dq_quality_t per register
+ * @return Number of registers that are not good
+ */
+int dq_filter_apply(dq_filter_t* dq, float* values, uint64_t* valid, uint8_t* quality);
+
+/**
+ * @brief One-letter code of a quality, as in the "quality" string of the JSON reading
+ *
+ * G good, S stale, F failed, R out of range, M spike-filtered (median)
+ */
+char dq_quality_letter(dq_quality_t quality);
+
+/**
+ * @brief Name of a quality: "good", "stale", "failed", "out_of_range" or "spike_filtered"
+ */
+const char* dq_quality_name(dq_quality_t quality);
+
+/**
+ * @brief Registers flagged in the binary quality column
+ *
+ * Bit i is set when register i was spike-filtered (its value is present) or
+ * out of range (its value is absent); an absent value without the bit was
+ * not read.
+ */
+uint64_t dq_flag_mask(const uint8_t* quality, uint8_t reg_count);
+
+#ifdef __cplusplus
+}
+#endif
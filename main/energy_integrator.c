@@ -0,0 +1,214 @@
+/**
+ * @file energy_integrator.c
+ * @brief Trapezoidal active energy integration with meter reconciliation and NVS checkpoints
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "energy_integrator.h"
+
+static const char* TAG = "SDM_ENERGY";
+
+#define ENERGY_NVS_NAMESPACE    "energy"
+#define ENERGY_NVS_KEY          "acc"
+#define ENERGY_NVS_VERSION      1
+
+#define US_PER_HOUR             3600000000.0
+
+// Layout persisted in NVS
+typedef struct {
+    uint32_t version;
+    int64_t import_mwh;
+    int64_t export_mwh;
+} energy_checkpoint_t;
+
+esp_err_t energy_integrator_init(energy_integrator_t* ei)
+{
+    memset(ei, 0, sizeof(*ei));
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ENERGY_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG, "ℹ️  No energy checkpoint yet, seeding from meter on first reading");
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+
+    energy_checkpoint_t checkpoint;
+    size_t size = sizeof(checkpoint);
+    err = nvs_get_blob(handle, ENERGY_NVS_KEY, &checkpoint, &size);
+    nvs_close(handle);
+
+    if (err == ESP_OK && size == sizeof(checkpoint) && checkpoint.version == ENERGY_NVS_VERSION) {
+        ei->import_mwh = checkpoint.import_mwh;
+        ei->export_mwh = checkpoint.export_mwh;
+        ei->checkpoint_import_mwh = checkpoint.import_mwh;
+        ei->checkpoint_export_mwh = checkpoint.export_mwh;
+        ESP_LOGI(TAG, "✓ Restored energy checkpoint: import %.3f Wh, export %.3f Wh",
+                 checkpoint.import_mwh / 1000.0, checkpoint.export_mwh / 1000.0);
+        return ESP_OK;
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND || err == ESP_OK) {
+        ESP_LOGW(TAG, "⚠️  Ignoring missing or incompatible energy checkpoint");
+        return ESP_OK;
+    }
+    return err;
+}
+
+/**
+ * @brief Move whole milli-Wh from a fractional carry into an accumulator
+ */
+static void accumulate(int64_t* acc_mwh, double* residual_mwh, double add_mwh)
+{
+    *residual_mwh += add_mwh;
+    double whole = floor(*residual_mwh);
+    *acc_mwh += (int64_t)whole;
+    *residual_mwh -= whole;
+}
+
+void energy_integrator_add_sample(energy_integrator_t* ei, float power_w, int64_t timestamp_us,
+                                  int64_t max_gap_us)
+{
+    if (isnan(power_w) || isinf(power_w)) {
+        return;
+    }
+
+    if (ei->has_last_sample) {
+        const int64_t dt_us = timestamp_us - ei->last_sample_us;
+
+        if (dt_us <= 0 || dt_us > max_gap_us) {
+            ei->gaps++;
+            ESP_LOGD(TAG, "⏭️  Not integrating across %lld ms gap", (long long)(dt_us / 1000));
+        } else {
+            const double p0 = ei->last_power_w;
+            const double p1 = power_w;
+            const double dt = (double)dt_us;
+            double import_wus = 0;  // Energy in W*us
+            double export_wus = 0;
+
+            if ((p0 >= 0 && p1 >= 0) || (p0 <= 0 && p1 <= 0)) {
+                const double area = (p0 + p1) / 2.0 * dt;
+                if (area >= 0) {
+                    import_wus = area;
+                } else {
+                    export_wus = -area;
+                }
+            } else {
+                // Power changed sign: split the trapezoid at the linear zero crossing
+                const double t_zero = dt * p0 / (p0 - p1);
+                const double first = p0 / 2.0 * t_zero;
+                const double second = p1 / 2.0 * (dt - t_zero);
+                import_wus = (first > 0 ? first : 0) + (second > 0 ? second : 0);
+                export_wus = (first < 0 ? -first : 0) + (second < 0 ? -second : 0);
+            }
+
+            // W*us -> mWh: / 3.6e9 us per hour * 1000 mW per W
+            accumulate(&ei->import_mwh, &ei->residual_import_mwh, import_wus * 1000.0 / US_PER_HOUR);
+            accumulate(&ei->export_mwh, &ei->residual_export_mwh, export_wus * 1000.0 / US_PER_HOUR);
+        }
+    }
+
+    ei->last_power_w = power_w;
+    ei->last_sample_us = timestamp_us;
+    ei->has_last_sample = true;
+}
+
+/**
+ * @brief Clamp one accumulator into the window allowed by a truncated meter counter
+ *
+ * @return true if the accumulator had to be corrected
+ */
+static bool reconcile_one(int64_t* acc_mwh, double* residual_mwh, float meter_kwh, uint32_t resolution_wh)
+{
+    if (isnan(meter_kwh) || meter_kwh < 0) {
+        return false;
+    }
+
+    // float32 quantisation at this magnitude (one ulp), in mWh
+    const double ulp_kwh = nextafterf(meter_kwh, INFINITY) - meter_kwh;
+    double step_mwh = ulp_kwh * 1e6;
+    if (step_mwh < resolution_wh * 1000.0) {
+        step_mwh = resolution_wh * 1000.0;
+    }
+
+    const int64_t lower = (int64_t)llround((double)meter_kwh * 1e6);
+    const int64_t upper = lower + (int64_t)ceil(step_mwh);
+
+    if (*acc_mwh < lower) {
+        *acc_mwh = lower;
+        *residual_mwh = 0;
+        return true;
+    } else if (*acc_mwh > upper) {
+        *acc_mwh = upper;
+        *residual_mwh = 0;
+        return true;
+    }
+    return false;
+}
+
+void energy_integrator_reconcile(energy_integrator_t* ei, float meter_import_kwh, float meter_export_kwh,
+                                 uint32_t resolution_wh)
+{
+    const int64_t before_import = ei->import_mwh;
+    const int64_t before_export = ei->export_mwh;
+
+    bool corrected = reconcile_one(&ei->import_mwh, &ei->residual_import_mwh, meter_import_kwh, resolution_wh);
+    corrected |= reconcile_one(&ei->export_mwh, &ei->residual_export_mwh, meter_export_kwh, resolution_wh);
+
+    if (!ei->reconciled) {
+        // First alignment after boot: seeding or restoring is expected, not a correction
+        ei->reconciled = true;
+        ESP_LOGI(TAG, "✓ Energy integrator aligned to meter: import %.3f Wh, export %.3f Wh",
+                 ei->import_mwh / 1000.0, ei->export_mwh / 1000.0);
+    } else if (corrected) {
+        ei->corrections++;
+        ESP_LOGW(TAG, "⚠️  Energy integrator drifted from meter, corrected import %+.3f Wh, export %+.3f Wh",
+                 (ei->import_mwh - before_import) / 1000.0, (ei->export_mwh - before_export) / 1000.0);
+    }
+}
+
+esp_err_t energy_integrator_checkpoint(energy_integrator_t* ei, int64_t now_us, int64_t min_interval_us,
+                                       int64_t min_delta_mwh, bool force)
+{
+    if (!force) {
+        const int64_t delta = llabs(ei->import_mwh - ei->checkpoint_import_mwh) +
+                              llabs(ei->export_mwh - ei->checkpoint_export_mwh);
+        if (now_us - ei->checkpoint_us < min_interval_us || delta < min_delta_mwh) {
+            return ESP_ERR_NOT_FINISHED;
+        }
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ENERGY_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ Failed to open NVS for energy checkpoint: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    const energy_checkpoint_t checkpoint = {
+        .version = ENERGY_NVS_VERSION,
+        .import_mwh = ei->import_mwh,
+        .export_mwh = ei->export_mwh,
+    };
+    err = nvs_set_blob(handle, ENERGY_NVS_KEY, &checkpoint, sizeof(checkpoint));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ Failed to write energy checkpoint: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    ei->checkpoint_us = now_us;
+    ei->checkpoint_import_mwh = ei->import_mwh;
+    ei->checkpoint_export_mwh = ei->export_mwh;
+    ESP_LOGD(TAG, "💾 Energy checkpoint written: import %.3f Wh, export %.3f Wh",
+             ei->import_mwh / 1000.0, ei->export_mwh / 1000.0);
+    return ESP_OK;
+}
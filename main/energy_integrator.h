@@ -0,0 +1,104 @@
+/**
+ * @file energy_integrator.h
+ * @brief High-resolution on-device energy integration from active power samples
+ *
+ * The meter's kWh counters are float32 and only resolve ~7 significant digits, so
+ * at several thousand kWh their granularity is whole Wh or worse. This module
+ * integrates active power samples (trapezoidal rule) into int64 milli-watt-hour
+ * accumulators, keeps them reconciled against the meter counters (which remain
+ * the long-term reference) and checkpoints them to NVS without wearing the flash.
+ *
+ * Sign convention follows the Eastron meters: positive power is import,
+ * negative power is export.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Integrator state
+ *
+ * Owned by the acquisition task; not thread-safe.
+ */
+typedef struct {
+    int64_t import_mwh;             // Integrated import energy (milli-Wh)
+    int64_t export_mwh;             // Integrated export energy (milli-Wh)
+    double residual_import_mwh;     // Sub-mWh carry so no energy is lost to truncation
+    double residual_export_mwh;
+
+    int64_t last_sample_us;         // Timestamp of the previous power sample
+    float last_power_w;
+    bool has_last_sample;
+
+    bool reconciled;                // At least one meter reconciliation done since boot
+    uint32_t corrections;           // Times the integrator was pulled back into the meter's bounds
+    uint32_t gaps;                  // Sample gaps too long to integrate across
+
+    int64_t checkpoint_us;          // Time of the last NVS checkpoint
+    int64_t checkpoint_import_mwh;  // Values at the last NVS checkpoint
+    int64_t checkpoint_export_mwh;
+} energy_integrator_t;
+
+/**
+ * @brief Reset the integrator and restore the last checkpoint from NVS (if any)
+ *
+ * NVS must already be initialised. A missing checkpoint is not an error: the
+ * integrator is then seeded from the meter counters on the first reconcile.
+ */
+esp_err_t energy_integrator_init(energy_integrator_t* ei);
+
+/**
+ * @brief Integrate one active power sample
+ *
+ * The interval since the previous sample is integrated with the trapezoidal rule
+ * and split at the zero crossing when power changes sign. A failed read simply
+ * produces no sample; intervals longer than max_gap_us are skipped and left to
+ * the reconciliation against the meter.
+ *
+ * @param power_w       Active power in W (positive = import)
+ * @param timestamp_us  Sample time, esp_timer_get_time() time base
+ * @param max_gap_us    Longest interval that is still integrated
+ */
+void energy_integrator_add_sample(energy_integrator_t* ei, float power_w, int64_t timestamp_us,
+                                  int64_t max_gap_us);
+
+/**
+ * @brief Reconcile the accumulators against the meter's own counters
+ *
+ * The meter truncates its counters, so the true energy lies in
+ * [counter, counter + step), where step is the larger of the meter resolution
+ * and the float32 quantisation at the counter's magnitude. Accumulators outside
+ * that window are pulled back to its nearest edge.
+ *
+ * @param meter_import_kwh  Meter import active energy counter
+ * @param meter_export_kwh  Meter export active energy counter
+ * @param resolution_wh     Meter counter resolution in Wh
+ */
+void energy_integrator_reconcile(energy_integrator_t* ei, float meter_import_kwh, float meter_export_kwh,
+                                 uint32_t resolution_wh);
+
+/**
+ * @brief Persist the accumulators to NVS if enough has changed
+ *
+ * Writes only when at least min_interval_us has elapsed AND at least
+ * min_delta_mwh of new energy was accumulated since the last checkpoint, which
+ * bounds NVS writes to a few per hour regardless of poll rate.
+ *
+ * @param now_us           Current time, esp_timer_get_time() time base
+ * @param min_interval_us  Minimum time between checkpoints
+ * @param min_delta_mwh    Minimum accumulated change worth persisting
+ * @param force            Write regardless of the thresholds
+ * @return ESP_OK if written, ESP_ERR_NOT_FINISHED if skipped, NVS error otherwise
+ */
+esp_err_t energy_integrator_checkpoint(energy_integrator_t* ei, int64_t now_us, int64_t min_interval_us,
+                                       int64_t min_delta_mwh, bool force);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,149 @@
+/**
+ * @file eth_link.c
+ * @brief Ethernet driver bring-up for the internal EMAC or a W5500 SPI module
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SDM_ETHERNET
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_eth.h"
+#include "esp_idf_version.h"
+#include "driver/gpio.h"
+#if CONFIG_SDM_ETH_W5500
+#include "driver/spi_master.h"
+#endif
+#include "eth_link.h"
+
+static const char* TAG = "SDM_ETH";
+
+#if CONFIG_SDM_ETH_W5500
+#define ETH_SPI_HOST    SPI2_HOST
+#endif
+
+/**
+ * @brief Create the MAC and PHY driver instances for the configured hardware
+ */
+static esp_err_t eth_link_new_mac_phy(esp_eth_mac_t** mac, esp_eth_phy_t** phy)
+{
+    eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
+    eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
+    phy_config.phy_addr = CONFIG_SDM_ETH_PHY_ADDR;
+    phy_config.reset_gpio_num = CONFIG_SDM_ETH_PHY_RST_GPIO;
+
+#if CONFIG_SDM_ETH_INTERNAL_EMAC
+    eth_esp32_emac_config_t emac_config = ETH_ESP32_EMAC_DEFAULT_CONFIG();
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 2, 0)
+    emac_config.smi_gpio.mdc_num = CONFIG_SDM_ETH_MDC_GPIO;
+    emac_config.smi_gpio.mdio_num = CONFIG_SDM_ETH_MDIO_GPIO;
+#else
+    emac_config.smi_mdc_gpio_num = CONFIG_SDM_ETH_MDC_GPIO;
+    emac_config.smi_mdio_gpio_num = CONFIG_SDM_ETH_MDIO_GPIO;
+#endif
+    *mac = esp_eth_mac_new_esp32(&emac_config, &mac_config);
+#if CONFIG_SDM_ETH_PHY_IP101
+    *phy = esp_eth_phy_new_ip101(&phy_config);
+#elif CONFIG_SDM_ETH_PHY_RTL8201
+    *phy = esp_eth_phy_new_rtl8201(&phy_config);
+#else
+    *phy = esp_eth_phy_new_lan87xx(&phy_config);
+#endif
+
+#elif CONFIG_SDM_ETH_W5500
+    spi_bus_config_t bus_config = {
+        .miso_io_num = CONFIG_SDM_ETH_SPI_MISO_GPIO,
+        .mosi_io_num = CONFIG_SDM_ETH_SPI_MOSI_GPIO,
+        .sclk_io_num = CONFIG_SDM_ETH_SPI_SCLK_GPIO,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+    };
+    esp_err_t err = spi_bus_initialize(ETH_SPI_HOST, &bus_config, SPI_DMA_CH_AUTO);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ SPI bus initialization failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    // The W5500 signals received frames through an interrupt line
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+
+    spi_device_interface_config_t spi_device = {
+        .mode = 0,
+        .clock_speed_hz = CONFIG_SDM_ETH_SPI_CLOCK_MHZ * 1000 * 1000,
+        .spics_io_num = CONFIG_SDM_ETH_SPI_CS_GPIO,
+        .queue_size = 20,
+    };
+    eth_w5500_config_t w5500_config = ETH_W5500_DEFAULT_CONFIG(ETH_SPI_HOST, &spi_device);
+    w5500_config.int_gpio_num = CONFIG_SDM_ETH_SPI_INT_GPIO;
+    *mac = esp_eth_mac_new_w5500(&w5500_config, &mac_config);
+    *phy = esp_eth_phy_new_w5500(&phy_config);
+#endif
+
+    if (*mac == NULL || *phy == NULL) {
+        ESP_LOGE(TAG, "❌ Failed to create Ethernet MAC/PHY driver");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t eth_link_init(esp_netif_t** netif)
+{
+    esp_eth_mac_t* mac = NULL;
+    esp_eth_phy_t* phy = NULL;
+    esp_err_t err = eth_link_new_mac_phy(&mac, &phy);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    esp_eth_config_t eth_config = ETH_DEFAULT_CONFIG(mac, phy);
+    esp_eth_handle_t eth_handle = NULL;
+    err = esp_eth_driver_install(&eth_config, &eth_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ Ethernet driver install failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+#if CONFIG_SDM_ETH_W5500
+    // The W5500 has no factory MAC address: use the one reserved for Ethernet in eFuse
+    uint8_t mac_addr[6];
+    esp_read_mac(mac_addr, ESP_MAC_ETH);
+    esp_eth_ioctl(eth_handle, ETH_CMD_S_MAC_ADDR, mac_addr);
+#endif
+
+    // Own netif with a route priority above WiFi: Ethernet carries the default route when up
+    esp_netif_inherent_config_t base_config = ESP_NETIF_INHERENT_DEFAULT_ETH();
+    base_config.route_prio = ETH_LINK_ROUTE_PRIO;
+    esp_netif_config_t netif_config = {
+        .base = &base_config,
+        .stack = ESP_NETIF_NETSTACK_DEFAULT_ETH,
+    };
+    *netif = esp_netif_new(&netif_config);
+    if (*netif == NULL) {
+        ESP_LOGE(TAG, "❌ Failed to create Ethernet network interface");
+        return ESP_FAIL;
+    }
+
+    err = esp_netif_attach(*netif, esp_eth_new_netif_glue(eth_handle));
+    if (err == ESP_OK) {
+        err = esp_eth_start(eth_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ Failed to start Ethernet: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    ESP_LOGI(TAG, "✓ Ethernet started (%s)",
+#if CONFIG_SDM_ETH_W5500
+             "W5500 SPI"
+#else
+             "internal EMAC"
+#endif
+    );
+    return ESP_OK;
+}
+
+#endif // CONFIG_SDM_ETHERNET
@@ -0,0 +1,37 @@
+/**
+ * @file eth_link.h
+ * @brief Ethernet network backend (ESP32 internal EMAC + RMII PHY, or SPI W5500)
+ *
+ * Brings up the Ethernet driver selected in menuconfig and attaches it to its own
+ * esp_netif. The netif gets a higher route priority than the WiFi station, so
+ * Ethernet is the primary path whenever it has an address and WiFi stays
+ * connected as a hot standby.
+ *
+ * Link state is reported through the standard ETH_EVENT / IP_EVENT_ETH_* events;
+ * failover between the interfaces is handled by the application.
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ETH_LINK_ROUTE_PRIO     150     // Above the WiFi station's default of 100
+
+/**
+ * @brief Install the Ethernet driver, create its netif and start it
+ *
+ * The event loop and esp_netif must already be initialised. Returns as soon as
+ * the driver is running; the link comes up asynchronously.
+ *
+ * @param netif Created Ethernet netif
+ * @return ESP_OK on success, driver error otherwise
+ */
+esp_err_t eth_link_init(esp_netif_t** netif);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,386 @@
+/**
+ * @file flash_log.c
+ * @brief Flash ring: mount-time recovery, page-sized appends and range reads
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_rom_crc.h"
+#include "flash_log.h"
+
+#define FLASH_LOG_MAGIC         0x4C4D4453          // "SDML"
+#define FLASH_LOG_ERASED_LEN    0xFFFF
+
+static void put_u16(uint8_t* p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static void put_i64(uint8_t* p, int64_t v)
+{
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)((uint64_t)v >> 32));
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int64_t get_i64(const uint8_t* p)
+{
+    return (int64_t)((uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32));
+}
+
+static uint32_t record_crc(const uint8_t* header, const uint8_t* payload, uint16_t len)
+{
+    uint32_t crc = esp_rom_crc32_le(0, header, 4);
+    crc = esp_rom_crc32_le(crc, header + 8, FLASH_LOG_RECORD_HEADER - 8);
+    return esp_rom_crc32_le(crc, payload, len);
+}
+
+/**
+ * @brief Age of a sector (0 = head, used - 1 = oldest) to its physical index
+ */
+static uint32_t sector_phys(const flash_log_t* log, uint32_t age)
+{
+    return (log->head + log->sector_count - age) % log->sector_count;
+}
+
+/**
+ * @brief Read a sector header
+ *
+ * @return true with its sequence number if the header is intact
+ */
+static bool sector_header_read(const flash_log_t* log, uint32_t phys, uint32_t* seq)
+{
+    uint8_t header[FLASH_LOG_SECTOR_HEADER];
+    if (esp_partition_read(log->partition, phys * FLASH_LOG_SECTOR_SIZE, header, sizeof(header)) != ESP_OK ||
+        get_u32(header) != FLASH_LOG_MAGIC || get_u32(header + 8) != esp_rom_crc32_le(0, header, 8)) {
+        return false;
+    }
+    *seq = get_u32(header + 4);
+    return true;
+}
+
+/**
+ * @brief Read and check the record at offset
+ *
+ * @return ESP_OK, ESP_ERR_NOT_FOUND for erased space, ESP_ERR_INVALID_CRC for a
+ *         torn or corrupted record, or a flash read error
+ */
+static esp_err_t record_read(const flash_log_t* log, uint32_t phys, uint32_t offset, uint32_t end,
+                             flash_log_record_t* record, uint8_t* buf)
+{
+    uint8_t header[FLASH_LOG_RECORD_HEADER];
+    if (offset + FLASH_LOG_RECORD_HEADER > end) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = esp_partition_read(log->partition, phys * FLASH_LOG_SECTOR_SIZE + offset, header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    const uint16_t len = get_u16(header);
+    if (len == FLASH_LOG_ERASED_LEN && get_u16(header + 2) == FLASH_LOG_ERASED_LEN) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (len == 0 || len > FLASH_LOG_MAX_PAYLOAD || (get_u16(header + 2) ^ len) != 0xFFFF ||
+        offset + FLASH_LOG_RECORD_HEADER + len > end) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    err = esp_partition_read(log->partition, phys * FLASH_LOG_SECTOR_SIZE + offset + FLASH_LOG_RECORD_HEADER,
+                             buf, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (get_u32(header + 4) != record_crc(header, buf, len)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    record->len = len;
+    record->first_ms = get_i64(header + 8);
+    record->last_ms = get_i64(header + 16);
+    return ESP_OK;
+}
+
+/**
+ * @brief Walk the records of a sector
+ *
+ * @param end_offset Receives the end of the last good record
+ * @param last_ms    Receives its last time (unchanged if the sector has none)
+ * @return true if only erased space follows, so appending can continue
+ */
+static bool sector_scan(const flash_log_t* log, uint32_t phys, uint32_t* end_offset, int64_t* last_ms)
+{
+    uint8_t buf[FLASH_LOG_RECORD_SIZE];
+    flash_log_record_t record;
+    uint32_t offset = FLASH_LOG_SECTOR_HEADER;
+    esp_err_t err;
+    while ((err = record_read(log, phys, offset, FLASH_LOG_SECTOR_SIZE, &record, buf)) == ESP_OK) {
+        offset += FLASH_LOG_RECORD_HEADER + record.len;
+        *last_ms = record.last_ms;
+    }
+    *end_offset = offset;
+    if (err != ESP_ERR_NOT_FOUND) {
+        return false;
+    }
+
+    // A write cut short before its header landed still leaves programmed bits behind
+    for (uint32_t pos = offset; pos < FLASH_LOG_SECTOR_SIZE; pos += sizeof(buf)) {
+        const uint32_t n = FLASH_LOG_SECTOR_SIZE - pos < sizeof(buf) ? FLASH_LOG_SECTOR_SIZE - pos : sizeof(buf);
+        if (esp_partition_read(log->partition, phys * FLASH_LOG_SECTOR_SIZE + pos, buf, n) != ESP_OK) {
+            return false;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (buf[i] != 0xFF) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+esp_err_t flash_log_mount(flash_log_t* log, const char* label, uint32_t budget_per_hour, int64_t now_ms)
+{
+    memset(log, 0, sizeof(*log));
+    log->partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (log->partition == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    log->sector_count = log->partition->size / FLASH_LOG_SECTOR_SIZE;
+    if (log->sector_count < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    log->first_ms = malloc(log->sector_count * sizeof(*log->first_ms));
+    uint32_t* seqs = malloc(log->sector_count * sizeof(*seqs));
+    if (log->first_ms == NULL || seqs == NULL) {
+        free(log->first_ms);
+        free(seqs);
+        log->first_ms = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Every intact sector header; the newest sector has the highest sequence
+    bool found = false;
+    for (uint32_t i = 0; i < log->sector_count; i++) {
+        log->first_ms[i] = FLASH_LOG_NO_TIME;
+        const bool valid = sector_header_read(log, i, &seqs[i]);
+        if (!valid) {
+            seqs[i] = 0;
+        } else if (!found || seqs[i] > log->head_seq) {
+            found = true;
+            log->head = i;
+            log->head_seq = seqs[i];
+        }
+    }
+
+    // The log is the run of consecutive sequence numbers ending at the head
+    uint8_t buf[FLASH_LOG_RECORD_SIZE];
+    flash_log_record_t record;
+    while (found && log->used < log->sector_count) {
+        const uint32_t phys = sector_phys(log, log->used);
+        if (seqs[phys] != log->head_seq - log->used || (log->used > 0 && seqs[phys] == 0)) {
+            break;
+        }
+        if (record_read(log, phys, FLASH_LOG_SECTOR_HEADER, FLASH_LOG_SECTOR_SIZE, &record, buf) == ESP_OK) {
+            log->first_ms[phys] = record.first_ms;
+        }
+        log->used++;
+    }
+    free(seqs);
+
+    if (log->used == 0) {
+        // Empty: the first append opens sector 0
+        log->head = log->sector_count - 1;
+        log->head_used = FLASH_LOG_SECTOR_SIZE;
+    } else if (!sector_scan(log, log->head, &log->head_used, &log->last_ms)) {
+        log->head_used = FLASH_LOG_SECTOR_SIZE;     // Torn write: never program over it
+    }
+    // The newest record sits in an earlier sector when the head is still empty
+    for (uint32_t age = 1; age < log->used && log->first_ms[log->head] == FLASH_LOG_NO_TIME; age++) {
+        if (log->first_ms[sector_phys(log, age)] != FLASH_LOG_NO_TIME) {
+            uint32_t end;
+            sector_scan(log, sector_phys(log, age), &end, &log->last_ms);
+            break;
+        }
+    }
+
+    log->budget_per_hour = budget_per_hour;
+    log->tokens = FLASH_LOG_RECORD_SIZE;            // One record right away, the rest earned over time
+    log->refill_ms = now_ms;
+    return ESP_OK;
+}
+
+/**
+ * @brief Add the tokens earned since the last refill, up to one hour's budget
+ */
+static void budget_refill(flash_log_t* log, int64_t now_ms)
+{
+    if (log->budget_per_hour == 0) {
+        return;
+    }
+    const int64_t earned = (now_ms - log->refill_ms) * log->budget_per_hour / 3600000;
+    if (earned <= 0) {
+        return;
+    }
+    // Advance only by the time actually converted, so fractions of a byte are not lost
+    log->refill_ms += earned * 3600000 / log->budget_per_hour;
+    log->tokens = (uint64_t)log->tokens + earned > log->budget_per_hour
+                      ? log->budget_per_hour : log->tokens + (uint32_t)earned;
+}
+
+/**
+ * @brief Erase the sector after the head and make it the new head
+ */
+static esp_err_t sector_open(flash_log_t* log)
+{
+    const uint32_t next = (log->head + 1) % log->sector_count;
+    esp_err_t err = esp_partition_erase_range(log->partition, next * FLASH_LOG_SECTOR_SIZE, FLASH_LOG_SECTOR_SIZE);
+    log->first_ms[next] = FLASH_LOG_NO_TIME;
+    if (err == ESP_OK) {
+        log->erases++;
+        uint8_t header[FLASH_LOG_SECTOR_HEADER];
+        put_u32(header, FLASH_LOG_MAGIC);
+        put_u32(header + 4, log->head_seq + 1);
+        put_u32(header + 8, esp_rom_crc32_le(0, header, 8));
+        put_u32(header + 12, 0xFFFFFFFF);
+        err = esp_partition_write(log->partition, next * FLASH_LOG_SECTOR_SIZE, header, sizeof(header));
+    }
+    if (log->used >= log->sector_count) {
+        log->used--;                                // The oldest sector is gone either way
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    log->head = next;
+    log->head_seq++;
+    log->head_used = FLASH_LOG_SECTOR_HEADER;
+    log->used++;
+    return ESP_OK;
+}
+
+esp_err_t flash_log_append(flash_log_t* log, const uint8_t* data, size_t len,
+                           int64_t first_ms, int64_t last_ms, int64_t now_ms)
+{
+    if (log->first_ms == NULL || len == 0 || len > FLASH_LOG_MAX_PAYLOAD ||
+        last_ms < first_ms || (log->used > 0 && first_ms < log->last_ms)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint32_t size = FLASH_LOG_RECORD_HEADER + len;
+    budget_refill(log, now_ms);
+    if (log->tokens < size) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    if (log->head_used + size > FLASH_LOG_SECTOR_SIZE) {
+        esp_err_t err = sector_open(log);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    uint8_t record[FLASH_LOG_RECORD_SIZE];
+    put_u16(record, (uint16_t)len);
+    put_u16(record + 2, (uint16_t)(len ^ 0xFFFF));
+    put_i64(record + 8, first_ms);
+    put_i64(record + 16, last_ms);
+    memcpy(record + FLASH_LOG_RECORD_HEADER, data, len);
+    put_u32(record + 4, record_crc(record, data, (uint16_t)len));
+
+    esp_err_t err = esp_partition_write(log->partition, log->head * FLASH_LOG_SECTOR_SIZE + log->head_used,
+                                        record, size);
+    log->tokens -= size;
+    if (err != ESP_OK) {
+        log->head_used = FLASH_LOG_SECTOR_SIZE;     // State of the page unknown: continue in a fresh sector
+        return err;
+    }
+    if (log->first_ms[log->head] == FLASH_LOG_NO_TIME) {
+        log->first_ms[log->head] = first_ms;
+    }
+    log->head_used += size;
+    log->last_ms = last_ms;
+    log->bytes_written += size;
+    return ESP_OK;
+}
+
+bool flash_log_extent(const flash_log_t* log, int64_t* oldest_ms, int64_t* newest_ms)
+{
+    for (uint32_t age = log->used; age-- > 0; ) {
+        const int64_t first = log->first_ms[sector_phys(log, age)];
+        if (first != FLASH_LOG_NO_TIME) {
+            *oldest_ms = first;
+            *newest_ms = log->last_ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+void flash_log_seek(const flash_log_t* log, int64_t from_ms, int64_t to_ms, flash_log_cursor_t* cursor)
+{
+    cursor->from_ms = from_ms;
+    cursor->to_ms = to_ms;
+    cursor->offset = FLASH_LOG_SECTOR_HEADER;
+    cursor->seq = log->head_seq - (log->used > 0 ? log->used - 1 : 0);
+
+    // Newest sector starting at or before from_ms: ages [lo, hi) are candidates
+    uint32_t lo = 0;
+    uint32_t hi = log->used;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const int64_t first = log->first_ms[sector_phys(log, mid)];
+        if (first != FLASH_LOG_NO_TIME && first <= from_ms) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    if (lo < log->used) {
+        cursor->seq = log->head_seq - lo;
+    }
+}
+
+esp_err_t flash_log_next(const flash_log_t* log, flash_log_cursor_t* cursor,
+                         flash_log_record_t* record, uint8_t* buf)
+{
+    while (log->used > 0 && (int32_t)(log->head_seq - cursor->seq) >= 0) {
+        uint32_t age = log->head_seq - cursor->seq;
+        if (age >= log->used) {
+            // Overwritten while the query ran: continue with the oldest sector
+            age = log->used - 1;
+            cursor->seq = log->head_seq - age;
+            cursor->offset = FLASH_LOG_SECTOR_HEADER;
+        }
+        const uint32_t end = age == 0 ? log->head_used : FLASH_LOG_SECTOR_SIZE;
+        esp_err_t err = record_read(log, sector_phys(log, age), cursor->offset, end, record, buf);
+        if (err == ESP_OK) {
+            cursor->offset += FLASH_LOG_RECORD_HEADER + record->len;
+            if (record->first_ms > cursor->to_ms) {
+                break;
+            }
+            if (record->last_ms >= cursor->from_ms) {
+                return ESP_OK;
+            }
+        } else if (err == ESP_ERR_NOT_FOUND || err == ESP_ERR_INVALID_CRC) {
+            cursor->seq++;                          // End of this sector's records
+            cursor->offset = FLASH_LOG_SECTOR_HEADER;
+        } else {
+            return err;
+        }
+    }
+    cursor->seq = log->head_seq + 1;                // Stay at the end
+    return ESP_ERR_NOT_FOUND;
+}
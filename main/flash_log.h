@@ -0,0 +1,169 @@
+/**
+ * @file flash_log.h
+ * @brief Append-only time-series log in a raw flash partition ring
+ *
+ * The partition is used as a ring of 4 KB sectors, written strictly in order
+ * and erased one sector ahead of the writer, so every sector is erased once
+ * per pass over the ring: wear is spread evenly without a translation layer.
+ * Data is appended as records covering a time range, each at most two
+ * 256-byte flash program pages long so that eight fill a sector exactly; the
+ * caller batches samples into page-sized records (see sample_codec.h) rather
+ * than programming flash for every sample.
+ *
+ * Sector layout (little-endian):
+ *
+ *   u32 magic "SDML" | u32 sequence | u32 CRC32 of the previous 8 bytes | u32 0xFFFFFFFF
+ *   records, then erased (0xFF) space
+ *
+ * Record layout:
+ *
+ *   u16 length | u16 ~length | u32 CRC32 | i64 first time (ms) | i64 last time (ms)
+ *   payload
+ *
+ * The CRC covers the length fields, the two times and the payload. The
+ * sequence number grows by one per sector opened, so after a reboot the
+ * newest sector is the one with the highest sequence and the ring is walked
+ * back from it. Power loss can leave a half-erased sector without a valid
+ * header or a record with a bad CRC; both are dropped at mount, and a head
+ * sector with anything but erased space after its last good record is closed
+ * rather than written over.
+ *
+ * Record times must not go backwards, so the first time of every sector
+ * forms a sorted index kept in RAM (8 bytes per sector): a range lookup is a
+ * binary search over sectors followed by a scan of at most one sector.
+ *
+ * A token bucket limits the bytes programmed per hour; every 4 KB of records
+ * costs one sector erase.
+ *
+ * The log is not thread-safe: the caller serialises appends and reads.
+ *
+ * flash_log.c only needs the partition and CRC calls, which tools/host
+ * stands in for, so tools/flash_log_powercut.c runs this code against a
+ * simulated NOR flash with power cuts. flash_log_query_parse() lives in
+ * flash_log_query.c.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FLASH_LOG_SECTOR_SIZE       4096
+#define FLASH_LOG_SECTOR_HEADER     16
+#define FLASH_LOG_RECORD_HEADER     24
+#define FLASH_LOG_RECORD_SIZE       ((FLASH_LOG_SECTOR_SIZE - FLASH_LOG_SECTOR_HEADER) / 8)    // Largest record, header included
+#define FLASH_LOG_MAX_PAYLOAD       (FLASH_LOG_RECORD_SIZE - FLASH_LOG_RECORD_HEADER)
+#define FLASH_LOG_NO_TIME           INT64_MIN           // Sector index entry without records
+
+/**
+ * @brief Log state
+ */
+typedef struct {
+    const esp_partition_t* partition;
+    uint32_t sector_count;
+    int64_t* first_ms;              // Per physical sector: first time of its records, or FLASH_LOG_NO_TIME
+    uint32_t head;                  // Sector being appended to
+    uint32_t head_seq;              // Its sequence number
+    uint32_t head_used;             // Bytes used in it; FLASH_LOG_SECTOR_SIZE once closed
+    uint32_t used;                  // Sectors holding the log, head included (0 = empty)
+    int64_t last_ms;                // Last time of the newest record
+
+    uint32_t budget_per_hour;       // Bytes that may be programmed per hour
+    uint32_t tokens;                // Bytes that may be programmed now
+    int64_t refill_ms;              // Time tokens were last added
+
+    uint32_t bytes_written;         // Record bytes programmed since boot
+    uint32_t erases;                // Sectors erased since boot
+} flash_log_t;
+
+/**
+ * @brief Read position of a range query
+ */
+typedef struct {
+    uint32_t seq;                   // Sector being read
+    uint32_t offset;                // Next record in it
+    int64_t from_ms;
+    int64_t to_ms;
+} flash_log_cursor_t;
+
+/**
+ * @brief Header fields of a record returned by flash_log_next()
+ */
+typedef struct {
+    int64_t first_ms;
+    int64_t last_ms;
+    uint16_t len;
+} flash_log_record_t;
+
+/**
+ * @brief Find the partition, rebuild the index and recover the append position
+ *
+ * @param label           Partition label
+ * @param budget_per_hour Bytes that may be programmed per hour
+ * @param now_ms          Current monotonic time (starts the budget)
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without the partition, ESP_ERR_INVALID_SIZE
+ *         if it is smaller than two sectors, ESP_ERR_NO_MEM, or a flash read error
+ */
+esp_err_t flash_log_mount(flash_log_t* log, const char* label, uint32_t budget_per_hour, int64_t now_ms);
+
+/**
+ * @brief Append a record, opening (and erasing) the next sector when the head is full
+ *
+ * When the ring is full the oldest sector is overwritten.
+ *
+ * @param data     Payload, at most FLASH_LOG_MAX_PAYLOAD bytes
+ * @param first_ms Time of the first sample in the payload, not before the previous record's last
+ * @param last_ms  Time of the last sample in the payload
+ * @param now_ms   Current monotonic time, for the write budget
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a bad size or times going backwards,
+ *         ESP_ERR_TIMEOUT when the hourly budget is used up (retry later),
+ *         or a flash erase/write error
+ */
+esp_err_t flash_log_append(flash_log_t* log, const uint8_t* data, size_t len,
+                           int64_t first_ms, int64_t last_ms, int64_t now_ms);
+
+/**
+ * @brief Time span held by the log
+ *
+ * @return false if the log is empty
+ */
+bool flash_log_extent(const flash_log_t* log, int64_t* oldest_ms, int64_t* newest_ms);
+
+/**
+ * @brief Start a range query: find the first sector that can hold from_ms
+ */
+void flash_log_seek(const flash_log_t* log, int64_t from_ms, int64_t to_ms, flash_log_cursor_t* cursor);
+
+/**
+ * @brief Read the next record overlapping the cursor's range
+ *
+ * Sectors overwritten since the query started are skipped.
+ *
+ * @param buf  Receives the payload, at least FLASH_LOG_MAX_PAYLOAD bytes
+ * @return ESP_OK, ESP_ERR_NOT_FOUND at the end of the range, or a flash read error
+ */
+esp_err_t flash_log_next(const flash_log_t* log, flash_log_cursor_t* cursor,
+                         flash_log_record_t* record, uint8_t* buf);
+
+/**
+ * @brief Validate a cmd/log payload: {"from":ms,"to":ms,"id":n}
+ *
+ * All keys are optional; from and to default to the whole log.
+ *
+ * @param id         Receives the command id (-1 if none), filled even on error
+ * @param error      Receives a short description of the first problem found (raw text,
+ *                   may contain an unknown key from the payload)
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a schema violation
+ */
+esp_err_t flash_log_query_parse(const char* json, int len, int64_t* from_ms, int64_t* to_ms,
+                                int32_t* id, char* error, size_t error_size);
+
+#ifdef __cplusplus
+}
+#endif
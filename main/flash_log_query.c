@@ -0,0 +1,63 @@
+/**
+ * @file flash_log_query.c
+ * @brief cmd/log payload parsing
+ *
+ * Kept apart from flash_log.c so the ring builds on a host without cJSON
+ * (tools/flash_log_powercut.c).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cJSON.h"
+#include "flash_log.h"
+
+esp_err_t flash_log_query_parse(const char* json, int len, int64_t* from_ms, int64_t* to_ms,
+                                int32_t* id, char* error, size_t error_size)
+{
+    *from_ms = INT64_MIN;
+    *to_ms = INT64_MAX;
+    *id = -1;
+    error[0] = '\0';
+
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (root == NULL || !cJSON_IsObject(root)) {
+        snprintf(error, error_size, "payload must be a JSON object");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool ok = true;
+    const cJSON* item;
+    cJSON_ArrayForEach(item, root) {
+        const double value = cJSON_IsNumber(item) ? item->valuedouble : -1.0;
+        if (strcmp(item->string, "from") == 0 || strcmp(item->string, "to") == 0) {
+            // UTC milliseconds are exact in a double well past the year 200000
+            ok = value >= 0 && value < 9.0e15 && value == (double)(int64_t)value;
+            if (ok) {
+                *(item->string[0] == 'f' ? from_ms : to_ms) = (int64_t)value;
+            } else {
+                snprintf(error, error_size, "%s must be a UTC time in milliseconds", item->string);
+            }
+        } else if (strcmp(item->string, "id") == 0) {
+            ok = value >= 0 && value <= INT32_MAX && value == (double)(int32_t)value;
+            if (ok) {
+                *id = (int32_t)value;
+            } else {
+                snprintf(error, error_size, "id must be a non-negative integer");
+            }
+        } else {
+            snprintf(error, error_size, "unknown key %.32s", item->string);
+            ok = false;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    cJSON_Delete(root);
+
+    if (ok && *from_ms > *to_ms) {
+        snprintf(error, error_size, "from is after to");
+        ok = false;
+    }
+    return ok ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
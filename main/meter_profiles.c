@@ -0,0 +1,248 @@
+/**
+ * @file meter_profiles.c
+ * @brief Compiled-in register maps for the Eastron SDM meter family
+ *
+ * Register addresses follow the Eastron Modbus protocol documents for each model.
+ * Tables are static const (flash resident) and sorted by register address so the
+ * block planner can walk them in a single pass.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include "sdkconfig.h"
+#include "meter_profiles.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Shorthand for a register table entry
+#define REG(addr, qty, ph, prec, key, topic, name, unit, dev_class, state_class, icon) \
+    { (addr), (qty), (ph), (prec), (key), (topic), (name), (unit), (dev_class), (state_class), (icon) }
+
+#define MEAS    "measurement"
+#define TOTAL   "total_increasing"
+
+/* ===== SINGLE-PHASE: SDM120 / SDM230 =====
+ * Both meters share the same input register map. Topic names of the first ten
+ * entries are unchanged from the original fixed SDM120 implementation.
+ */
+static const meter_register_t s_sdm120_regs[] = {
+    REG(0x0000, QTY_VOLTAGE,                 0, 2, "Voltage",                 "voltage",                 "Voltage",                 "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0006, QTY_CURRENT,                 0, 3, "Current",                 "current",                 "Current",                 "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x000C, QTY_ACTIVE_POWER,            0, 2, "Active_Power",            "active_power",            "Active Power",            "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0012, QTY_APPARENT_POWER,          0, 2, "Apparent_Power",          "apparent_power",          "Apparent Power",          "VA",   "apparent_power", MEAS,  "mdi:flash-outline"),
+    REG(0x0018, QTY_REACTIVE_POWER,          0, 2, "Reactive_Power",          "reactive_power",          "Reactive Power",          "var",  "reactive_power", MEAS,  "mdi:flash-outline"),
+    REG(0x001E, QTY_POWER_FACTOR,            0, 3, "Power_Factor",            "power_factor",            "Power Factor",            "",     "power_factor",   MEAS,  "mdi:cosine-wave"),
+    REG(0x0024, QTY_PHASE_ANGLE,             0, 1, "Phase_Angle",             "phase_angle",             "Phase Angle",             "°",    "",               MEAS,  "mdi:angle-acute"),
+    REG(0x0046, QTY_FREQUENCY,               0, 2, "Frequency",               "frequency",               "Frequency",               "Hz",   "frequency",      MEAS,  "mdi:sine-wave"),
+    REG(0x0048, QTY_IMPORT_ACTIVE_ENERGY,    0, 3, "Import_Active_Energy",    "import_energy",           "Import Energy",           "kWh",  "energy",         TOTAL, "mdi:transmission-tower-import"),
+    REG(0x004A, QTY_EXPORT_ACTIVE_ENERGY,    0, 3, "Export_Active_Energy",    "export_energy",           "Export Energy",           "kWh",  "energy",         TOTAL, "mdi:transmission-tower-export"),
+    REG(0x004C, QTY_IMPORT_REACTIVE_ENERGY,  0, 3, "Import_Reactive_Energy",  "import_reactive_energy",  "Import Reactive Energy",  "kvarh", "",              TOTAL, "mdi:transmission-tower-import"),
+    REG(0x004E, QTY_EXPORT_REACTIVE_ENERGY,  0, 3, "Export_Reactive_Energy",  "export_reactive_energy",  "Export Reactive Energy",  "kvarh", "",              TOTAL, "mdi:transmission-tower-export"),
+    REG(0x0054, QTY_POWER_DEMAND,            0, 2, "Total_Power_Demand",      "power_demand",            "Total Power Demand",      "W",    "power",          MEAS,  "mdi:chart-bell-curve"),
+    REG(0x0056, QTY_MAX_POWER_DEMAND,        0, 2, "Max_Power_Demand",        "max_power_demand",        "Max Power Demand",        "W",    "power",          MEAS,  "mdi:chart-bell-curve-cumulative"),
+    REG(0x0058, QTY_IMPORT_POWER_DEMAND,     0, 2, "Import_Power_Demand",     "import_power_demand",     "Import Power Demand",     "W",    "power",          MEAS,  "mdi:chart-bell-curve"),
+    REG(0x005A, QTY_MAX_IMPORT_POWER_DEMAND, 0, 2, "Max_Import_Power_Demand", "max_import_power_demand", "Max Import Power Demand", "W",    "power",          MEAS,  "mdi:chart-bell-curve-cumulative"),
+    REG(0x005C, QTY_EXPORT_POWER_DEMAND,     0, 2, "Export_Power_Demand",     "export_power_demand",     "Export Power Demand",     "W",    "power",          MEAS,  "mdi:chart-bell-curve"),
+    REG(0x005E, QTY_MAX_EXPORT_POWER_DEMAND, 0, 2, "Max_Export_Power_Demand", "max_export_power_demand", "Max Export Power Demand", "W",    "power",          MEAS,  "mdi:chart-bell-curve-cumulative"),
+    REG(0x0102, QTY_CURRENT_DEMAND,          0, 3, "Current_Demand",          "current_demand",          "Current Demand",          "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x0108, QTY_MAX_CURRENT_DEMAND,      0, 3, "Max_Current_Demand",      "max_current_demand",      "Max Current Demand",      "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x0156, QTY_TOTAL_ACTIVE_ENERGY,     0, 3, "Total_Active_Energy",     "total_energy",            "Total Energy",            "kWh",  "energy",         TOTAL, "mdi:lightning-bolt"),
+    REG(0x0158, QTY_TOTAL_REACTIVE_ENERGY,   0, 3, "Total_Reactive_Energy",   "total_reactive_energy",   "Total Reactive Energy",   "kvarh", "",              TOTAL, "mdi:lightning-bolt-outline"),
+};
+
+/* ===== THREE-PHASE: SDM72D-M (V2) ===== */
+static const meter_register_t s_sdm72_regs[] = {
+    REG(0x0000, QTY_VOLTAGE,                 1, 2, "L1_Voltage",              "voltage_l1",              "L1 Voltage",              "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0002, QTY_VOLTAGE,                 2, 2, "L2_Voltage",              "voltage_l2",              "L2 Voltage",              "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0004, QTY_VOLTAGE,                 3, 2, "L3_Voltage",              "voltage_l3",              "L3 Voltage",              "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0006, QTY_CURRENT,                 1, 3, "L1_Current",              "current_l1",              "L1 Current",              "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x0008, QTY_CURRENT,                 2, 3, "L2_Current",              "current_l2",              "L2 Current",              "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x000A, QTY_CURRENT,                 3, 3, "L3_Current",              "current_l3",              "L3 Current",              "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x000C, QTY_ACTIVE_POWER,            1, 2, "L1_Active_Power",         "active_power_l1",         "L1 Active Power",         "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x000E, QTY_ACTIVE_POWER,            2, 2, "L2_Active_Power",         "active_power_l2",         "L2 Active Power",         "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0010, QTY_ACTIVE_POWER,            3, 2, "L3_Active_Power",         "active_power_l3",         "L3 Active Power",         "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0034, QTY_ACTIVE_POWER,            0, 2, "Total_Active_Power",      "active_power",            "Total Active Power",      "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0038, QTY_APPARENT_POWER,          0, 2, "Total_Apparent_Power",    "apparent_power",          "Total Apparent Power",    "VA",   "apparent_power", MEAS,  "mdi:flash-outline"),
+    REG(0x003C, QTY_REACTIVE_POWER,          0, 2, "Total_Reactive_Power",    "reactive_power",          "Total Reactive Power",    "var",  "reactive_power", MEAS,  "mdi:flash-outline"),
+    REG(0x003E, QTY_POWER_FACTOR,            0, 3, "Total_Power_Factor",      "power_factor",            "Total Power Factor",      "",     "power_factor",   MEAS,  "mdi:cosine-wave"),
+    REG(0x0046, QTY_FREQUENCY,               0, 2, "Frequency",               "frequency",               "Frequency",               "Hz",   "frequency",      MEAS,  "mdi:sine-wave"),
+    REG(0x0048, QTY_IMPORT_ACTIVE_ENERGY,    0, 3, "Import_Active_Energy",    "import_energy",           "Import Energy",           "kWh",  "energy",         TOTAL, "mdi:transmission-tower-import"),
+    REG(0x004A, QTY_EXPORT_ACTIVE_ENERGY,    0, 3, "Export_Active_Energy",    "export_energy",           "Export Energy",           "kWh",  "energy",         TOTAL, "mdi:transmission-tower-export"),
+    REG(0x0156, QTY_TOTAL_ACTIVE_ENERGY,     0, 3, "Total_Active_Energy",     "total_energy",            "Total Energy",            "kWh",  "energy",         TOTAL, "mdi:lightning-bolt"),
+};
+
+/* ===== THREE-PHASE: SDM630 (V2) ===== */
+static const meter_register_t s_sdm630_regs[] = {
+    REG(0x0000, QTY_VOLTAGE,                 1, 2, "L1_Voltage",              "voltage_l1",              "L1 Voltage",              "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0002, QTY_VOLTAGE,                 2, 2, "L2_Voltage",              "voltage_l2",              "L2 Voltage",              "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0004, QTY_VOLTAGE,                 3, 2, "L3_Voltage",              "voltage_l3",              "L3 Voltage",              "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x0006, QTY_CURRENT,                 1, 3, "L1_Current",              "current_l1",              "L1 Current",              "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x0008, QTY_CURRENT,                 2, 3, "L2_Current",              "current_l2",              "L2 Current",              "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x000A, QTY_CURRENT,                 3, 3, "L3_Current",              "current_l3",              "L3 Current",              "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x000C, QTY_ACTIVE_POWER,            1, 2, "L1_Active_Power",         "active_power_l1",         "L1 Active Power",         "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x000E, QTY_ACTIVE_POWER,            2, 2, "L2_Active_Power",         "active_power_l2",         "L2 Active Power",         "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0010, QTY_ACTIVE_POWER,            3, 2, "L3_Active_Power",         "active_power_l3",         "L3 Active Power",         "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0012, QTY_APPARENT_POWER,          1, 2, "L1_Apparent_Power",       "apparent_power_l1",       "L1 Apparent Power",       "VA",   "apparent_power", MEAS,  "mdi:flash-outline"),
+    REG(0x0014, QTY_APPARENT_POWER,          2, 2, "L2_Apparent_Power",       "apparent_power_l2",       "L2 Apparent Power",       "VA",   "apparent_power", MEAS,  "mdi:flash-outline"),
+    REG(0x0016, QTY_APPARENT_POWER,          3, 2, "L3_Apparent_Power",       "apparent_power_l3",       "L3 Apparent Power",       "VA",   "apparent_power", MEAS,  "mdi:flash-outline"),
+    REG(0x0018, QTY_REACTIVE_POWER,          1, 2, "L1_Reactive_Power",       "reactive_power_l1",       "L1 Reactive Power",       "var",  "reactive_power", MEAS,  "mdi:flash-outline"),
+    REG(0x001A, QTY_REACTIVE_POWER,          2, 2, "L2_Reactive_Power",       "reactive_power_l2",       "L2 Reactive Power",       "var",  "reactive_power", MEAS,  "mdi:flash-outline"),
+    REG(0x001C, QTY_REACTIVE_POWER,          3, 2, "L3_Reactive_Power",       "reactive_power_l3",       "L3 Reactive Power",       "var",  "reactive_power", MEAS,  "mdi:flash-outline"),
+    REG(0x001E, QTY_POWER_FACTOR,            1, 3, "L1_Power_Factor",         "power_factor_l1",         "L1 Power Factor",         "",     "power_factor",   MEAS,  "mdi:cosine-wave"),
+    REG(0x0020, QTY_POWER_FACTOR,            2, 3, "L2_Power_Factor",         "power_factor_l2",         "L2 Power Factor",         "",     "power_factor",   MEAS,  "mdi:cosine-wave"),
+    REG(0x0022, QTY_POWER_FACTOR,            3, 3, "L3_Power_Factor",         "power_factor_l3",         "L3 Power Factor",         "",     "power_factor",   MEAS,  "mdi:cosine-wave"),
+    REG(0x0024, QTY_PHASE_ANGLE,             1, 1, "L1_Phase_Angle",          "phase_angle_l1",          "L1 Phase Angle",          "°",    "",               MEAS,  "mdi:angle-acute"),
+    REG(0x0026, QTY_PHASE_ANGLE,             2, 1, "L2_Phase_Angle",          "phase_angle_l2",          "L2 Phase Angle",          "°",    "",               MEAS,  "mdi:angle-acute"),
+    REG(0x0028, QTY_PHASE_ANGLE,             3, 1, "L3_Phase_Angle",          "phase_angle_l3",          "L3 Phase Angle",          "°",    "",               MEAS,  "mdi:angle-acute"),
+    REG(0x002A, QTY_VOLTAGE,                 0, 2, "Average_Voltage",         "voltage",                 "Average Voltage",         "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x002E, QTY_CURRENT,                 0, 3, "Average_Current",         "current",                 "Average Current",         "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x0034, QTY_ACTIVE_POWER,            0, 2, "Total_Active_Power",      "active_power",            "Total Active Power",      "W",    "power",          MEAS,  "mdi:flash"),
+    REG(0x0038, QTY_APPARENT_POWER,          0, 2, "Total_Apparent_Power",    "apparent_power",          "Total Apparent Power",    "VA",   "apparent_power", MEAS,  "mdi:flash-outline"),
+    REG(0x003C, QTY_REACTIVE_POWER,          0, 2, "Total_Reactive_Power",    "reactive_power",          "Total Reactive Power",    "var",  "reactive_power", MEAS,  "mdi:flash-outline"),
+    REG(0x003E, QTY_POWER_FACTOR,            0, 3, "Total_Power_Factor",      "power_factor",            "Total Power Factor",      "",     "power_factor",   MEAS,  "mdi:cosine-wave"),
+    REG(0x0042, QTY_PHASE_ANGLE,             0, 1, "Total_Phase_Angle",       "phase_angle",             "Total Phase Angle",       "°",    "",               MEAS,  "mdi:angle-acute"),
+    REG(0x0046, QTY_FREQUENCY,               0, 2, "Frequency",               "frequency",               "Frequency",               "Hz",   "frequency",      MEAS,  "mdi:sine-wave"),
+    REG(0x0048, QTY_IMPORT_ACTIVE_ENERGY,    0, 3, "Import_Active_Energy",    "import_energy",           "Import Energy",           "kWh",  "energy",         TOTAL, "mdi:transmission-tower-import"),
+    REG(0x004A, QTY_EXPORT_ACTIVE_ENERGY,    0, 3, "Export_Active_Energy",    "export_energy",           "Export Energy",           "kWh",  "energy",         TOTAL, "mdi:transmission-tower-export"),
+    REG(0x004C, QTY_IMPORT_REACTIVE_ENERGY,  0, 3, "Import_Reactive_Energy",  "import_reactive_energy",  "Import Reactive Energy",  "kvarh", "",              TOTAL, "mdi:transmission-tower-import"),
+    REG(0x004E, QTY_EXPORT_REACTIVE_ENERGY,  0, 3, "Export_Reactive_Energy",  "export_reactive_energy",  "Export Reactive Energy",  "kvarh", "",              TOTAL, "mdi:transmission-tower-export"),
+    REG(0x0054, QTY_POWER_DEMAND,            0, 2, "Total_Power_Demand",      "power_demand",            "Total Power Demand",      "W",    "power",          MEAS,  "mdi:chart-bell-curve"),
+    REG(0x0056, QTY_MAX_POWER_DEMAND,        0, 2, "Max_Power_Demand",        "max_power_demand",        "Max Power Demand",        "W",    "power",          MEAS,  "mdi:chart-bell-curve-cumulative"),
+    REG(0x00C8, QTY_LINE_VOLTAGE,            1, 2, "L1_L2_Voltage",           "voltage_l1_l2",           "L1-L2 Voltage",           "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x00CA, QTY_LINE_VOLTAGE,            2, 2, "L2_L3_Voltage",           "voltage_l2_l3",           "L2-L3 Voltage",           "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x00CC, QTY_LINE_VOLTAGE,            3, 2, "L3_L1_Voltage",           "voltage_l3_l1",           "L3-L1 Voltage",           "V",    "voltage",        MEAS,  "mdi:flash"),
+    REG(0x00E0, QTY_NEUTRAL_CURRENT,         0, 3, "Neutral_Current",         "current_n",               "Neutral Current",         "A",    "current",        MEAS,  "mdi:current-ac"),
+    REG(0x0156, QTY_TOTAL_ACTIVE_ENERGY,     0, 3, "Total_Active_Energy",     "total_energy",            "Total Energy",            "kWh",  "energy",         TOTAL, "mdi:lightning-bolt"),
+    REG(0x0158, QTY_TOTAL_REACTIVE_ENERGY,   0, 3, "Total_Reactive_Energy",   "total_reactive_energy",   "Total Reactive Energy",   "kvarh", "",              TOTAL, "mdi:lightning-bolt-outline"),
+};
+
+#define TABLE_LEN(t) ((uint8_t)(sizeof(t) / sizeof((t)[0])))
+
+_Static_assert(TABLE_LEN(s_sdm120_regs) <= METER_MAX_REGISTERS, "SDM120 table too large");
+_Static_assert(TABLE_LEN(s_sdm72_regs) <= METER_MAX_REGISTERS, "SDM72 table too large");
+_Static_assert(TABLE_LEN(s_sdm630_regs) <= METER_MAX_REGISTERS, "SDM630 table too large");
+
+static const meter_profile_t s_profiles[] = {
+    { "SDM120", "Eastron", 1, TABLE_LEN(s_sdm120_regs), s_sdm120_regs },
+    { "SDM230", "Eastron", 1, TABLE_LEN(s_sdm120_regs), s_sdm120_regs },
+    { "SDM72",  "Eastron", 3, TABLE_LEN(s_sdm72_regs),  s_sdm72_regs  },
+    { "SDM630", "Eastron", 3, TABLE_LEN(s_sdm630_regs), s_sdm630_regs },
+};
+
+const meter_profile_t* meter_profile_find(const char* model)
+{
+    if (model == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(s_profiles) / sizeof(s_profiles[0]); i++) {
+        if (strcasecmp(s_profiles[i].model, model) == 0) {
+            return &s_profiles[i];
+        }
+    }
+    return NULL;
+}
+
+const meter_profile_t* meter_profile_default(void)
+{
+    const meter_profile_t* profile = meter_profile_find(CONFIG_SDM_METER_MODEL);
+    return profile != NULL ? profile : &s_profiles[0];
+}
+
+int meter_profile_index_of(const meter_profile_t* profile, meter_quantity_t quantity, uint8_t phase)
+{
+    for (int i = 0; i < profile->reg_count; i++) {
+        if (profile->regs[i].quantity == quantity && profile->regs[i].phase == phase) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+size_t meter_plan_blocks(const meter_profile_t* profile, uint16_t max_regs, uint16_t max_gap,
+                         meter_block_t* blocks, size_t max_blocks)
+{
+    if (max_regs > METER_MODBUS_MAX_REGS) {
+        max_regs = METER_MODBUS_MAX_REGS;
+    }
+    if (max_regs < 2) {
+        max_regs = 2;
+    }
+
+    size_t block_count = 0;
+    meter_block_t* current = NULL;
+
+    for (uint8_t i = 0; i < profile->reg_count; i++) {
+        const uint16_t reg = profile->regs[i].reg;
+
+        if (current != NULL) {
+            const uint16_t current_end = current->reg_start + current->reg_size;
+            const bool fits = (reg >= current_end) &&
+                              (reg - current_end <= max_gap) &&
+                              (reg + 2 - current->reg_start <= max_regs);
+            if (fits) {
+                current->reg_size = reg + 2 - current->reg_start;
+                current->count++;
+                continue;
+            }
+        }
+
+        if (block_count >= max_blocks) {
+            return 0;
+        }
+        current = &blocks[block_count++];
+        current->reg_start = reg;
+        current->reg_size = 2;
+        current->first = i;
+        current->count = 1;
+    }
+
+    return block_count;
+}
+
+/**
+ * On the Linux host build the word swap is done 4 floats at a time with SSE2/NEON
+ * shuffles. On Xtensa/RISC-V the loop compiles down to a 16-bit rotate per value.
+ */
+void meter_decode_floats(const uint16_t* regs, float* out, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Swap the two 16-bit words inside every 32-bit lane: (hi, lo) -> (lo, hi)
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(regs + 2 * i));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i*)(out + i), v);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4) {
+        uint16x8_t v = vld1q_u16(regs + 2 * i);
+        vst1q_f32(out + i, vreinterpretq_f32_u16(vrev32q_u16(v)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        uint32_t word;
+        memcpy(&word, regs + 2 * i, sizeof(word));
+        word = (word << 16) | (word >> 16);
+        memcpy(out + i, &word, sizeof(word));
+    }
+}
+
+void meter_decode_block(const meter_profile_t* profile, const meter_block_t* block, const uint16_t* regs,
+                        float* values, uint64_t* valid)
+{
+    float block_values[METER_MODBUS_MAX_REGS / 2];
+    meter_decode_floats(regs, block_values, block->reg_size / 2);
+
+    for (int i = block->first; i < block->first + block->count; i++) {
+        values[i] = block_values[(profile->regs[i].reg - block->reg_start) / 2];
+        *valid |= 1ULL << i;
+    }
+}
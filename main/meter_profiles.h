@@ -0,0 +1,166 @@
+/**
+ * @file meter_profiles.h
+ * @brief Eastron SDM-family device profiles (register maps + MQTT/Home Assistant metadata)
+ *
+ * Every supported meter model is described by a static const register table that
+ * lives in flash. A profile carries everything needed to read, decode, publish and
+ * auto-discover one meter, so the acquisition and MQTT code never hard-code a
+ * register address or topic name.
+ *
+ * All Eastron measurement registers are IEEE754 floats spanning two input registers
+ * (function code 0x04), high word first.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define METER_MAX_REGISTERS     64      // Upper bound for any profile's register table
+#define METER_MAX_BLOCKS        METER_MAX_REGISTERS  // Worst case: one read per register
+#define METER_MODBUS_MAX_REGS   80      // Eastron meters answer at most 80 registers (40 floats) per read
+
+/**
+ * @brief Physical quantity measured by a register
+ *
+ * Lets the application locate e.g. active power or import energy in any profile
+ * without knowing its register address or table position.
+ */
+typedef enum {
+    QTY_VOLTAGE = 0,
+    QTY_LINE_VOLTAGE,
+    QTY_CURRENT,
+    QTY_NEUTRAL_CURRENT,
+    QTY_ACTIVE_POWER,
+    QTY_APPARENT_POWER,
+    QTY_REACTIVE_POWER,
+    QTY_POWER_FACTOR,
+    QTY_PHASE_ANGLE,
+    QTY_FREQUENCY,
+    QTY_IMPORT_ACTIVE_ENERGY,
+    QTY_EXPORT_ACTIVE_ENERGY,
+    QTY_TOTAL_ACTIVE_ENERGY,
+    QTY_IMPORT_REACTIVE_ENERGY,
+    QTY_EXPORT_REACTIVE_ENERGY,
+    QTY_TOTAL_REACTIVE_ENERGY,
+    QTY_POWER_DEMAND,
+    QTY_MAX_POWER_DEMAND,
+    QTY_IMPORT_POWER_DEMAND,
+    QTY_MAX_IMPORT_POWER_DEMAND,
+    QTY_EXPORT_POWER_DEMAND,
+    QTY_MAX_EXPORT_POWER_DEMAND,
+    QTY_CURRENT_DEMAND,
+    QTY_MAX_CURRENT_DEMAND,
+    QTY_COUNT
+} meter_quantity_t;
+
+/**
+ * @brief One IEEE754 measurement register plus its publishing metadata
+ */
+typedef struct {
+    uint16_t reg;               // Input register start address (2 registers wide)
+    uint8_t quantity;           // meter_quantity_t
+    uint8_t phase;              // 0 = single-phase/system total, 1..3 = L1..L3
+    uint8_t precision;          // Decimal places used for MQTT/JSON output
+    const char* key;            // Modbus parameter key / log label
+    const char* topic;          // MQTT subtopic and JSON field name
+    const char* name;           // Home Assistant friendly name
+    const char* unit;           // Unit of measurement ("" = dimensionless)
+    const char* device_class;   // Home Assistant device_class ("" = none)
+    const char* state_class;    // Home Assistant state_class
+    const char* icon;           // Home Assistant icon
+} meter_register_t;
+
+/**
+ * @brief Complete description of one meter model
+ */
+typedef struct {
+    const char* model;              // e.g. "SDM120"
+    const char* manufacturer;
+    uint8_t phases;                 // 1 or 3
+    uint8_t reg_count;
+    const meter_register_t* regs;   // Sorted by ascending register address
+} meter_profile_t;
+
+/**
+ * @brief One contiguous Modbus read covering several profile registers
+ */
+typedef struct {
+    uint16_t reg_start;     // First register of the read
+    uint16_t reg_size;      // Number of 16-bit registers in the read
+    uint8_t first;          // Index of the first profile register covered
+    uint8_t count;          // Number of profile registers covered
+} meter_block_t;
+
+/**
+ * @brief Get the profile selected in menuconfig
+ */
+const meter_profile_t* meter_profile_default(void);
+
+/**
+ * @brief Look up a compiled-in profile by model name (case-insensitive)
+ *
+ * @return Profile, or NULL if the model is unknown
+ */
+const meter_profile_t* meter_profile_find(const char* model);
+
+/**
+ * @brief Find the table index of a quantity/phase in a profile
+ *
+ * Intended for one-off setup (e.g. filling an index cache), not the hot path.
+ *
+ * @return Index into profile->regs, or -1 if the profile does not provide it
+ */
+int meter_profile_index_of(const meter_profile_t* profile, meter_quantity_t quantity, uint8_t phase);
+
+/**
+ * @brief Plan block reads for a profile
+ *
+ * Greedily merges registers (in address order) into one read while the gap to the
+ * previous register is at most max_gap registers and the read stays within
+ * max_regs. Registers in a gap are read and discarded - a few wasted bytes are far
+ * cheaper than an extra Modbus round trip.
+ *
+ * @param profile    Profile to plan for
+ * @param max_regs   Maximum registers per read (clamped to METER_MODBUS_MAX_REGS)
+ * @param max_gap    Maximum unused registers bridged inside one read
+ * @param blocks     Output array
+ * @param max_blocks Capacity of the output array
+ * @return Number of blocks written, 0 if the plan does not fit
+ */
+size_t meter_plan_blocks(const meter_profile_t* profile, uint16_t max_regs, uint16_t max_gap,
+                         meter_block_t* blocks, size_t max_blocks);
+
+/**
+ * @brief Batch-convert IEEE754 register pairs to native floats
+ *
+ * Eastron meters send every float as two registers, high word first, so each
+ * value is (regs[2i] << 16) | regs[2i + 1]. Bit patterns (NaN payloads,
+ * denormals, signed zero) are passed through untouched.
+ *
+ * @param regs  Register words in host order, 2 * count of them (no alignment requirement)
+ * @param out   Destination for count floats
+ * @param count Number of floats to convert
+ */
+void meter_decode_floats(const uint16_t* regs, float* out, size_t count);
+
+/**
+ * @brief Decode the response to one block read into profile-indexed values
+ *
+ * Converts the whole block in one pass, bridged gap registers included, and
+ * scatters the registers the block covers into values, setting their bits in
+ * valid.
+ *
+ * @param regs   The block's reg_size register words, in host order
+ * @param values Profile-indexed values (profile->reg_count entries)
+ * @param valid  Mask of the profile registers holding a value
+ */
+void meter_decode_block(const meter_profile_t* profile, const meter_block_t* block, const uint16_t* regs,
+                        float* values, uint64_t* valid);
+
+#ifdef __cplusplus
+}
+#endif
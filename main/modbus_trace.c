@@ -0,0 +1,248 @@
+/**
+ * @file modbus_trace.c
+ * @brief Transaction ring and pcapng packet construction
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "modbus_trace.h"
+
+#define ENTRY_PREFIX    2                               // u16 length ahead of each entry
+#define PCAPNG_LINKTYPE_RAW     101                     // Raw IPv4/IPv6 packets
+#define PCAPNG_EPB_HEADER       28                      // Enhanced packet block up to the packet data
+#define IP_TCP_HEADERS          40
+
+/* ===== RING ===== */
+
+static void ring_write(modbus_trace_t* trace, uint32_t pos, const void* data, uint32_t len)
+{
+    const uint32_t offset = pos % trace->size;
+    const uint32_t first = len < trace->size - offset ? len : trace->size - offset;
+    memcpy(trace->buf + offset, data, first);
+    memcpy(trace->buf, (const uint8_t*)data + first, len - first);
+}
+
+static void ring_read(const modbus_trace_t* trace, uint32_t pos, void* data, uint32_t len)
+{
+    const uint32_t offset = pos % trace->size;
+    const uint32_t first = len < trace->size - offset ? len : trace->size - offset;
+    memcpy(data, trace->buf + offset, first);
+    memcpy((uint8_t*)data + first, trace->buf, len - first);
+}
+
+void modbus_trace_init(modbus_trace_t* trace, uint8_t* buf, uint32_t size)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->buf = buf;
+    trace->size = size;
+}
+
+bool modbus_trace_add(modbus_trace_t* trace, modbus_trace_entry_t* entry, const uint16_t* regs)
+{
+    if (entry->response_regs > MODBUS_TRACE_MAX_REGS) {
+        entry->response_regs = MODBUS_TRACE_MAX_REGS;
+    }
+    const uint16_t len = (uint16_t)(ENTRY_PREFIX + sizeof(*entry) + entry->response_regs * sizeof(uint16_t));
+    if (len > trace->size) {
+        return false;
+    }
+    while (trace->size - (trace->head - trace->tail) < len) {
+        uint16_t oldest;
+        ring_read(trace, trace->tail, &oldest, sizeof(oldest));
+        trace->tail += oldest;
+        trace->count--;
+        trace->dropped++;
+    }
+
+    entry->transaction = trace->next_transaction++;
+    ring_write(trace, trace->head, &len, sizeof(len));
+    ring_write(trace, trace->head + ENTRY_PREFIX, entry, sizeof(*entry));
+    if (entry->response_regs > 0) {
+        ring_write(trace, trace->head + ENTRY_PREFIX + sizeof(*entry), regs, len - ENTRY_PREFIX - sizeof(*entry));
+    }
+    trace->head += len;
+    trace->count++;
+    return true;
+}
+
+uint32_t modbus_trace_oldest(const modbus_trace_t* trace)
+{
+    return trace->tail;
+}
+
+bool modbus_trace_read(const modbus_trace_t* trace, uint32_t* cursor, modbus_trace_entry_t* entry, uint16_t* regs)
+{
+    if ((int32_t)(*cursor - trace->tail) < 0) {
+        *cursor = trace->tail;
+    }
+    if (*cursor == trace->head) {
+        return false;
+    }
+    uint16_t len;
+    ring_read(trace, *cursor, &len, sizeof(len));
+    ring_read(trace, *cursor + ENTRY_PREFIX, entry, sizeof(*entry));
+    if (entry->response_regs > 0) {
+        ring_read(trace, *cursor + ENTRY_PREFIX + sizeof(*entry), regs, len - ENTRY_PREFIX - sizeof(*entry));
+    }
+    *cursor += len;
+    return true;
+}
+
+/* ===== PCAPNG ===== */
+
+static void put_u16_le(uint8_t* p, uint16_t v) { p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8); }
+static void put_u32_le(uint8_t* p, uint32_t v) { put_u16_le(p, (uint16_t)v); put_u16_le(p + 2, (uint16_t)(v >> 16)); }
+static void put_u16_be(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static void put_u32_be(uint8_t* p, uint32_t v) { put_u16_be(p, (uint16_t)(v >> 16)); put_u16_be(p + 2, (uint16_t)v); }
+
+size_t modbus_trace_pcapng_header(uint8_t* out)
+{
+    // Section header block: byte-order magic, version 1.0, unknown section length
+    put_u32_le(out, 0x0A0D0D0A);
+    put_u32_le(out + 4, 28);
+    put_u32_le(out + 8, 0x1A2B3C4D);
+    put_u16_le(out + 12, 1);
+    put_u16_le(out + 14, 0);
+    put_u32_le(out + 16, 0xFFFFFFFF);
+    put_u32_le(out + 20, 0xFFFFFFFF);
+    put_u32_le(out + 24, 28);
+
+    // Interface description block: raw IPv4, no snap length limit, microsecond times
+    put_u32_le(out + 28, 0x00000001);
+    put_u32_le(out + 32, 20);
+    put_u16_le(out + 36, PCAPNG_LINKTYPE_RAW);
+    put_u16_le(out + 38, 0);
+    put_u32_le(out + 40, 0);
+    put_u32_le(out + 44, 20);
+    return MODBUS_TRACE_PCAPNG_HEADER_SIZE;
+}
+
+/**
+ * @brief Internet checksum over len bytes, continuing from sum
+ */
+static uint32_t checksum_add(uint32_t sum, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (uint32_t)(data[i] << 8 | data[i + 1]);
+    }
+    if (len & 1) {
+        sum += (uint32_t)data[len - 1] << 8;
+    }
+    return sum;
+}
+
+static uint16_t checksum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief Write one enhanced packet block holding an IPv4/TCP segment with a Modbus ADU
+ *
+ * @param comment Packet comment option, NULL for none
+ * @return Bytes written
+ */
+static size_t pcapng_packet(uint8_t* out, int64_t time_us, uint32_t src_ip, uint32_t dst_ip,
+                            uint16_t src_port, uint16_t dst_port, uint32_t seq, uint32_t ack,
+                            const uint8_t* adu, size_t adu_len, const char* comment)
+{
+    const size_t packet_len = IP_TCP_HEADERS + adu_len;
+    const size_t padded_len = (packet_len + 3) & ~(size_t)3;
+    const size_t comment_len = comment != NULL ? strlen(comment) : 0;
+    const size_t options_len = comment != NULL ? 4 + ((comment_len + 3) & ~(size_t)3) + 4 : 0;
+    const size_t block_len = PCAPNG_EPB_HEADER + padded_len + options_len + 4;
+
+    put_u32_le(out, 0x00000006);
+    put_u32_le(out + 4, (uint32_t)block_len);
+    put_u32_le(out + 8, 0);                                     // Interface 0
+    put_u32_le(out + 12, (uint32_t)((uint64_t)time_us >> 32));
+    put_u32_le(out + 16, (uint32_t)time_us);
+    put_u32_le(out + 20, (uint32_t)packet_len);
+    put_u32_le(out + 24, (uint32_t)packet_len);
+
+    uint8_t* ip = out + PCAPNG_EPB_HEADER;
+    memset(ip, 0, IP_TCP_HEADERS);
+    ip[0] = 0x45;                                               // IPv4, 20-byte header
+    put_u16_be(ip + 2, (uint16_t)packet_len);
+    ip[6] = 0x40;                                               // Don't fragment
+    ip[8] = 64;                                                 // TTL
+    ip[9] = 6;                                                  // TCP
+    put_u32_be(ip + 12, src_ip);
+    put_u32_be(ip + 16, dst_ip);
+    put_u16_be(ip + 10, checksum_fold(checksum_add(0, ip, 20)));
+
+    uint8_t* tcp = ip + 20;
+    put_u16_be(tcp, src_port);
+    put_u16_be(tcp + 2, dst_port);
+    put_u32_be(tcp + 4, seq);
+    put_u32_be(tcp + 8, ack);
+    tcp[12] = 5 << 4;                                           // 20-byte header
+    tcp[13] = 0x18;                                             // PSH, ACK
+    put_u16_be(tcp + 14, 0xFFFF);                               // Window
+    memcpy(tcp + 20, adu, adu_len);
+
+    // TCP checksum over the pseudo header, the TCP header and the ADU
+    uint8_t pseudo[12];
+    put_u32_be(pseudo, src_ip);
+    put_u32_be(pseudo + 4, dst_ip);
+    pseudo[8] = 0;
+    pseudo[9] = 6;
+    put_u16_be(pseudo + 10, (uint16_t)(20 + adu_len));
+    put_u16_be(tcp + 16, checksum_fold(checksum_add(checksum_add(0, pseudo, sizeof(pseudo)), tcp, 20 + adu_len)));
+
+    memset(ip + packet_len, 0, padded_len - packet_len);
+    uint8_t* p = ip + padded_len;
+    if (comment != NULL) {
+        put_u16_le(p, 1);                                       // opt_comment
+        put_u16_le(p + 2, (uint16_t)comment_len);
+        memcpy(p + 4, comment, comment_len);
+        memset(p + 4 + comment_len, 0, options_len - 8 - comment_len);
+        p += options_len - 4;
+        put_u32_le(p, 0);                                       // opt_endofopt
+        p += 4;
+    }
+    put_u32_le(p, (uint32_t)block_len);
+    return block_len;
+}
+
+size_t modbus_trace_pcapng_entry(modbus_trace_pcap_t* pcap, const modbus_trace_entry_t* entry,
+                                 const uint16_t* regs, uint8_t* out)
+{
+    uint8_t adu[9 + 2 * MODBUS_TRACE_MAX_REGS];
+
+    // Request: MBAP (transaction, protocol 0, length, unit) + function, start, quantity
+    put_u16_be(adu, entry->transaction);
+    put_u16_be(adu + 2, 0);
+    put_u16_be(adu + 4, 6);
+    adu[6] = entry->unit;
+    adu[7] = entry->function;
+    put_u16_be(adu + 8, entry->reg_start);
+    put_u16_be(adu + 10, entry->reg_count);
+
+    char comment[80];
+    snprintf(comment, sizeof(comment), "cid=%u attempt=%u err=0x%lx us=%lu", entry->cid, entry->attempt,
+             (unsigned long)(uint32_t)entry->error, (unsigned long)entry->duration_us);
+    const int64_t start_us = entry->start_us + pcap->time_offset_us;
+    size_t len = pcapng_packet(out, start_us, pcap->client_ip, pcap->server_ip, MODBUS_TRACE_CLIENT_PORT,
+                               MODBUS_TRACE_PORT, pcap->client_seq, pcap->server_seq, adu, 12, comment);
+    pcap->client_seq += 12;
+    if (entry->error != 0 || entry->response_regs == 0) {
+        return len;
+    }
+
+    // Response: MBAP + function, byte count, register data
+    const size_t data_len = 2 * (size_t)entry->response_regs;
+    put_u16_be(adu + 4, (uint16_t)(3 + data_len));
+    adu[8] = (uint8_t)data_len;
+    for (int i = 0; i < entry->response_regs; i++) {
+        put_u16_be(adu + 9 + 2 * i, regs[i]);
+    }
+    len += pcapng_packet(out + len, start_us + entry->duration_us, pcap->server_ip, pcap->client_ip,
+                         MODBUS_TRACE_PORT, MODBUS_TRACE_CLIENT_PORT, pcap->server_seq, pcap->client_seq,
+                         adu, 9 + data_len, NULL);
+    pcap->server_seq += 9 + data_len;
+    return len;
+}
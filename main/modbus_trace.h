@@ -0,0 +1,135 @@
+/**
+ * @file modbus_trace.h
+ * @brief RAM ring of Modbus transactions, dumped as pcapng for Wireshark and offline replay
+ *
+ * Every attempt of a register read is recorded with its timing, outcome and
+ * the register words of the response. The ring keeps the most recent
+ * transactions: when a new one does not fit, the oldest are dropped.
+ *
+ * The application talks to the meter through the esp-modbus parameter API,
+ * which does not expose the bytes on the wire, so the dump rebuilds them: the
+ * request and response ADUs are exactly what Modbus TCP carries for the
+ * recorded read (MBAP header, function code, start address and quantity, byte
+ * count and register data), wrapped in IPv4/TCP headers between the device
+ * and the meter on port 502 so Wireshark dissects them as Modbus/TCP. The
+ * transaction id is the recorder's own counter and IP and TCP checksums are
+ * computed but the TCP handshake is not recorded, so Wireshark may flag the
+ * first segment of each direction. A failed attempt has no response packet;
+ * every request packet carries a comment
+ *
+ *   cid=<n> attempt=<n> err=0x<esp_err_t> us=<duration>
+ *
+ * from which tools/modbus_replay rebuilds the retries bit-for-bit.
+ *
+ * Like sample_codec.c this has no ESP-IDF dependencies. The ring is not
+ * thread-safe: the caller serialises adds and reads.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MODBUS_TRACE_MAX_REGS           125     // Most registers one Modbus read returns
+#define MODBUS_TRACE_PCAPNG_HEADER_SIZE 48      // Section header and interface description blocks
+#define MODBUS_TRACE_PCAPNG_MAX_ENTRY   640     // Request and response blocks of one transaction
+#define MODBUS_TRACE_PORT               502
+#define MODBUS_TRACE_CLIENT_PORT        50200
+
+/**
+ * @brief One attempt of a register read
+ */
+typedef struct {
+    int64_t start_us;               // Monotonic time the request went out
+    uint32_t duration_us;           // Until the response or the error
+    int32_t error;                  // esp_err_t of the attempt, 0 on success
+    uint16_t transaction;           // Assigned by modbus_trace_add()
+    uint16_t cid;                   // esp-modbus parameter of the read
+    uint16_t reg_start;
+    uint16_t reg_count;             // Registers requested
+    uint8_t unit;                   // Modbus unit (slave) address
+    uint8_t function;               // 3 = holding, 4 = input registers
+    uint8_t attempt;                // 0 for the first try, counting retries
+    uint8_t response_regs;          // Register words in the response (0 without one)
+} modbus_trace_entry_t;
+
+/**
+ * @brief Trace ring
+ *
+ * Positions count bytes ever written, so a reader's cursor tells whether the
+ * entry it points at has been overwritten since.
+ */
+typedef struct {
+    uint8_t* buf;
+    uint32_t size;
+    uint32_t head;                  // Position of the next entry
+    uint32_t tail;                  // Position of the oldest entry
+    uint32_t count;                 // Entries in the ring
+    uint32_t dropped;               // Entries overwritten since boot
+    uint16_t next_transaction;
+} modbus_trace_t;
+
+/**
+ * @brief Addresses and TCP state of a pcapng dump
+ */
+typedef struct {
+    uint32_t client_ip;             // Device address, host order
+    uint32_t server_ip;             // Meter address, host order
+    uint32_t client_seq;            // Next TCP sequence number of each side
+    uint32_t server_seq;
+    int64_t time_offset_us;         // Added to the monotonic times (UTC minus monotonic)
+} modbus_trace_pcap_t;
+
+/**
+ * @brief Use buf (size bytes) as an empty ring
+ */
+void modbus_trace_init(modbus_trace_t* trace, uint8_t* buf, uint32_t size);
+
+/**
+ * @brief Record a transaction, dropping the oldest ones if needed
+ *
+ * @param entry Transaction; its transaction field is assigned here
+ * @param regs  entry->response_regs register words of the response, host order
+ * @return false if the entry is larger than the whole ring
+ */
+bool modbus_trace_add(modbus_trace_t* trace, modbus_trace_entry_t* entry, const uint16_t* regs);
+
+/**
+ * @brief Position of the oldest entry, to start reading from
+ */
+uint32_t modbus_trace_oldest(const modbus_trace_t* trace);
+
+/**
+ * @brief Copy the entry at a cursor and advance it
+ *
+ * A cursor pointing at an overwritten entry moves to the oldest one first.
+ *
+ * @param regs Receives the response words, MODBUS_TRACE_MAX_REGS capacity
+ * @return false once the cursor has caught up with the newest entry
+ */
+bool modbus_trace_read(const modbus_trace_t* trace, uint32_t* cursor, modbus_trace_entry_t* entry, uint16_t* regs);
+
+/**
+ * @brief Write the pcapng section header and the raw IPv4 interface description
+ *
+ * @param out MODBUS_TRACE_PCAPNG_HEADER_SIZE bytes
+ * @return Bytes written
+ */
+size_t modbus_trace_pcapng_header(uint8_t* out);
+
+/**
+ * @brief Write the request (and response) packet blocks of a transaction
+ *
+ * @param out MODBUS_TRACE_PCAPNG_MAX_ENTRY bytes
+ * @return Bytes written
+ */
+size_t modbus_trace_pcapng_entry(modbus_trace_pcap_t* pcap, const modbus_trace_entry_t* entry,
+                                 const uint16_t* regs, uint8_t* out);
+
+#ifdef __cplusplus
+}
+#endif
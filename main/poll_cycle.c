@@ -0,0 +1,89 @@
+/**
+ * @file poll_cycle.c
+ * @brief Block reads with retries, link checks and reading timestamps
+ */
+
+#include <string.h>
+#include "poll_cycle.h"
+
+bool poll_cycle_read(const poll_io_t* io, const meter_profile_t* profile, const meter_block_t* blocks,
+                     uint16_t block_count, uint32_t inter_block_ms, float* values, uint64_t* valid,
+                     poll_result_t* result)
+{
+    memset(result, 0, sizeof(*result));
+    *valid = 0;
+    int64_t first_start_us = 0;         // Start of the first successful transaction
+    int64_t last_end_us = 0;            // End of the last successful transaction
+    int timeouts_since_check = 0;
+
+    for (uint16_t b = 0; b < block_count; b++) {
+        uint16_t regs[METER_MODBUS_MAX_REGS];
+        int32_t err = 0;
+        uint8_t attempt;
+        for (attempt = 0; attempt <= POLL_MAX_RETRIES; attempt++) {
+            const int64_t start_us = io->now_us(io->ctx);
+            err = io->read(io->ctx, b, attempt, regs);
+            if (err == 0) {
+                last_end_us = io->now_us(io->ctx);
+                if (first_start_us == 0) {
+                    first_start_us = start_us;
+                }
+                break;
+            }
+            result->last_error = err;
+            if (attempt < POLL_MAX_RETRIES) {
+                // Progressive delay: the meter or a gateway in front of it may need a moment
+                const uint32_t delay_ms = POLL_RETRY_DELAY_BASE_MS + attempt * POLL_RETRY_DELAY_STEP_MS;
+                if (io->on_retry != NULL) {
+                    io->on_retry(io->ctx, b, attempt + 1, err, delay_ms);
+                }
+                result->retries++;
+                io->delay_ms(io->ctx, delay_ms);
+            }
+        }
+
+        if (err == 0) {
+            // Decode the whole block in one pass, including any bridged gap registers
+            meter_decode_block(profile, &blocks[b], regs, values, valid);
+            result->registers_ok += blocks[b].count;
+        } else {
+            result->blocks_failed++;
+            if (io->on_block_failed != NULL) {
+                io->on_block_failed(io->ctx, b, attempt, err);
+            }
+            if (err == io->timeout_error) {
+                result->timeouts++;
+                if (++timeouts_since_check >= POLL_TIMEOUTS_BEFORE_CHECK) {
+                    if (io->check_link != NULL) {
+                        io->check_link(io->ctx);
+                    }
+                    timeouts_since_check = 0;
+                }
+            }
+        }
+
+        // Inter-block delay for device stability and network recovery
+        if (b + 1 < block_count) {
+            io->delay_ms(io->ctx, inter_block_ms);
+        }
+    }
+
+    // Stamp the reading at the midpoint of its Modbus transactions
+    if (first_start_us != 0) {
+        result->timestamp_us = first_start_us + (last_end_us - first_start_us) / 2;
+        result->spread_us = (uint32_t)((last_end_us - first_start_us) / 2);
+    }
+    return result->registers_ok > 0;
+}
+
+uint32_t poll_reconnect_delay_ms(int attempt, uint32_t min_ms, uint32_t max_ms, uint32_t random)
+{
+    uint32_t delay_ms = min_ms;
+    for (int i = 1; i < attempt && delay_ms < max_ms; i++) {
+        delay_ms *= 2;
+    }
+    if (delay_ms > max_ms) {
+        delay_ms = max_ms;
+    }
+    return delay_ms / 2 + random % (delay_ms / 2 + 1);
+}
@@ -0,0 +1,90 @@
+/**
+ * @file poll_cycle.h
+ * @brief One Modbus read cycle with retries, and the reconnect backoff, behind injectable I/O
+ *
+ * read_sdm120_data() runs the cycle against esp-modbus and FreeRTOS;
+ * tools/fault_harness.c runs the same code against a simulated meter on a
+ * virtual clock, so the retry, timeout and recovery behaviour it asserts on
+ * is the firmware's.
+ *
+ * A cycle reads every planned block in order, pausing between blocks. A
+ * failed read is retried POLL_MAX_RETRIES times, waiting
+ * POLL_RETRY_DELAY_BASE_MS plus POLL_RETRY_DELAY_STEP_MS per earlier retry;
+ * a block that fails every attempt is left out and the cycle goes on. Every
+ * POLL_TIMEOUTS_BEFORE_CHECK blocks lost to timeouts the link check hook runs.
+ * The reading is stamped at the midpoint of its successful reads.
+ *
+ * Like sample_codec.c this has no ESP-IDF dependencies.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "meter_profiles.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POLL_MAX_RETRIES                2       // Attempts beyond the first for each block
+#define POLL_RETRY_DELAY_BASE_MS        200
+#define POLL_RETRY_DELAY_STEP_MS        300
+#define POLL_TIMEOUTS_BEFORE_CHECK      3       // Blocks lost to timeouts before the link check
+#define POLL_ALL_FAILED_DELAY_MS        2000    // Extra pause after a cycle that read nothing
+
+/**
+ * @brief Transport and clock of a cycle
+ *
+ * Error codes are the caller's (esp_err_t in the firmware); 0 is success.
+ */
+typedef struct {
+    void* ctx;
+    int32_t (*read)(void* ctx, uint16_t block, uint8_t attempt, uint16_t* regs);   // Raw words of one block
+    void (*delay_ms)(void* ctx, uint32_t ms);
+    int64_t (*now_us)(void* ctx);                                                   // Monotonic
+    void (*check_link)(void* ctx);                                                  // May be NULL
+    void (*on_retry)(void* ctx, uint16_t block, uint8_t retry, int32_t error, uint32_t delay_ms);  // May be NULL
+    void (*on_block_failed)(void* ctx, uint16_t block, uint8_t attempts, int32_t error);           // May be NULL
+    int32_t timeout_error;                                                          // read() result for a timeout
+} poll_io_t;
+
+/**
+ * @brief Outcome of a cycle
+ */
+typedef struct {
+    int64_t timestamp_us;               // Midpoint of the successful reads, 0 without any
+    uint32_t spread_us;                 // Half their span
+    uint16_t registers_ok;
+    uint16_t blocks_failed;
+    uint16_t timeouts;                  // Blocks lost to a timeout
+    uint16_t retries;                   // Attempts beyond the first, over all blocks
+    int32_t last_error;
+} poll_result_t;
+
+/**
+ * @brief Read every block once, with retries
+ *
+ * @param blocks         Block plan of the profile (meter_plan_blocks())
+ * @param inter_block_ms Pause between consecutive blocks
+ * @param values         Profile-indexed values, decoded with meter_decode_block()
+ * @param valid          Mask of the registers read, cleared first
+ * @return true when at least one register was read
+ */
+bool poll_cycle_read(const poll_io_t* io, const meter_profile_t* profile, const meter_block_t* blocks,
+                     uint16_t block_count, uint32_t inter_block_ms, float* values, uint64_t* valid,
+                     poll_result_t* result);
+
+/**
+ * @brief Reconnect delay for an attempt: exponential backoff with jitter
+ *
+ * Doubles from min_ms up to max_ms. Half of the delay is randomised so devices
+ * that lost the same access point do not retry in lockstep.
+ *
+ * @param attempt 1 for the first delayed attempt
+ * @param random  Uniformly distributed random value
+ */
+uint32_t poll_reconnect_delay_ms(int attempt, uint32_t min_ms, uint32_t max_ms, uint32_t random);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,51 @@
+/**
+ * @file reading_json.c
+ * @brief Reading to JSON document
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "reading_json.h"
+#include "data_quality.h"
+
+int reading_json_format(char* buf, size_t size, const meter_profile_t* profile, const float* values,
+                        const uint8_t* quality, const reading_json_time_t* time, const int64_t* energy_mwh,
+                        const char* device_ip)
+{
+    int len;
+    if (time->utc) {
+        // UTC milliseconds with microsecond fraction, stamped at the transaction midpoint
+        len = snprintf(buf, size, "{\"timestamp\":%lld.%03d,\"time_uncertainty_ms\":%.3f,\"time_sync\":\"%s\"",
+                       (long long)(time->time_us / 1000), (int)(time->time_us % 1000),
+                       time->uncertainty_us / 1000.0, time->sync);
+    } else {
+        // Not synced yet: milliseconds since boot
+        len = snprintf(buf, size, "{\"timestamp\":%llu,\"time_sync\":\"%s\"",
+                       (unsigned long long)(time->time_us / 1000), time->sync);
+    }
+    for (int i = 0; i < profile->reg_count && len < (int)size; i++) {
+        const meter_register_t* reg = &profile->regs[i];
+        const bool missing = quality != NULL && (quality[i] == DQ_FAILED || quality[i] == DQ_OUT_OF_RANGE);
+        if (missing || !isfinite(values[i])) {
+            len += snprintf(buf + len, size - len, ",\"%s\":null", reg->topic);
+        } else {
+            len += snprintf(buf + len, size - len, ",\"%s\":%.*f", reg->topic, reg->precision, values[i]);
+        }
+    }
+    if (quality != NULL && len < (int)size) {
+        char letters[METER_MAX_REGISTERS + 1];
+        for (int i = 0; i < profile->reg_count; i++) {
+            letters[i] = dq_quality_letter((dq_quality_t)quality[i]);
+        }
+        letters[profile->reg_count] = '\0';
+        len += snprintf(buf + len, size - len, ",\"quality\":\"%s\"", letters);
+    }
+    if (energy_mwh != NULL && len < (int)size) {
+        len += snprintf(buf + len, size - len, ",\"import_energy_wh\":%.3f,\"export_energy_wh\":%.3f",
+                        energy_mwh[0] / 1000.0, energy_mwh[1] / 1000.0);
+    }
+    if (len < (int)size) {
+        len += snprintf(buf + len, size - len, ",\"model\":\"%s\",\"device_ip\":\"%s\"}", profile->model, device_ip);
+    }
+    return len;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file reading_json.h
+ * @brief JSON document of one reading, as published on <prefix>/data
+ *
+ *   {"timestamp":1700000000123.456,"time_uncertainty_ms":1.250,"time_sync":"synced",
+ *    "voltage":230.12,"current":null,...,"quality":"GFG...","model":"SDM120","device_ip":"192.168.1.50"}
+ *
+ * Before the clock is synced the timestamp is whole milliseconds since boot
+ * and there is no uncertainty field. Every register of the profile is written
+ * at its display precision, in table order; a register that failed or was out
+ * of range is null, never a made-up number. "quality" has one letter per
+ * register in the same order (dq_quality_letter()).
+ *
+ * Like sample_codec.c this has no ESP-IDF dependencies, so tools/sdm_bench
+ * times the same formatting the firmware publishes with.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "meter_profiles.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Timestamp fields of a reading
+ */
+typedef struct {
+    bool utc;                       // time_us is UTC rather than time since boot
+    int64_t time_us;                // Epoch us when utc, monotonic us otherwise
+    uint32_t uncertainty_us;        // Clock uncertainty plus stamping spread (utc only)
+    const char* sync;               // clock_sync_state_name() of the mapping
+} reading_json_time_t;
+
+/**
+ * @brief Format a reading
+ *
+ * @param values     Profile-indexed values
+ * @param quality    dq_quality_t of every register, NULL to treat all as good and leave "quality" out
+ * @param energy_mwh Integrated import and export energy, NULL to leave them out
+ * @param device_ip  Meter address written as device_ip
+ * @return Length of the document; size or more when buf is too small
+ */
+int reading_json_format(char* buf, size_t size, const meter_profile_t* profile, const float* values,
+                        const uint8_t* quality, const reading_json_time_t* time, const int64_t* energy_mwh,
+                        const char* device_ip);
+
+#ifdef __cplusplus
+}
+#endif
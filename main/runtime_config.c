@@ -0,0 +1,168 @@
+/**
+ * @file runtime_config.c
+ * @brief Schema validation, merging and NVS persistence of the runtime settings
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "nvs.h"
+#include "runtime_config.h"
+
+static const char* TAG = "SDM_CONFIG";
+
+#define CONFIG_NVS_NAMESPACE    "rt_config"
+#define CONFIG_NVS_KEY          "cfg"
+#define CONFIG_NVS_VERSION      1
+
+// Layout persisted in NVS
+typedef struct {
+    uint32_t version;
+    runtime_config_t cfg;
+} runtime_config_record_t;
+
+esp_err_t runtime_config_load(runtime_config_t* cfg)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG, "ℹ️  No runtime configuration saved, using build defaults");
+        return ESP_OK;
+    } else if (err != ESP_OK) {
+        return err;
+    }
+
+    runtime_config_record_t record;
+    size_t size = sizeof(record);
+    err = nvs_get_blob(handle, CONFIG_NVS_KEY, &record, &size);
+    nvs_close(handle);
+
+    if (err == ESP_OK && size == sizeof(record) && record.version == CONFIG_NVS_VERSION) {
+        record.cfg.slave_ip[RUNTIME_CONFIG_IP_LEN - 1] = '\0';
+        *cfg = record.cfg;
+        ESP_LOGI(TAG, "✓ Restored runtime configuration: poll %lums, delay %lums, slave %s",
+                 (unsigned long)cfg->poll_interval_ms, (unsigned long)cfg->inter_param_delay_ms, cfg->slave_ip);
+        return ESP_OK;
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND || err == ESP_OK) {
+        ESP_LOGW(TAG, "⚠️  Ignoring missing or incompatible runtime configuration");
+        return ESP_OK;
+    }
+    return err;
+}
+
+esp_err_t runtime_config_save(const runtime_config_t* cfg)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(CONFIG_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ Failed to open NVS for runtime configuration: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    runtime_config_record_t record;
+    memset(&record, 0, sizeof(record));     // No stack garbage in the padding written to flash
+    record.version = CONFIG_NVS_VERSION;
+    record.cfg = *cfg;
+    err = nvs_set_blob(handle, CONFIG_NVS_KEY, &record, sizeof(record));
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ Failed to write runtime configuration: %s", esp_err_to_name(err));
+    }
+    return err;
+}
+
+/**
+ * @brief Read an integer field within [min, max]
+ *
+ * @return true when valid; error is filled otherwise
+ */
+static bool parse_uint(const cJSON* item, uint32_t min, uint32_t max, uint32_t* out,
+                       char* error, size_t error_size)
+{
+    const double value = cJSON_IsNumber(item) ? item->valuedouble : -1.0;
+    if (!cJSON_IsNumber(item) || value < min || value > max || value != (double)(uint32_t)value) {
+        snprintf(error, error_size, "%s must be an integer in %lu..%lu", item->string,
+                 (unsigned long)min, (unsigned long)max);
+        return false;
+    }
+    *out = (uint32_t)value;
+    return true;
+}
+
+esp_err_t runtime_config_parse(const char* json, int len, const runtime_config_t* current,
+                               runtime_config_t* out, int32_t* id, char* error, size_t error_size)
+{
+    *id = -1;
+    error[0] = '\0';
+
+    cJSON* root = cJSON_ParseWithLength(json, len);
+    if (root == NULL) {
+        snprintf(error, error_size, "payload is not valid JSON");
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!cJSON_IsObject(root)) {
+        snprintf(error, error_size, "payload must be a JSON object");
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    runtime_config_t merged = *current;
+    bool ok = true;
+    const cJSON* item;
+    cJSON_ArrayForEach(item, root) {
+        if (strcmp(item->string, "poll_interval_ms") == 0) {
+            ok = parse_uint(item, RUNTIME_CONFIG_POLL_MIN_MS, RUNTIME_CONFIG_POLL_MAX_MS,
+                            &merged.poll_interval_ms, error, error_size);
+        } else if (strcmp(item->string, "inter_param_delay_ms") == 0) {
+            ok = parse_uint(item, 0, RUNTIME_CONFIG_DELAY_MAX_MS, &merged.inter_param_delay_ms, error, error_size);
+        } else if (strcmp(item->string, "individual_topics") == 0) {
+            ok = cJSON_IsBool(item);
+            if (ok) {
+                merged.individual_topics = cJSON_IsTrue(item);
+            } else {
+                snprintf(error, error_size, "individual_topics must be true or false");
+            }
+        } else if (strcmp(item->string, "slave_ip") == 0) {
+            esp_ip4_addr_t addr;
+            ok = cJSON_IsString(item) && strlen(item->valuestring) < RUNTIME_CONFIG_IP_LEN &&
+                 esp_netif_str_to_ip4(item->valuestring, &addr) == ESP_OK;
+            if (ok) {
+                strcpy(merged.slave_ip, item->valuestring);
+            } else {
+                snprintf(error, error_size, "slave_ip must be a dotted IPv4 address");
+            }
+        } else if (strcmp(item->string, "id") == 0) {
+            uint32_t value;
+            ok = parse_uint(item, 0, INT32_MAX, &value, error, error_size);
+            *id = ok ? (int32_t)value : -1;
+        } else {
+            snprintf(error, error_size, "unknown key %.32s", item->string);
+            ok = false;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    cJSON_Delete(root);
+
+    if (!ok) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = merged;
+    return ESP_OK;
+}
+
+int runtime_config_format(const runtime_config_t* cfg, char* buf, size_t size)
+{
+    return snprintf(buf, size,
+                    "\"poll_interval_ms\":%lu,\"inter_param_delay_ms\":%lu,\"individual_topics\":%s,\"slave_ip\":\"%s\"",
+                    (unsigned long)cfg->poll_interval_ms, (unsigned long)cfg->inter_param_delay_ms,
+                    cfg->individual_topics ? "true" : "false", cfg->slave_ip);
+}
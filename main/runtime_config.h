@@ -0,0 +1,80 @@
+/**
+ * @file runtime_config.h
+ * @brief Settings that can be changed at runtime over MQTT and persist in NVS
+ *
+ * A command on <prefix>/config/set carries a JSON object with any subset of
+ * the fields below. It is validated as a whole against the schema - unknown
+ * keys, wrong types and out-of-range values reject the entire command - so a
+ * configuration is either applied completely or not at all. Accepted settings
+ * survive reboots in NVS and take precedence over the Kconfig defaults.
+ *
+ *   {"poll_interval_ms":10000,"inter_param_delay_ms":100,
+ *    "individual_topics":false,"slave_ip":"192.168.1.12","id":42}
+ *
+ * "id" is optional and echoed back on <prefix>/config/state.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RUNTIME_CONFIG_POLL_MIN_MS      1000
+#define RUNTIME_CONFIG_POLL_MAX_MS      3600000
+#define RUNTIME_CONFIG_DELAY_MAX_MS     5000
+#define RUNTIME_CONFIG_IP_LEN           16          // "255.255.255.255" + NUL
+
+/**
+ * @brief Runtime settings
+ */
+typedef struct {
+    uint32_t poll_interval_ms;          // Time between full read cycles
+    uint32_t inter_param_delay_ms;      // Pause between block reads of one cycle
+    bool individual_topics;             // Publish every register on its own subtopic too
+    char slave_ip[RUNTIME_CONFIG_IP_LEN];
+} runtime_config_t;
+
+/**
+ * @brief Replace cfg with the settings saved in NVS, if any
+ *
+ * NVS must already be initialised. cfg keeps the caller's defaults when
+ * nothing valid is stored; that is not an error.
+ */
+esp_err_t runtime_config_load(runtime_config_t* cfg);
+
+/**
+ * @brief Persist settings to NVS
+ */
+esp_err_t runtime_config_save(const runtime_config_t* cfg);
+
+/**
+ * @brief Validate a config/set command and merge it over the current settings
+ *
+ * @param json        Command payload (need not be NUL-terminated)
+ * @param len         Payload length
+ * @param current     Settings the command is applied to
+ * @param out         Receives the merged settings; untouched on error
+ * @param id          Receives the optional "id" (-1 when absent)
+ * @param error       Receives a short description of the first problem found; an
+ *                    unknown key is quoted as sent, not JSON-escaped
+ * @param error_size  Size of error
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a schema violation, ESP_ERR_NO_MEM
+ */
+esp_err_t runtime_config_parse(const char* json, int len, const runtime_config_t* current,
+                               runtime_config_t* out, int32_t* id, char* error, size_t error_size);
+
+/**
+ * @brief Write the settings as the body of a JSON object, without braces
+ *
+ * @return Number of characters that would have been written (snprintf semantics)
+ */
+int runtime_config_format(const runtime_config_t* cfg, char* buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
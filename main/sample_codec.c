@@ -0,0 +1,340 @@
+/**
+ * @file sample_codec.c
+ * @brief Quantised delta + zigzag varint batch encoder, decoder and self-test
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample_codec.h"
+
+#define SAMPLE_CODEC_COUNT_OFFSET   7           // Sample count field in the header
+#define SAMPLE_CODEC_MAX_COUNT      9.0e15      // Keeps counts exact in a double
+
+static const double s_pow10[SAMPLE_CODEC_MAX_PRECISION + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+};
+
+bool sample_codec_quantise(float value, uint8_t precision, int64_t* out)
+{
+    if (precision > SAMPLE_CODEC_MAX_PRECISION) {
+        return false;
+    }
+    const double scaled = (double)value * s_pow10[precision];
+    if (!isfinite(scaled) || fabs(scaled) > SAMPLE_CODEC_MAX_COUNT) {
+        return false;
+    }
+    *out = llround(scaled);
+    return true;
+}
+
+double sample_codec_value(int64_t count, uint8_t precision)
+{
+    return (double)count / s_pow10[precision <= SAMPLE_CODEC_MAX_PRECISION ? precision : 0];
+}
+
+static uint8_t* put_varint(uint8_t* p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static size_t varint_size(uint64_t v)
+{
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Zigzag-encode a difference computed modulo 2^64
+ *
+ * Small positive and negative deltas both map to small unsigned numbers.
+ */
+static uint64_t zigzag(uint64_t delta)
+{
+    return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static uint64_t unzigzag(uint64_t v)
+{
+    return (v >> 1) ^ (0 - (v & 1));
+}
+
+bool sample_encoder_begin(sample_encoder_t* enc, uint8_t* buf, size_t size,
+                          const uint8_t* precision, uint8_t columns, bool utc)
+{
+    memset(enc, 0, sizeof(*enc));
+    if (columns > SAMPLE_CODEC_MAX_COLUMNS || size < SAMPLE_CODEC_HEADER_SIZE(columns)) {
+        return false;
+    }
+    memcpy(buf, "SDMQ", 4);
+    buf[4] = SAMPLE_CODEC_VERSION;
+    buf[5] = utc ? SAMPLE_CODEC_FLAG_UTC : 0;
+    buf[6] = columns;
+    buf[SAMPLE_CODEC_COUNT_OFFSET] = 0;
+    buf[SAMPLE_CODEC_COUNT_OFFSET + 1] = 0;
+    memcpy(buf + 9, precision, columns);
+
+    enc->buf = buf;
+    enc->size = size;
+    enc->len = SAMPLE_CODEC_HEADER_SIZE(columns);
+    enc->columns = columns;
+    enc->utc = utc;
+    return true;
+}
+
+bool sample_encoder_add(sample_encoder_t* enc, int64_t time_ms, const int64_t* values, uint64_t valid)
+{
+    if (enc->columns < SAMPLE_CODEC_MAX_COLUMNS) {
+        valid &= (1ULL << enc->columns) - 1;
+    }
+    if (enc->sample_count == UINT16_MAX) {
+        return false;
+    }
+    const uint64_t interval = (uint64_t)time_ms - (uint64_t)enc->last_ms;
+    const uint64_t interval_change = zigzag(interval - (uint64_t)enc->last_interval_ms);
+    if (interval_change >> 63) {
+        return false;                   // The mask flag would shift out its top bit
+    }
+    const uint64_t mask_change = valid ^ enc->last_valid;
+    const uint64_t time_word = interval_change << 1 | (mask_change != 0);
+
+    // Exact size first, so a nearly full buffer still takes a sample that fits
+    size_t need = varint_size(time_word) + (mask_change != 0 ? varint_size(mask_change) : 0);
+    for (int i = 0; i < enc->columns; i++) {
+        if (valid & (1ULL << i)) {
+            need += varint_size(zigzag((uint64_t)values[i] - (uint64_t)enc->last[i]));
+        }
+    }
+    if (enc->len + need > enc->size) {
+        return false;
+    }
+
+    uint8_t* p = enc->buf + enc->len;
+    p = put_varint(p, time_word);
+    if (mask_change != 0) {
+        p = put_varint(p, mask_change);
+    }
+    for (int i = 0; i < enc->columns; i++) {
+        if (valid & (1ULL << i)) {
+            p = put_varint(p, zigzag((uint64_t)values[i] - (uint64_t)enc->last[i]));
+            enc->last[i] = values[i];
+        }
+    }
+    enc->last_ms = time_ms;
+    enc->last_interval_ms = (int64_t)interval;
+    enc->last_valid = valid;
+
+    enc->len = p - enc->buf;
+    enc->sample_count++;
+    enc->buf[SAMPLE_CODEC_COUNT_OFFSET] = (uint8_t)enc->sample_count;
+    enc->buf[SAMPLE_CODEC_COUNT_OFFSET + 1] = (uint8_t)(enc->sample_count >> 8);
+    return true;
+}
+
+static bool get_varint(sample_decoder_t* dec, uint64_t* out)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && dec->pos < dec->len; shift += 7) {
+        const uint8_t byte = dec->buf[dec->pos++];
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sample_decoder_begin(sample_decoder_t* dec, const uint8_t* buf, size_t len)
+{
+    memset(dec, 0, sizeof(*dec));
+    if (len < SAMPLE_CODEC_HEADER_SIZE(0) || memcmp(buf, "SDMQ", 4) != 0 || (buf[4] != 1 && buf[4] != SAMPLE_CODEC_VERSION) ||
+        buf[6] > SAMPLE_CODEC_MAX_COLUMNS || len < SAMPLE_CODEC_HEADER_SIZE(buf[6])) {
+        return false;
+    }
+    dec->buf = buf;
+    dec->len = len;
+    dec->version = buf[4];
+    dec->utc = (buf[5] & SAMPLE_CODEC_FLAG_UTC) != 0;
+    dec->columns = buf[6];
+    dec->sample_count = (uint16_t)(buf[SAMPLE_CODEC_COUNT_OFFSET] | (buf[SAMPLE_CODEC_COUNT_OFFSET + 1] << 8));
+    dec->remaining = dec->sample_count;
+    memcpy(dec->precision, buf + 9, dec->columns);
+    dec->pos = SAMPLE_CODEC_HEADER_SIZE(dec->columns);
+    return true;
+}
+
+bool sample_decoder_next(sample_decoder_t* dec, int64_t* time_ms, int64_t* values, uint64_t* valid)
+{
+    uint64_t v;
+    if (dec->remaining == 0 || !get_varint(dec, &v)) {
+        return false;
+    }
+    bool mask_changed = true;
+    if (dec->version == 1) {
+        dec->last_interval_ms = (int64_t)unzigzag(v);
+    } else {
+        mask_changed = v & 1;
+        dec->last_interval_ms = (int64_t)((uint64_t)dec->last_interval_ms + unzigzag(v >> 1));
+    }
+    dec->last_ms = (int64_t)((uint64_t)dec->last_ms + (uint64_t)dec->last_interval_ms);
+    if (mask_changed) {
+        if (!get_varint(dec, &v)) {
+            return false;
+        }
+        dec->last_valid ^= v;
+    }
+    for (int i = 0; i < dec->columns; i++) {
+        if (dec->last_valid & (1ULL << i)) {
+            if (!get_varint(dec, &v)) {
+                return false;
+            }
+            dec->last[i] = (int64_t)((uint64_t)dec->last[i] + unzigzag(v));
+        }
+        values[i] = dec->last[i];
+    }
+    dec->remaining--;
+    *time_ms = dec->last_ms;
+    *valid = dec->last_valid;
+    return true;
+}
+
+/* ===== SELF-TEST ===== */
+
+static uint32_t selftest_rand(uint32_t* state)
+{
+    // xorshift32: deterministic for a seed, identical on the device and the host
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * @brief Next value of a column: mostly a small random walk, sometimes a jump or an extreme
+ */
+static int64_t selftest_value(uint32_t* state, int64_t previous)
+{
+    const uint32_t kind = selftest_rand(state) % 100;
+    if (kind < 80) {
+        return (int64_t)((uint64_t)previous + selftest_rand(state) % 21 - 10);
+    } else if (kind < 95) {
+        return (int64_t)((uint64_t)selftest_rand(state) << 20) - (1LL << 50);
+    } else if (kind < 98) {
+        return INT64_MAX - (selftest_rand(state) % 3);
+    }
+    return INT64_MIN + (selftest_rand(state) % 3);
+}
+
+int sample_codec_selftest(uint32_t seed, int rounds)
+{
+    enum { MAX_SAMPLES = 40 };
+    const size_t buf_size = SAMPLE_CODEC_HEADER_SIZE(SAMPLE_CODEC_MAX_COLUMNS) +
+                            MAX_SAMPLES * SAMPLE_CODEC_MAX_SAMPLE_SIZE(SAMPLE_CODEC_MAX_COLUMNS);
+    uint8_t* buf = malloc(buf_size);
+    int64_t (*values)[SAMPLE_CODEC_MAX_COLUMNS] = malloc(MAX_SAMPLES * sizeof(*values));
+    int64_t times[MAX_SAMPLES];
+    uint64_t masks[MAX_SAMPLES];
+    uint8_t precision[SAMPLE_CODEC_MAX_COLUMNS];
+    uint32_t state = seed != 0 ? seed : 1;
+    int failed = 0;
+    if (buf == NULL || values == NULL) {
+        failed = -1;
+    }
+
+    // A version 1 batch, as older firmware left in the flash log: 1000 ms {5}, 2000 ms {3}
+    static const uint8_t v1[] = { 'S', 'D', 'M', 'Q', 1, 0, 1, 2, 0, 2,
+                                  0xD0, 0x0F, 0x01, 0x0A, 0xD0, 0x0F, 0x00, 0x03 };
+    sample_decoder_t v1_dec;
+    int64_t v1_ms[2];
+    int64_t v1_values[2];
+    uint64_t v1_valid;
+    if (failed == 0 &&
+        (!sample_decoder_begin(&v1_dec, v1, sizeof(v1)) ||
+         !sample_decoder_next(&v1_dec, &v1_ms[0], &v1_values[0], &v1_valid) || v1_valid != 1 ||
+         !sample_decoder_next(&v1_dec, &v1_ms[1], &v1_values[1], &v1_valid) || v1_valid != 1 ||
+         v1_ms[0] != 1000 || v1_ms[1] != 2000 || v1_values[0] != 5 || v1_values[1] != 3 ||
+         v1_dec.pos != sizeof(v1))) {
+        failed = -2;
+    }
+
+    for (int round = 0; round < rounds && failed == 0; round++) {
+        failed = round + 1;             // Cleared once the round has passed every check
+        const uint8_t columns = (uint8_t)(1 + selftest_rand(&state) % SAMPLE_CODEC_MAX_COLUMNS);
+        const int samples = (int)(selftest_rand(&state) % (MAX_SAMPLES + 1));
+        const bool utc = selftest_rand(&state) & 1;
+        for (int c = 0; c < columns; c++) {
+            precision[c] = (uint8_t)(selftest_rand(&state) % (SAMPLE_CODEC_MAX_PRECISION + 1));
+        }
+        // Sometimes a buffer too small for all samples: the encoder must stop cleanly
+        size_t size = buf_size;
+        if (selftest_rand(&state) % 4 == 0) {
+            size = SAMPLE_CODEC_HEADER_SIZE(columns) + selftest_rand(&state) % (buf_size / 4);
+        }
+
+        sample_encoder_t enc;
+        if (!sample_encoder_begin(&enc, buf, size, precision, columns, utc)) {
+            break;
+        }
+        const uint64_t all = columns < 64 ? (1ULL << columns) - 1 : UINT64_MAX;
+        int64_t time_ms = utc ? 1700000000000LL + selftest_rand(&state) : selftest_rand(&state);
+        int encoded = 0;
+        // Half the rounds poll at a steady interval with the odd late sample
+        const int64_t steady_ms = selftest_rand(&state) & 1 ? 1 + selftest_rand(&state) % 60000 : 0;
+        for (int s = 0; s < samples; s++) {
+            if (steady_ms > 0) {
+                time_ms += steady_ms + (selftest_rand(&state) % 10 == 0 ? selftest_rand(&state) % 500 : 0);
+            } else {
+                time_ms += (int64_t)(selftest_rand(&state) % 20000) - (s % 7 == 6 ? 15000 : 0);
+            }
+            times[s] = time_ms;
+            masks[s] = selftest_rand(&state) % 5 == 0
+                ? (((uint64_t)selftest_rand(&state) << 32) | selftest_rand(&state)) & all : all;
+            for (int c = 0; c < columns; c++) {
+                values[s][c] = selftest_value(&state, s > 0 ? values[s - 1][c] : 0);
+            }
+            if (!sample_encoder_add(&enc, times[s], values[s], masks[s])) {
+                break;
+            }
+            encoded++;
+        }
+        if (size == buf_size && encoded != samples) {
+            break;
+        }
+
+        sample_decoder_t dec;
+        if (!sample_decoder_begin(&dec, buf, sample_encoder_len(&enc)) || dec.columns != columns ||
+            dec.utc != utc || dec.sample_count != encoded || memcmp(dec.precision, precision, columns) != 0) {
+            break;
+        }
+        int64_t decoded[SAMPLE_CODEC_MAX_COLUMNS];
+        int64_t decoded_ms;
+        uint64_t decoded_mask;
+        bool match = true;
+        for (int s = 0; s < encoded && match; s++) {
+            match = sample_decoder_next(&dec, &decoded_ms, decoded, &decoded_mask) &&
+                    decoded_ms == times[s] && decoded_mask == masks[s];
+            for (int c = 0; c < columns && match; c++) {
+                match = !(masks[s] & (1ULL << c)) || decoded[c] == values[s][c];
+            }
+        }
+        // Nothing may follow the last sample
+        if (match && !sample_decoder_next(&dec, &decoded_ms, decoded, &decoded_mask) && dec.pos == dec.len) {
+            failed = 0;
+        }
+    }
+
+    free(buf);
+    free(values);
+    return failed;
+}
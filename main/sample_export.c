@@ -0,0 +1,142 @@
+/**
+ * @file sample_export.c
+ * @brief Batch to CSV rows, bucket averaging and chunked output
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "sample_export.h"
+
+static bool export_flush(sample_export_t* exp)
+{
+    if (exp->len > 0 && !exp->failed) {
+        exp->failed = !exp->write(exp->write_ctx, exp->buf, exp->len);
+    }
+    exp->len = 0;
+    return !exp->failed;
+}
+
+/**
+ * @brief Append formatted text, flushing the buffer first when it would not fit
+ */
+static bool export_printf(sample_export_t* exp, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static bool export_printf(sample_export_t* exp, const char* fmt, ...)
+{
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_list args;
+        va_start(args, fmt);
+        const int n = vsnprintf(exp->buf + exp->len, sizeof(exp->buf) - exp->len, fmt, args);
+        va_end(args);
+        if (n >= 0 && exp->len + n < sizeof(exp->buf)) {
+            exp->len += n;
+            return true;
+        }
+        if (!export_flush(exp)) {
+            return false;
+        }
+    }
+    return false;                           // Longer than the whole buffer
+}
+
+void sample_export_begin(sample_export_t* exp, const uint8_t* selected, uint8_t count,
+                         int64_t from_ms, int64_t to_ms, int64_t step_ms,
+                         sample_export_write_t write, void* write_ctx)
+{
+    memset(exp, 0, sizeof(*exp));
+    exp->selected_count = count <= SAMPLE_CODEC_MAX_COLUMNS ? count : SAMPLE_CODEC_MAX_COLUMNS;
+    memcpy(exp->selected, selected, exp->selected_count);
+    exp->from_ms = from_ms;
+    exp->to_ms = to_ms;
+    exp->step_ms = step_ms > 0 ? step_ms : 0;
+    exp->write = write;
+    exp->write_ctx = write_ctx;
+}
+
+void sample_export_flag_column(sample_export_t* exp, uint8_t column)
+{
+    for (int i = 0; i < exp->selected_count; i++) {
+        if (exp->selected[i] == column) {
+            exp->flag_outputs |= 1ULL << i;
+        }
+    }
+}
+
+bool sample_export_header(sample_export_t* exp, const char* const* names)
+{
+    bool ok = export_printf(exp, "utc_ms");
+    for (int i = 0; i < exp->selected_count && ok; i++) {
+        ok = export_printf(exp, ",%s", names[i]);
+    }
+    return ok && export_printf(exp, "\n");
+}
+
+/**
+ * @brief Write one row: time, then each output column's value or an empty cell
+ *
+ * Values are sum / count so raw readings (count 1) and bucket means share the code.
+ */
+static bool export_row(sample_export_t* exp, int64_t time_ms)
+{
+    bool ok = export_printf(exp, "%lld", (long long)time_ms);
+    for (int i = 0; i < exp->selected_count; i++) {
+        if (exp->count[i] == 0) {
+            ok = ok && export_printf(exp, ",");
+        } else if (exp->flag_outputs & (1ULL << i)) {
+            ok = ok && export_printf(exp, ",%llu", (unsigned long long)exp->bits[i]);
+        } else {
+            ok = ok && export_printf(exp, ",%.*f", exp->bucket_precision[i], exp->sum[i] / exp->count[i]);
+        }
+        exp->sum[i] = 0;
+        exp->count[i] = 0;
+        exp->bits[i] = 0;
+    }
+    exp->rows++;
+    return ok && export_printf(exp, "\n");
+}
+
+bool sample_export_batch(sample_export_t* exp, const uint8_t* batch, size_t len)
+{
+    if (exp->failed || !sample_decoder_begin(&exp->dec, batch, len)) {
+        return false;
+    }
+
+    int64_t time_ms;
+    uint64_t valid;
+    while (sample_decoder_next(&exp->dec, &time_ms, exp->values, &valid)) {
+        if (time_ms < exp->from_ms || time_ms > exp->to_ms) {
+            continue;
+        }
+        const int64_t bucket = exp->step_ms > 0 ? time_ms - ((time_ms % exp->step_ms) + exp->step_ms) % exp->step_ms
+                                                : time_ms;
+        if (exp->bucket_open && (exp->step_ms == 0 || bucket != exp->bucket_ms) &&
+            !export_row(exp, exp->bucket_ms)) {
+            return false;
+        }
+        exp->bucket_open = true;
+        exp->bucket_ms = bucket;
+
+        for (int i = 0; i < exp->selected_count; i++) {
+            const uint8_t column = exp->selected[i];
+            if (column < exp->dec.columns && (valid & (1ULL << column))) {
+                exp->bits[i] |= (uint64_t)exp->values[column];
+                exp->sum[i] += sample_codec_value(exp->values[column], exp->dec.precision[column]);
+                exp->count[i]++;
+                exp->bucket_precision[i] = exp->dec.precision[column];
+            }
+        }
+    }
+    return exp->dec.remaining == 0 && exp->dec.pos == exp->dec.len;
+}
+
+bool sample_export_end(sample_export_t* exp)
+{
+    if (exp->bucket_open && !exp->failed) {
+        exp->bucket_open = false;
+        if (!export_row(exp, exp->bucket_ms)) {
+            return false;
+        }
+    }
+    return export_flush(exp);
+}
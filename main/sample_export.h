@@ -0,0 +1,116 @@
+/**
+ * @file sample_export.h
+ * @brief Streaming CSV export of delta-encoded batches, with on-the-fly downsampling
+ *
+ * Batches (see sample_codec.h) are decoded one at a time and written out as
+ * CSV rows through a caller-supplied writer in chunks of at most
+ * SAMPLE_EXPORT_CHUNK_SIZE bytes, so an export of any length needs only this
+ * fixed-size state:
+ *
+ *   utc_ms,voltage,active_power
+ *   1700000000000,230.12,1532.4
+ *
+ * Columns are chosen and ordered by the caller; readings outside [from, to]
+ * are skipped. With a step, each column is averaged over consecutive buckets
+ * of step milliseconds aligned to multiples of the step, and one row is
+ * written per bucket holding at least one reading, stamped with the bucket
+ * start. Empty cells are columns without a value. Bit flag columns (see
+ * sample_export_flag_column()) are ORed over a bucket instead.
+ *
+ * Like sample_codec.c this has no ESP-IDF dependencies.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sample_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SAMPLE_EXPORT_CHUNK_SIZE    1024
+
+/**
+ * @brief Receives the CSV output
+ *
+ * @return false to abort the export (e.g. the client went away)
+ */
+typedef bool (*sample_export_write_t)(void* ctx, const char* data, size_t len);
+
+/**
+ * @brief Export state
+ */
+typedef struct {
+    uint8_t selected[SAMPLE_CODEC_MAX_COLUMNS];     // Batch column of each output column
+    uint8_t selected_count;
+    int64_t from_ms;
+    int64_t to_ms;
+    int64_t step_ms;                                // 0 = every reading
+
+    bool bucket_open;
+    int64_t bucket_ms;                              // Start of the current bucket
+    uint8_t bucket_precision[SAMPLE_CODEC_MAX_COLUMNS];
+    double sum[SAMPLE_CODEC_MAX_COLUMNS];           // Per output column
+    uint32_t count[SAMPLE_CODEC_MAX_COLUMNS];
+    uint64_t flag_outputs;                          // Output columns holding bit flags
+    uint64_t bits[SAMPLE_CODEC_MAX_COLUMNS];        // OR of a flag column over the bucket
+
+    sample_decoder_t dec;
+    int64_t values[SAMPLE_CODEC_MAX_COLUMNS];
+
+    sample_export_write_t write;
+    void* write_ctx;
+    bool failed;                                    // The writer aborted
+    char buf[SAMPLE_EXPORT_CHUNK_SIZE];
+    size_t len;
+    uint32_t rows;
+} sample_export_t;
+
+/**
+ * @brief Start an export
+ *
+ * @param selected Batch column of each output column, in output order
+ * @param count    Number of output columns
+ * @param step_ms  Bucket length for downsampling, 0 for every reading
+ */
+void sample_export_begin(sample_export_t* exp, const uint8_t* selected, uint8_t count,
+                         int64_t from_ms, int64_t to_ms, int64_t step_ms,
+                         sample_export_write_t write, void* write_ctx);
+
+/**
+ * @brief Treat a batch column as bit flags: ORed over a bucket, written as an integer
+ *
+ * Call after sample_export_begin().
+ */
+void sample_export_flag_column(sample_export_t* exp, uint8_t column);
+
+/**
+ * @brief Write the header row
+ *
+ * @param names Name of each output column, in output order
+ * @return false if the writer aborted
+ */
+bool sample_export_header(sample_export_t* exp, const char* const* names);
+
+/**
+ * @brief Decode a batch and write its rows
+ *
+ * Batches must be passed in time order. Selected columns the batch does not
+ * have are left empty.
+ *
+ * @return false if the batch is malformed or the writer aborted
+ */
+bool sample_export_batch(sample_export_t* exp, const uint8_t* batch, size_t len);
+
+/**
+ * @brief Write the last bucket and everything still buffered
+ *
+ * @return false if the writer aborted
+ */
+bool sample_export_end(sample_export_t* exp);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,122 @@
+/**
+ * @file status_led.c
+ * @brief LEDC-driven status LED patterns
+ */
+
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "status_led.h"
+
+static const char* TAG = "SDM_LED";
+
+#define STATUS_LED_SPEED_MODE   LEDC_LOW_SPEED_MODE     // Only low speed mode can run from RC_FAST
+#define STATUS_LED_TIMER        LEDC_TIMER_0
+#define STATUS_LED_CHANNEL      LEDC_CHANNEL_0
+#define STATUS_LED_RESOLUTION   LEDC_TIMER_10_BIT
+#define STATUS_LED_DUTY_MAX     ((1 << 10) - 1)
+
+/**
+ * @brief Blink frequency and on-time of one state
+ */
+typedef struct {
+    uint32_t freq_hz;
+    uint16_t duty_permille;
+} status_led_pattern_t;
+
+static const status_led_pattern_t s_patterns[] = {
+    [STATUS_LED_BOOTING]        = { .freq_hz = 1, .duty_permille = 1000 },
+    [STATUS_LED_NETWORK_DOWN]   = { .freq_hz = 4, .duty_permille = 500 },
+    [STATUS_LED_MODBUS_FAILING] = { .freq_hz = 1, .duty_permille = 500 },
+    [STATUS_LED_MQTT_BACKLOG]   = { .freq_hz = 1, .duty_permille = 850 },
+    [STATUS_LED_HEALTHY]        = { .freq_hz = 1, .duty_permille = 30 },
+};
+
+static SemaphoreHandle_t s_lock = NULL;
+static status_led_state_t s_state = STATUS_LED_BOOTING;
+
+/**
+ * @brief Program the LEDC timer and channel for a pattern
+ */
+static void status_led_apply(const status_led_pattern_t* pattern)
+{
+    const uint32_t duty = (uint32_t)pattern->duty_permille * STATUS_LED_DUTY_MAX / 1000;
+    ledc_set_freq(STATUS_LED_SPEED_MODE, STATUS_LED_TIMER, pattern->freq_hz);
+    ledc_set_duty(STATUS_LED_SPEED_MODE, STATUS_LED_CHANNEL, duty);
+    ledc_update_duty(STATUS_LED_SPEED_MODE, STATUS_LED_CHANNEL);
+}
+
+esp_err_t status_led_init(int gpio, bool keep_in_light_sleep)
+{
+    ledc_timer_config_t timer_config = {
+        .speed_mode = STATUS_LED_SPEED_MODE,
+        .duty_resolution = STATUS_LED_RESOLUTION,
+        .timer_num = STATUS_LED_TIMER,
+        .freq_hz = s_patterns[STATUS_LED_BOOTING].freq_hz,
+        .clk_cfg = LEDC_USE_RC_FAST_CLK,
+    };
+    esp_err_t err = ledc_timer_config(&timer_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ LEDC timer configuration failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    ledc_channel_config_t channel_config = {
+        .gpio_num = gpio,
+        .speed_mode = STATUS_LED_SPEED_MODE,
+        .channel = STATUS_LED_CHANNEL,
+        .timer_sel = STATUS_LED_TIMER,
+        .duty = STATUS_LED_DUTY_MAX,
+        .hpoint = 0,
+    };
+    err = ledc_channel_config(&channel_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "❌ LEDC channel configuration failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    if (keep_in_light_sleep) {
+        // RC_FAST and the pin's active configuration must survive light sleep
+        esp_sleep_pd_config(ESP_PD_DOMAIN_RC_FAST, ESP_PD_OPTION_ON);
+        gpio_sleep_sel_dis(gpio);
+    }
+
+    // Created last: status_led_set() stays a no-op unless the LEDC setup succeeded
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "✅ Status LED on GPIO%d driven by LEDC", gpio);
+    return ESP_OK;
+}
+
+void status_led_set(status_led_state_t state)
+{
+    if (s_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (state != s_state) {
+        ESP_LOGI(TAG, "💡 Status LED: %s -> %s", status_led_state_name(s_state), status_led_state_name(state));
+        s_state = state;
+        status_led_apply(&s_patterns[state]);
+    }
+    xSemaphoreGive(s_lock);
+}
+
+const char* status_led_state_name(status_led_state_t state)
+{
+    switch (state) {
+        case STATUS_LED_BOOTING:        return "booting";
+        case STATUS_LED_NETWORK_DOWN:   return "network down";
+        case STATUS_LED_MODBUS_FAILING: return "modbus failing";
+        case STATUS_LED_MQTT_BACKLOG:   return "mqtt backlog";
+        case STATUS_LED_HEALTHY:        return "healthy";
+        default:                        return "unknown";
+    }
+}
@@ -0,0 +1,56 @@
+/**
+ * @file status_led.h
+ * @brief Status LED patterns generated by the LEDC peripheral
+ *
+ * Each system state maps to a blink frequency and duty cycle that the LEDC
+ * timer produces on its own: the CPU is only involved when the state changes,
+ * so the LED costs no task, no stack and no periodic wakeups.
+ *
+ * The timer runs from the RC_FAST clock, which can stay powered in light sleep,
+ * so the pattern keeps running while the chip sleeps.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief System states shown on the LED, in increasing order of health
+ */
+typedef enum {
+    STATUS_LED_BOOTING = 0,         // Solid on until the first network event
+    STATUS_LED_NETWORK_DOWN,        // Fast blink (4 Hz)
+    STATUS_LED_MODBUS_FAILING,      // Even blink (1 Hz)
+    STATUS_LED_MQTT_BACKLOG,        // Mostly on, short off (1 Hz): broker down or outbox backing up
+    STATUS_LED_HEALTHY,             // Short blip once a second
+} status_led_state_t;
+
+/**
+ * @brief Configure the LEDC timer and channel on the LED pin and show STATUS_LED_BOOTING
+ *
+ * @param gpio                 LED pin (active high)
+ * @param keep_in_light_sleep  Keep RC_FAST powered so the pattern runs through light sleep
+ * @return ESP_OK on success, LEDC error otherwise
+ */
+esp_err_t status_led_init(int gpio, bool keep_in_light_sleep);
+
+/**
+ * @brief Switch the LED to the pattern of a state
+ *
+ * Cheap when the state is unchanged; safe to call from any task. Ignored until
+ * status_led_init() succeeded.
+ */
+void status_led_set(status_led_state_t state);
+
+/**
+ * @brief Short name of a state for logs
+ */
+const char* status_led_state_name(status_led_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
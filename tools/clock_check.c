@@ -0,0 +1,281 @@
+/**
+ * @file clock_check.c
+ * @brief The clock discipline against a simulated NTP server with injected offsets and drift
+ *
+ * Build from the repository root:
+ *
+ *   gcc -O2 -Wall -Imain -o clock_check tools/clock_check.c main/clock_discipline.c -lm
+ *
+ * Usage:
+ *
+ *   ./clock_check                 # built-in scenarios, exit status 1 on a violated bound
+ *   ./clock_check -v              # also print every sync
+ *   ./clock_check --only step     # scenarios whose name contains the text
+ *
+ * main/clock_discipline.c gets the same input it gets from the SNTP callback:
+ * (monotonic, UTC) pairs. The monotonic clock runs off by a drift that can
+ * change mid-run; the NTP stand-in answers with its own time plus a random
+ * error of up to the jitter, can step its clock, and can stop answering.
+ * Syncs come at the firmware's interval and the configuration is the Kconfig
+ * default (5 ms per sync, 20 ppm residual drift, stale after three missed
+ * syncs).
+ *
+ * Every 10 s of simulated time, like a poll, a timestamp is mapped to UTC and
+ * compared with the server's time without the jitter:
+ *
+ *   max_err      largest mapping error
+ *   violations   samples whose error exceeds the published uncertainty (for a
+ *                clock drifting beyond the configured bound: once its rate is learnt)
+ *   rate_err     |estimated - true frequency error| at the end of the run
+ *   steps        syncs handled as a clock step (rate estimate reset)
+ *   resettle     syncs after the last injected event until the rate is within 1 ppm again
+ *   stale        samples reported stale
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clock_discipline.h"
+
+#define BASE_UNCERTAINTY_US     5000        // CONFIG_SDM_TIME_BASE_UNCERTAINTY_US
+#define DRIFT_BOUND_PPM         20          // CONFIG_SDM_TIME_DRIFT_PPM
+#define SYNC_INTERVAL_S         3600        // CONFIG_SDM_SNTP_SYNC_INTERVAL_S
+#define SAMPLE_INTERVAL_S       10
+#define FIRST_SYNC_S            5           // Boot to first SNTP answer
+#define EPOCH_US                1700000000000000LL
+#define SETTLED_PPM             1.0
+#define NONE                    -1          // Unused event time
+
+typedef struct {
+    const char* name;
+    int duration_h;
+    int interval_s;                 // 0 for SYNC_INTERVAL_S
+    double drift_ppm;               // Monotonic clock frequency error
+    uint32_t jitter_us;             // NTP answers are off by up to this much
+    int event_h;                    // Time of the injected event, NONE for none
+    int64_t step_us;                // Server clock step at event_h (slew below 1 s, step above)
+    double drift_after_ppm;         // Monotonic drift from event_h on
+    int outage_h;                   // Server silent from event_h for this long
+
+    bool beyond_bound;              // Drift exceeds DRIFT_BOUND_PPM: no bound holds until the rate is learnt
+
+    // Bounds (no scenario may exceed the published uncertainty)
+    double max_rate_err_ppm;
+    int expect_steps;
+    int max_resettle;               // Syncs, NONE for no bound
+    bool expect_stale;
+    bool expect_unsynced;           // Never synced: no mapping at all
+} scenario_t;
+
+static const scenario_t SCENARIOS[] = {
+    { .name = "locked_+10ppm", .duration_h = 48, .drift_ppm = 10, .jitter_us = 1000, .event_h = NONE,
+      .max_rate_err_ppm = 0.5, .max_resettle = NONE },
+    { .name = "locked_-18ppm", .duration_h = 48, .drift_ppm = -18, .jitter_us = 1000, .event_h = NONE,
+      .max_rate_err_ppm = 0.5, .max_resettle = NONE },
+    { .name = "jitter_5ms", .duration_h = 48, .drift_ppm = 10, .jitter_us = 5000, .event_h = NONE,
+      .max_rate_err_ppm = 2.0, .max_resettle = NONE },
+    { .name = "step_forward_30s", .duration_h = 48, .drift_ppm = 10, .jitter_us = 1000, .event_h = 24,
+      .step_us = 30000000, .drift_after_ppm = 10,
+      .max_rate_err_ppm = 0.5, .expect_steps = 1, .max_resettle = 8 },
+    { .name = "step_back_2s", .duration_h = 48, .drift_ppm = -12, .jitter_us = 1000, .event_h = 24,
+      .step_us = -2000000, .drift_after_ppm = -12,
+      .max_rate_err_ppm = 0.5, .expect_steps = 1, .max_resettle = 8 },
+    // A sub-second server jump beyond what drift explains is a phase correction: the rate stays put
+    { .name = "slew_300ms", .duration_h = 48, .drift_ppm = 10, .jitter_us = 1000, .event_h = 24,
+      .step_us = 300000, .drift_after_ppm = 10,
+      .max_rate_err_ppm = 0.5, .expect_steps = 0, .max_resettle = 1 },
+    { .name = "slew_back_90ms", .duration_h = 48, .drift_ppm = -15, .jitter_us = 1000, .event_h = 24,
+      .step_us = -90000, .drift_after_ppm = -15,
+      .max_rate_err_ppm = 0.5, .expect_steps = 0, .max_resettle = 1 },
+    // Out of spec: the crystal drifts beyond the 20 ppm bound. Its excess repeats every sync, so
+    // the rate is still learnt rather than taken for a phase correction each time.
+    { .name = "drift_40ppm", .duration_h = 48, .drift_ppm = 40, .jitter_us = 1000, .event_h = NONE,
+      .beyond_bound = true, .max_rate_err_ppm = 0.5, .max_resettle = NONE },
+    { .name = "drift_change_+5_+15", .duration_h = 48, .drift_ppm = 5, .jitter_us = 1000, .event_h = 24,
+      .drift_after_ppm = 15, .max_rate_err_ppm = 0.5, .max_resettle = 8 },
+    { .name = "outage_5h", .duration_h = 24, .drift_ppm = 15, .jitter_us = 1000, .event_h = 12,
+      .drift_after_ppm = 15, .outage_h = 5, .max_rate_err_ppm = 0.5, .max_resettle = NONE,
+      .expect_stale = true },
+    { .name = "fast_sync_15s", .duration_h = 6, .interval_s = 15, .drift_ppm = 15, .jitter_us = 1000,
+      .event_h = NONE, .max_rate_err_ppm = 15.5, .max_resettle = NONE },
+    { .name = "never_synced", .duration_h = 2, .drift_ppm = 10, .event_h = 0, .drift_after_ppm = 10,
+      .outage_h = 2, .max_resettle = NONE, .expect_unsynced = true },
+};
+
+typedef struct {
+    double max_err_us;
+    int violations;
+    double rate_err_ppm;
+    int steps;
+    int step_kept_rate;             // Steps after which the old rate estimate survived
+    int resettle;                   // -1 if never settled after the event
+    int stale;
+    int mapped;                     // Samples with a UTC mapping
+} result_t;
+
+static uint32_t s_rng = 1;
+static bool s_verbose = false;
+
+static double jitter(uint32_t max_us)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return max_us == 0 ? 0.0 : ((double)(s_rng % (2 * max_us + 1)) - max_us);
+}
+
+static result_t run(const scenario_t* scn)
+{
+    result_t r = { .resettle = -1 };
+    clock_discipline_t cd;
+    const int interval_s = scn->interval_s > 0 ? scn->interval_s : SYNC_INTERVAL_S;
+    clock_discipline_init(&cd, BASE_UNCERTAINTY_US, DRIFT_BOUND_PPM, (int64_t)interval_s * 3 * 1000000);
+    s_rng = 1;
+
+    // Events land on a sync, so the samples measure the discipline rather than the wait for the next sync
+    const int64_t event_s = scn->event_h == NONE ? INT64_MAX : (int64_t)scn->event_h * 3600 + FIRST_SYNC_S;
+    const int64_t outage_end_s = event_s == INT64_MAX ? INT64_MAX : event_s + (int64_t)scn->outage_h * 3600;
+    double mono_us = 1000000.0;                 // esp_timer after the boot up to t = 0
+    int syncs_since_event = 0;
+    bool settled = false;
+    bool learnt = !scn->beyond_bound;
+
+    for (int64_t t_s = 0; t_s <= (int64_t)scn->duration_h * 3600; t_s++) {
+        const bool after_event = t_s >= event_s;
+        const double drift_ppm = after_event ? scn->drift_after_ppm : scn->drift_ppm;
+        const int64_t server_us = EPOCH_US + t_s * 1000000 + (after_event ? scn->step_us : 0);
+
+        const bool silent = t_s >= event_s && t_s < outage_end_s;
+        if (t_s >= FIRST_SYNC_S && (t_s - FIRST_SYNC_S) % interval_s == 0 && !silent) {
+            const double rate_before = cd.rate_ppm;
+            clock_discipline_update(&cd, (int64_t)mono_us, server_us + (int64_t)jitter(scn->jitter_us));
+            const bool step = cd.sync_count > 1 && llabs(cd.last_offset_us) >= 1000000;
+            if (step) {
+                r.steps++;
+                if (cd.rate_ppm != 0.0) {
+                    r.step_kept_rate++;
+                }
+            }
+            learnt = learnt || fabs(cd.rate_ppm + drift_ppm) < SETTLED_PPM;
+            if (after_event) {
+                syncs_since_event++;
+                // True rate: UTC runs at 1 / (1 + drift) of the monotonic clock
+                const bool within = fabs(cd.rate_ppm + drift_ppm) < SETTLED_PPM;
+                if (within && !settled) {
+                    settled = true;
+                    r.resettle = syncs_since_event;
+                } else if (!within) {
+                    settled = false;
+                }
+            }
+            if (s_verbose) {
+                printf("  %7.2f h  sync: offset %+10.3f ms  rate %+8.3f ppm (was %+8.3f)%s\n", t_s / 3600.0,
+                       cd.last_offset_us / 1000.0, cd.rate_ppm, rate_before, step ? "  step" : "");
+            }
+        }
+
+        if (t_s % SAMPLE_INTERVAL_S == 0) {
+            const clock_sync_state_t state = clock_discipline_state(&cd, (int64_t)mono_us);
+            int64_t utc_us;
+            uint32_t uncertainty_us;
+            if (clock_discipline_to_utc(&cd, (int64_t)mono_us, &utc_us, &uncertainty_us)) {
+                r.mapped++;
+                const double err_us = fabs((double)(utc_us - server_us));
+                if (err_us > r.max_err_us) {
+                    r.max_err_us = err_us;
+                }
+                if (err_us > uncertainty_us && learnt) {
+                    r.violations++;
+                }
+            }
+            if (state == CLOCK_SYNC_STALE) {
+                r.stale++;
+            }
+        }
+        mono_us += 1000000.0 * (1.0 + drift_ppm * 1e-6);
+    }
+
+    const double final_drift = event_s == INT64_MAX ? scn->drift_ppm : scn->drift_after_ppm;
+    r.rate_err_ppm = fabs(cd.rate_ppm + final_drift);
+    if (!settled) {
+        r.resettle = -1;
+    }
+    return r;
+}
+
+/**
+ * @brief Compare a run with the scenario's bounds
+ *
+ * @return Number of violated bounds, each described in detail
+ */
+static int check(const scenario_t* scn, const result_t* r, char* detail, size_t size)
+{
+    int failed = 0;
+    int len = 0;
+#define VIOLATED(...) do { failed++; len += snprintf(detail + len, size - (size_t)len, "\n    violated: " __VA_ARGS__); } while (0)
+    if (scn->expect_unsynced) {
+        if (r->mapped != 0) {
+            VIOLATED("mapped %d samples without a sync", r->mapped);
+        }
+        return failed;
+    }
+    if (r->violations > 0) {
+        VIOLATED("violations == 0 (got %d)", r->violations);
+    }
+    if (r->rate_err_ppm > scn->max_rate_err_ppm) {
+        VIOLATED("rate_err <= %.2f ppm (got %.3f)", scn->max_rate_err_ppm, r->rate_err_ppm);
+    }
+    if (r->steps != scn->expect_steps) {
+        VIOLATED("steps == %d (got %d)", scn->expect_steps, r->steps);
+    }
+    if (r->step_kept_rate != 0) {
+        VIOLATED("rate reset on every step (kept on %d)", r->step_kept_rate);
+    }
+    if (scn->max_resettle != NONE && (r->resettle < 0 || r->resettle > scn->max_resettle)) {
+        VIOLATED("resettle <= %d syncs (got %d)", scn->max_resettle, r->resettle);
+    }
+    if ((r->stale > 0) != scn->expect_stale) {
+        VIOLATED("stale %s 0 (got %d)", scn->expect_stale ? ">" : "==", r->stale);
+    }
+#undef VIOLATED
+    return failed;
+}
+
+int main(int argc, char** argv)
+{
+    const char* only = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            s_verbose = true;
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [-v] [--only TEXT]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int run_count = 0;
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+        const scenario_t* scn = &SCENARIOS[i];
+        if (only != NULL && strstr(scn->name, only) == NULL) {
+            continue;
+        }
+        if (s_verbose) {
+            printf("%s:\n", scn->name);
+        }
+        const result_t r = run(scn);
+        char detail[512] = "";
+        const bool ok = check(scn, &r, detail, sizeof(detail)) == 0;
+        run_count++;
+        failed += !ok;
+        printf("%-20s %s  max_err %8.3f ms violations %4d rate_err %6.3f ppm steps %d resettle %2d stale %4d%s\n",
+               scn->name, ok ? "ok  " : "FAIL", r.max_err_us / 1000.0, r.violations, r.rate_err_ppm, r.steps,
+               r.resettle, r.stale, detail);
+    }
+    printf("%d of %d scenarios passed\n", run_count - failed, run_count);
+    return failed > 0 ? 1 : 0;
+}
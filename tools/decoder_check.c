@@ -0,0 +1,171 @@
+/**
+ * @file decoder_check.c
+ * @brief meter_decode_floats() against a scalar reference, bit for bit, and its decode time
+ *
+ * Build from the repository root:
+ *
+ *   gcc -O2 -Wall -Imain -Itools/host -o decoder_check tools/decoder_check.c main/meter_profiles.c
+ *
+ * Usage:
+ *
+ *   ./decoder_check               # exit status 1 on a mismatch
+ *   ./decoder_check -v            # also list every mismatching value
+ *
+ * On x86-64 (SSE2) and AArch64 (NEON) hosts meter_decode_floats() converts
+ * four values per iteration with vector shuffles and the rest in its scalar
+ * tail loop; the firmware targets only compile the scalar loop. Every length
+ * from 0 to 67 values is decoded at four register offsets, so the vector body,
+ * the tail and both together all run, and each output is compared as raw bits
+ * with an independent word swap: NaN != NaN would otherwise hide a broken
+ * payload. The patterns are signed zeros, denormals, infinities, quiet and
+ * signalling NaNs with payloads and a pseudo-random sweep. Canaries around the
+ * output catch writes past the last value.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "meter_profiles.h"
+
+#define MAX_VALUES      67          // Not a multiple of 4: the tail loop always runs
+#define MAX_OFFSET      4           // Register pairs skipped before the first value
+#define CANARY          0xA5A5A5A5u
+#define BENCH_VALUES    64
+#define BENCH_ROUNDS    200000
+
+static const uint32_t FIXED_PATTERNS[] = {
+    0x00000000, 0x80000000,             // +0, -0
+    0x00000001, 0x807FFFFF, 0x00400000, // denormals
+    0x00800000, 0x7F7FFFFF,             // smallest normal, FLT_MAX
+    0x7F800000, 0xFF800000,             // +inf, -inf
+    0x7FC00000, 0xFFC00001,             // quiet NaNs
+    0x7F800001, 0x7FBFFFFF,             // signalling NaNs
+    0xFFA00005, 0x7FC12345,             // signalling and quiet NaNs with payloads, negative and positive
+    0x43665999, 0x3F7D70A4,             // 230.35 V, 0.99 PF
+};
+#define FIXED_COUNT (sizeof(FIXED_PATTERNS) / sizeof(FIXED_PATTERNS[0]))
+
+/**
+ * @brief Reference decode: one value from its register pair, high word first
+ */
+static float decode_scalar(const uint16_t* pair)
+{
+    const uint32_t bits = ((uint32_t)pair[0] << 16) | pair[1];
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static uint32_t bits_of(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char* vector_path(void)
+{
+#if defined(__SSE2__)
+    return "SSE2";
+#elif defined(__ARM_NEON)
+    return "NEON";
+#else
+    return "none (scalar loop only)";
+#endif
+}
+
+int main(int argc, char** argv)
+{
+    const bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+    if (argc > 2 || (argc == 2 && !verbose)) {
+        fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+        return 2;
+    }
+
+    // Register pairs exactly as the meter puts them on the wire; fixed patterns
+    // first and again at the end, so they land in vector lanes and in the tail
+    enum { PATTERN_COUNT = MAX_OFFSET + MAX_VALUES };
+    static uint32_t patterns[PATTERN_COUNT];
+    static uint16_t regs[PATTERN_COUNT * 2];
+    uint32_t lcg = 0x12345678;
+    for (int i = 0; i < PATTERN_COUNT; i++) {
+        if (i < (int)FIXED_COUNT) {
+            patterns[i] = FIXED_PATTERNS[i];
+        } else if (i >= PATTERN_COUNT - (int)FIXED_COUNT) {
+            patterns[i] = FIXED_PATTERNS[i - (PATTERN_COUNT - FIXED_COUNT)];
+        } else {
+            lcg = lcg * 1664525u + 1013904223u;
+            patterns[i] = lcg;
+        }
+        regs[2 * i] = (uint16_t)(patterns[i] >> 16);
+        regs[2 * i + 1] = (uint16_t)(patterns[i] & 0xFFFF);
+    }
+
+    int runs = 0;
+    int mismatches = 0;
+    for (int offset = 0; offset < MAX_OFFSET; offset++) {
+        for (int count = 0; count <= MAX_VALUES; count++) {
+            float out[MAX_VALUES + 2];
+            for (int i = 0; i < MAX_VALUES + 2; i++) {
+                const uint32_t canary = CANARY;
+                memcpy(&out[i], &canary, sizeof(canary));
+            }
+            const uint16_t* first = regs + 2 * offset;
+            meter_decode_floats(first, out + 1, (size_t)count);
+            runs++;
+
+            for (int i = 0; i < MAX_VALUES + 2; i++) {
+                const bool value = i >= 1 && i <= count;
+                const uint32_t expected = value ? bits_of(decode_scalar(first + 2 * (i - 1))) : CANARY;
+                const uint32_t got = bits_of(out[i]);
+                if (value && expected != patterns[offset + i - 1]) {
+                    fprintf(stderr, "reference decode broken: 0x%08" PRIX32 " for 0x%08" PRIX32 "\n",
+                            expected, patterns[offset + i - 1]);
+                    return 1;
+                }
+                if (got != expected) {
+                    mismatches++;
+                    if (verbose) {
+                        printf("offset %d count %2d %s %2d: expected 0x%08" PRIX32 ", got 0x%08" PRIX32 "\n",
+                               offset, count, value ? "value" : "canary", value ? i - 1 : i, expected, got);
+                    }
+                }
+            }
+        }
+    }
+    printf("vector path: %s\n", vector_path());
+    printf("%d decodes of 0 to %d values at %d offsets: %d mismatches\n", runs, MAX_VALUES, MAX_OFFSET, mismatches);
+
+    // Per-value time of the reference and of meter_decode_floats() on one block
+    static float bench_out[BENCH_VALUES];
+    volatile uint32_t sink = 0;
+    const int64_t t0 = now_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (int i = 0; i < BENCH_VALUES; i++) {
+            bench_out[i] = decode_scalar(regs + 2 * i);
+        }
+        sink ^= bits_of(bench_out[r % BENCH_VALUES]);
+    }
+    const int64_t t1 = now_ns();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        meter_decode_floats(regs, bench_out, BENCH_VALUES);
+        sink ^= bits_of(bench_out[r % BENCH_VALUES]);
+    }
+    const int64_t t2 = now_ns();
+    const double total = (double)BENCH_VALUES * BENCH_ROUNDS;
+    printf("scalar reference: %.2f ns/value, meter_decode_floats: %.2f ns/value\n",
+           (double)(t1 - t0) / total, (double)(t2 - t1) / total);
+
+    return mismatches == 0 ? 0 : 1;
+}
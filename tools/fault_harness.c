@@ -0,0 +1,862 @@
+/**
+ * @file fault_harness.c
+ * @brief Fault-injection runs of the poll, retry and reconnect paths on a virtual clock
+ *
+ * Build from the repository root:
+ *
+ *   gcc -O2 -Wall -Imain -Itools/host -o fault_harness tools/fault_harness.c \
+ *       main/poll_cycle.c main/meter_profiles.c
+ *
+ * Usage:
+ *
+ *   ./fault_harness                       # built-in scenarios, exit status 1 on a violated bound
+ *   ./fault_harness --list                # print the built-in scenarios as scenario files
+ *   ./fault_harness -v wifi.scn           # run a scenario file, logging every event
+ *   ./fault_harness --only wifi_drop      # built-in scenarios whose name contains the text
+ *
+ * The acquisition loop of the firmware runs against a simulated SDM120 and
+ * network, in virtual time, so an hour of outages takes milliseconds. Each
+ * cycle is poll_cycle_read() from main/poll_cycle.c with the firmware's block
+ * plan - the retry delays, the link check after repeated timeouts and the
+ * timestamps are the firmware's code, not a copy of it. Around it the harness
+ * mirrors sdm120_acquisition_task(): pause while the network is down, the
+ * extra delay after a cycle that read nothing, vTaskDelayUntil() pacing.
+ *
+ * The WiFi and MQTT side follows the firmware's state machines on their
+ * Kconfig defaults: a lost link is noticed after the beacon timeout, the first
+ * reconnect is immediate and later ones wait poll_reconnect_delay_ms() (the
+ * firmware's backoff, jittered from a seeded generator), MQTT reconnects as
+ * soon as the link is back and otherwise every reconnect_timeout_ms, as
+ * esp-mqtt does. A reading is delivered when MQTT is connected as it
+ * completes; otherwise it is dropped, as mqtt_publish_sdm120_data() does.
+ *
+ * Scenario file (one directive per line, # starts a comment):
+ *
+ *   name      wifi_drop_60s
+ *   duration  600                       # seconds of virtual time
+ *   set       interval_ms 5000          # model parameter, see --list
+ *   at 120 for 60 wifi_drop             # fault from t=120 s for 60 s
+ *   at 300 for 30 timeout 1             # Modbus fault on block 1 (* or omitted: all)
+ *   expect    recovery_ms <= 15000
+ *
+ * Faults: timeout (no response within the response timeout), exception (a
+ * Modbus exception response), truncated (a short frame: the master waits out
+ * the timeout, then rejects it), wifi_drop (access point unreachable),
+ * broker_down (broker refuses connections).
+ *
+ * Metrics, each usable in expect with <= or >=:
+ *
+ *   expected      cycles at the nominal interval over the duration
+ *   delivered     readings published, complete or partial
+ *   lost          expected minus delivered
+ *   partial       readings published with some registers missing
+ *   overruns      cycles that ran past their interval
+ *   recovery_ms   longest time from the end of a fault, or of the faults
+ *                 overlapping it, to the next complete published reading (the
+ *                 duration if there was none)
+ *   max_gap_ms    longest time between published readings, including from
+ *                 the start and to the end of the run
+ *   link_checks   connectivity checks after repeated timeouts
+ *   retries       Modbus attempts beyond the first
+ *   wifi_attempts WiFi connection attempts
+ *   mqtt_attempts MQTT connection attempts
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "meter_profiles.h"
+#include "poll_cycle.h"
+
+#define MAX_FAULTS          64
+#define MAX_EXPECTS         32
+#define MAX_LINE            256
+
+// esp_err_t values the simulated esp-modbus master returns
+#define ERR_TIMEOUT             0x107   // ESP_ERR_TIMEOUT
+#define ERR_INVALID_RESPONSE    0x108   // ESP_ERR_INVALID_RESPONSE
+
+typedef enum {
+    FAULT_TIMEOUT,
+    FAULT_EXCEPTION,
+    FAULT_TRUNCATED,
+    FAULT_WIFI_DROP,
+    FAULT_BROKER_DOWN,
+    FAULT_KIND_COUNT
+} fault_kind_t;
+
+static const char* const FAULT_NAMES[FAULT_KIND_COUNT] = {
+    "timeout", "exception", "truncated", "wifi_drop", "broker_down"
+};
+
+typedef struct {
+    int64_t start_ms;
+    int64_t end_ms;
+    fault_kind_t kind;
+    int block;                  // Modbus faults: block index, -1 for every block
+} fault_t;
+
+/**
+ * @brief Timing model; defaults are the firmware's Kconfig defaults or measured figures
+ */
+typedef struct {
+    const char* name;
+    uint32_t value;
+    const char* help;
+} param_t;
+
+enum {
+    P_INTERVAL_MS, P_INTER_BLOCK_MS, P_TIMEOUT_MS, P_LATENCY_MS, P_BEACON_TIMEOUT_MS,
+    P_WIFI_CONNECT_MS, P_WIFI_FAIL_MS, P_BACKOFF_MIN_MS, P_BACKOFF_MAX_MS, P_MQTT_CONNECT_MS,
+    P_MQTT_RECONNECT_MS, P_SEED, PARAM_COUNT
+};
+
+static const param_t PARAM_DEFAULTS[PARAM_COUNT] = {
+    [P_INTERVAL_MS]       = { "interval_ms",       5000,  "poll interval (READ_INTERVAL_MS)" },
+    [P_INTER_BLOCK_MS]    = { "inter_block_ms",    200,   "pause between blocks (SDM120_INTER_PARAM_DELAY)" },
+    [P_TIMEOUT_MS]        = { "timeout_ms",        5000,  "Modbus response timeout (SDM120_MODBUS_TIMEOUT)" },
+    [P_LATENCY_MS]        = { "latency_ms",        20,    "Modbus transaction time when the meter answers" },
+    [P_BEACON_TIMEOUT_MS] = { "beacon_timeout_ms", 6000,  "time for the station to notice a lost access point" },
+    [P_WIFI_CONNECT_MS]   = { "wifi_connect_ms",   1500,  "association plus DHCP when the access point is there" },
+    [P_WIFI_FAIL_MS]      = { "wifi_fail_ms",      3000,  "time until a failed connection attempt is reported" },
+    [P_BACKOFF_MIN_MS]    = { "backoff_min_ms",    500,   "WIFI_BACKOFF_MIN_MS" },
+    [P_BACKOFF_MAX_MS]    = { "backoff_max_ms",    30000, "WIFI_BACKOFF_MAX_MS" },
+    [P_MQTT_CONNECT_MS]   = { "mqtt_connect_ms",   300,   "TCP plus MQTT CONNECT round trips" },
+    [P_MQTT_RECONNECT_MS] = { "mqtt_reconnect_ms", 5000,  "esp-mqtt reconnect_timeout_ms" },
+    [P_SEED]              = { "seed",              1,     "seed of the backoff jitter" },
+};
+
+typedef enum { CMP_LE, CMP_GE } cmp_t;
+
+typedef struct {
+    char metric[32];
+    cmp_t cmp;
+    int64_t bound;
+} expect_t;
+
+typedef struct {
+    char name[64];
+    int64_t duration_ms;
+    uint32_t param[PARAM_COUNT];
+    fault_t faults[MAX_FAULTS];
+    int fault_count;
+    expect_t expects[MAX_EXPECTS];
+    int expect_count;
+} scenario_t;
+
+typedef struct {
+    int64_t expected;
+    int64_t delivered;
+    int64_t lost;
+    int64_t partial;
+    int64_t overruns;
+    int64_t recovery_ms;
+    int64_t max_gap_ms;
+    int64_t link_checks;
+    int64_t retries;
+    int64_t wifi_attempts;
+    int64_t mqtt_attempts;
+} metrics_t;
+
+static const struct {
+    const char* name;
+    size_t offset;
+} METRICS[] = {
+    { "expected",      offsetof(metrics_t, expected) },
+    { "delivered",     offsetof(metrics_t, delivered) },
+    { "lost",          offsetof(metrics_t, lost) },
+    { "partial",       offsetof(metrics_t, partial) },
+    { "overruns",      offsetof(metrics_t, overruns) },
+    { "recovery_ms",   offsetof(metrics_t, recovery_ms) },
+    { "max_gap_ms",    offsetof(metrics_t, max_gap_ms) },
+    { "link_checks",   offsetof(metrics_t, link_checks) },
+    { "retries",       offsetof(metrics_t, retries) },
+    { "wifi_attempts", offsetof(metrics_t, wifi_attempts) },
+    { "mqtt_attempts", offsetof(metrics_t, mqtt_attempts) },
+};
+#define METRIC_COUNT ((int)(sizeof(METRICS) / sizeof(METRICS[0])))
+
+/* Built-in scenarios: the reliability targets of the default configuration */
+
+static const char* const BUILTIN_SCENARIOS[] = {
+    "name baseline\n"
+    "duration 600\n"
+    "expect lost <= 0\n"
+    "expect partial <= 0\n"
+    "expect overruns <= 0\n"
+    "expect retries <= 0\n",
+
+    // One block unanswered: every cycle spends three timeouts plus the retry delays on it
+    "name block_timeout_60s\n"
+    "duration 600\n"
+    "at 120 for 60 timeout 0\n"
+    "expect lost <= 10\n"
+    "expect partial <= 4\n"
+    "expect overruns <= 4\n"
+    "expect recovery_ms <= 20000\n"
+    "expect link_checks <= 0\n",
+
+    // Meter powered off: three blocks lost to timeouts trigger the link check
+    "name meter_offline_60s\n"
+    "duration 600\n"
+    "at 120 for 60 timeout *\n"
+    "expect lost <= 14\n"
+    "expect recovery_ms <= 50000\n"
+    "expect link_checks >= 1\n"
+    "expect max_gap_ms <= 110000\n",
+
+    // Exceptions come back fast: only the retry delays are lost
+    "name exception_60s\n"
+    "duration 600\n"
+    "at 120 for 60 exception 1\n"
+    "expect lost <= 0\n"
+    "expect partial <= 13\n"
+    "expect overruns <= 0\n"
+    "expect recovery_ms <= 5000\n",
+
+    "name truncated_30s\n"
+    "duration 600\n"
+    "at 200 for 30 truncated *\n"
+    "expect lost <= 8\n"
+    "expect recovery_ms <= 50000\n"
+    "expect max_gap_ms <= 80000\n",
+
+    // Access point gone for a minute: polling pauses, reconnect backs off
+    "name wifi_drop_60s\n"
+    "duration 600\n"
+    "at 120 for 60 wifi_drop\n"
+    "expect lost <= 16\n"
+    "expect recovery_ms <= 30000\n"
+    "expect max_gap_ms <= 100000\n"
+    "expect wifi_attempts <= 12\n",
+
+    // Short drops in a row must not ratchet the backoff up
+    "name wifi_flap\n"
+    "duration 900\n"
+    "at 100 for 5 wifi_drop\n"
+    "at 200 for 5 wifi_drop\n"
+    "at 300 for 5 wifi_drop\n"
+    "at 400 for 20 wifi_drop\n"
+    "at 500 for 5 wifi_drop\n"
+    "expect lost <= 20\n"
+    "expect recovery_ms <= 15000\n"
+    "expect max_gap_ms <= 45000\n",
+
+    // Long outage: the backoff must cap at backoff_max_ms
+    "name wifi_drop_10min\n"
+    "duration 1800\n"
+    "at 300 for 600 wifi_drop\n"
+    "expect lost <= 132\n"
+    "expect recovery_ms <= 40000\n"
+    "expect wifi_attempts <= 40\n",
+
+    "name broker_down_60s\n"
+    "duration 600\n"
+    "at 120 for 60 broker_down\n"
+    "expect lost <= 13\n"
+    "expect recovery_ms <= 10000\n"
+    "expect max_gap_ms <= 70000\n"
+    "expect overruns <= 0\n",
+
+    // Everything at once: the broker and one block fail while WiFi drops
+    "name combined\n"
+    "duration 900\n"
+    "at 100 for 120 broker_down\n"
+    "at 150 for 45 wifi_drop\n"
+    "at 160 for 200 timeout 1\n"
+    "at 400 for 20 exception *\n"
+    "expect recovery_ms <= 15000\n"
+    "expect lost <= 50\n"
+    "expect max_gap_ms <= 150000\n",
+};
+#define BUILTIN_COUNT ((int)(sizeof(BUILTIN_SCENARIOS) / sizeof(BUILTIN_SCENARIOS[0])))
+
+/* Simulation state */
+
+typedef enum { WIFI_LINKED, WIFI_CONNECTING, WIFI_BACKOFF } wifi_state_t;
+typedef enum { MQTT_IDLE, MQTT_UP, MQTT_CONNECTING, MQTT_WAIT } mqtt_state_t;
+
+typedef struct {
+    const scenario_t* scn;
+    const meter_profile_t* profile;
+    meter_block_t blocks[METER_MAX_BLOCKS];
+    uint16_t block_count;
+    bool verbose;
+    uint32_t rng;
+
+    int64_t now_ms;                 // Virtual clock, starts at 1 s (0 means "unset" to poll_cycle)
+
+    wifi_state_t wifi;
+    int64_t ap_lost_ms;             // Access point unreachable since, 0 while reachable
+    int64_t wifi_next_ms;           // End of the attempt or of the backoff
+    bool attempt_saw_ap_down;
+    int retry_num;                  // s_retry_num of the firmware
+
+    mqtt_state_t mqtt;
+    int64_t mqtt_next_ms;
+
+    metrics_t m;
+} sim_t;
+
+static void sim_log(const sim_t* s, const char* fmt, ...)
+{
+    if (!s->verbose) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    printf("  %8.3f  ", (s->now_ms - 1000) / 1000.0);
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+}
+
+static uint32_t xorshift32(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * @brief Active fault of a kind at the current time (block -2 matches any)
+ */
+static const fault_t* fault_active(const sim_t* s, fault_kind_t kind, int block)
+{
+    const int64_t t = s->now_ms - 1000;
+    for (int i = 0; i < s->scn->fault_count; i++) {
+        const fault_t* f = &s->scn->faults[i];
+        if (f->kind == kind && t >= f->start_ms && t < f->end_ms &&
+            (block == -2 || f->block < 0 || f->block == block)) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static bool sim_network_up(const sim_t* s)
+{
+    return s->wifi == WIFI_LINKED;
+}
+
+static void mqtt_start_connect(sim_t* s)
+{
+    s->mqtt = MQTT_CONNECTING;
+    s->mqtt_next_ms = s->now_ms + s->scn->param[P_MQTT_CONNECT_MS];
+    s->m.mqtt_attempts++;
+}
+
+static void wifi_start_connect(sim_t* s)
+{
+    s->wifi = WIFI_CONNECTING;
+    s->attempt_saw_ap_down = false;
+    s->wifi_next_ms = s->now_ms;
+    s->m.wifi_attempts++;
+}
+
+/**
+ * @brief Advance the network by one millisecond
+ *
+ * WiFi follows wifi_event_handler(): the disconnect is reported once the
+ * beacon timeout expires, s_retry_num counts the attempts, the first one is
+ * made at once and later ones after wifi_backoff_delay_ms(s_retry_num - 1).
+ * MQTT follows network_link_changed() and esp-mqtt.
+ */
+static void net_tick(sim_t* s)
+{
+    const uint32_t* p = s->scn->param;
+    const bool ap_up = fault_active(s, FAULT_WIFI_DROP, -2) == NULL;
+    const bool broker_up = fault_active(s, FAULT_BROKER_DOWN, -2) == NULL;
+
+    switch (s->wifi) {
+    case WIFI_LINKED:
+        if (ap_up) {
+            s->ap_lost_ms = 0;
+        } else if (s->ap_lost_ms == 0) {
+            s->ap_lost_ms = s->now_ms;
+        } else if (s->now_ms - s->ap_lost_ms >= p[P_BEACON_TIMEOUT_MS]) {
+            sim_log(s, "wifi: connection lost, reconnecting");
+            s->mqtt = MQTT_IDLE;        // network_link_changed(): no path, MQTT is down
+            s->retry_num = 1;
+            wifi_start_connect(s);
+        }
+        break;
+    case WIFI_CONNECTING:
+        if (!ap_up) {
+            s->attempt_saw_ap_down = true;
+        }
+        if (!s->attempt_saw_ap_down && s->now_ms - (s->wifi_next_ms) >= p[P_WIFI_CONNECT_MS]) {
+            sim_log(s, "wifi: connected after %d attempts", s->retry_num);
+            s->wifi = WIFI_LINKED;
+            s->ap_lost_ms = 0;
+            s->retry_num = 0;
+            mqtt_start_connect(s);      // network_link_changed() calls esp_mqtt_client_reconnect()
+        } else if (s->attempt_saw_ap_down && s->now_ms - s->wifi_next_ms >= p[P_WIFI_FAIL_MS]) {
+            s->retry_num++;
+            const uint32_t delay_ms = poll_reconnect_delay_ms(s->retry_num - 1, p[P_BACKOFF_MIN_MS],
+                                                              p[P_BACKOFF_MAX_MS], xorshift32(&s->rng));
+            sim_log(s, "wifi: attempt failed, retry %d in %" PRIu32 " ms", s->retry_num, delay_ms);
+            s->wifi = WIFI_BACKOFF;
+            s->wifi_next_ms = s->now_ms + delay_ms;
+        }
+        break;
+    case WIFI_BACKOFF:
+        if (s->now_ms >= s->wifi_next_ms) {
+            wifi_start_connect(s);
+        }
+        break;
+    }
+
+    switch (s->mqtt) {
+    case MQTT_IDLE:
+        break;
+    case MQTT_UP:
+        if (!broker_up) {
+            sim_log(s, "mqtt: disconnected");
+            s->mqtt = MQTT_WAIT;
+            s->mqtt_next_ms = s->now_ms + p[P_MQTT_RECONNECT_MS];
+        }
+        break;
+    case MQTT_CONNECTING:
+        if (s->now_ms >= s->mqtt_next_ms) {
+            if (broker_up) {
+                sim_log(s, "mqtt: connected");
+                s->mqtt = MQTT_UP;
+            } else {
+                s->mqtt = MQTT_WAIT;
+                s->mqtt_next_ms = s->now_ms + p[P_MQTT_RECONNECT_MS];
+            }
+        }
+        break;
+    case MQTT_WAIT:
+        if (s->now_ms >= s->mqtt_next_ms) {
+            mqtt_start_connect(s);
+        }
+        break;
+    }
+}
+
+static void sim_advance(sim_t* s, int64_t ms)
+{
+    for (int64_t i = 0; i < ms; i++) {
+        s->now_ms++;
+        net_tick(s);
+    }
+}
+
+/* poll_io_t of the simulated meter */
+
+static int32_t sim_read(void* ctx, uint16_t block, uint8_t attempt, uint16_t* regs)
+{
+    sim_t* s = ctx;
+    const uint32_t* p = s->scn->param;
+    const fault_t* f = NULL;
+    int32_t err = 0;
+
+    if (s->wifi != WIFI_LINKED || fault_active(s, FAULT_WIFI_DROP, -2) != NULL) {
+        // Link down but not reported yet: the request goes nowhere
+        sim_advance(s, p[P_TIMEOUT_MS]);
+        err = ERR_TIMEOUT;
+    } else if ((f = fault_active(s, FAULT_TIMEOUT, block)) != NULL) {
+        sim_advance(s, p[P_TIMEOUT_MS]);
+        err = ERR_TIMEOUT;
+    } else if ((f = fault_active(s, FAULT_TRUNCATED, block)) != NULL) {
+        sim_advance(s, p[P_TIMEOUT_MS]);
+        err = ERR_INVALID_RESPONSE;
+    } else if ((f = fault_active(s, FAULT_EXCEPTION, block)) != NULL) {
+        sim_advance(s, p[P_LATENCY_MS]);
+        err = ERR_INVALID_RESPONSE;
+    } else {
+        sim_advance(s, p[P_LATENCY_MS]);
+        // Every register reads 230.0 (0x43660000, high word first); gap registers too
+        for (uint16_t i = 0; i + 1 < s->blocks[block].reg_size; i += 2) {
+            regs[i] = 0x4366;
+            regs[i + 1] = 0x0000;
+        }
+    }
+    if (err != 0 && attempt == 0) {
+        sim_log(s, "modbus: block %u failed: 0x%" PRIx32, block, (uint32_t)err);
+    }
+    return err;
+}
+
+static void sim_delay_ms(void* ctx, uint32_t ms)
+{
+    sim_advance(ctx, ms);
+}
+
+static int64_t sim_now_us(void* ctx)
+{
+    return ((sim_t*)ctx)->now_ms * 1000;
+}
+
+static void sim_check_link(void* ctx)
+{
+    sim_t* s = ctx;
+    s->m.link_checks++;
+    sim_log(s, "modbus: multiple timeouts, connectivity check (network %s)",
+            sim_network_up(s) ? "up" : "down");
+}
+
+/**
+ * @brief Run a scenario: sdm120_acquisition_task() on the virtual clock
+ */
+static void sim_run(const scenario_t* scn, const meter_profile_t* profile, bool verbose, metrics_t* out)
+{
+    static sim_t s;
+    memset(&s, 0, sizeof(s));
+    s.scn = scn;
+    s.profile = profile;
+    s.verbose = verbose;
+    s.rng = scn->param[P_SEED] != 0 ? scn->param[P_SEED] : 1;
+    s.block_count = (uint16_t)meter_plan_blocks(profile, CONFIG_SDM_BLOCK_MAX_REGS, CONFIG_SDM_BLOCK_MAX_GAP,
+                                                s.blocks, METER_MAX_BLOCKS);
+    s.now_ms = 1000;
+    s.wifi = WIFI_LINKED;               // Steady state: booted, linked and connected
+    s.mqtt = MQTT_UP;
+
+    const poll_io_t io = {
+        .ctx = &s,
+        .read = sim_read,
+        .delay_ms = sim_delay_ms,
+        .now_us = sim_now_us,
+        .check_link = sim_check_link,
+        .timeout_error = ERR_TIMEOUT,
+    };
+    const uint32_t interval_ms = scn->param[P_INTERVAL_MS];
+    const int64_t end_ms = 1000 + scn->duration_ms;
+    int64_t last_delivery_ms = 1000;
+    int64_t fault_recovered[MAX_FAULTS];
+    int64_t fault_clear_ms[MAX_FAULTS];     // End of the fault and everything overlapping it
+    for (int i = 0; i < scn->fault_count; i++) {
+        fault_recovered[i] = -1;
+        fault_clear_ms[i] = scn->faults[i].end_ms;
+        for (bool extended = true; extended;) {
+            extended = false;
+            for (int j = 0; j < scn->fault_count; j++) {
+                const fault_t* f = &scn->faults[j];
+                if (f->start_ms < fault_clear_ms[i] && f->end_ms > fault_clear_ms[i]) {
+                    fault_clear_ms[i] = f->end_ms;
+                    extended = true;
+                }
+            }
+        }
+    }
+
+    while (s.now_ms < end_ms) {
+        if (!sim_network_up(&s)) {
+            sim_log(&s, "acquisition: network down, pausing");
+            while (!sim_network_up(&s) && s.now_ms < end_ms) {
+                sim_advance(&s, 1);
+            }
+            if (s.now_ms >= end_ms) {
+                break;
+            }
+            sim_log(&s, "acquisition: network back, resuming");
+        }
+
+        const int64_t cycle_start_ms = s.now_ms;
+        float values[METER_MAX_REGISTERS];
+        uint64_t valid = 0;
+        poll_result_t result;
+        const bool read_any = poll_cycle_read(&io, profile, s.blocks, s.block_count, scn->param[P_INTER_BLOCK_MS],
+                                              values, &valid, &result);
+        s.m.retries += result.retries;
+
+        if (read_any) {
+            const bool complete = result.registers_ok == profile->reg_count;
+            if (s.mqtt == MQTT_UP) {
+                s.m.delivered++;
+                if (!complete) {
+                    s.m.partial++;
+                }
+                if (s.now_ms - last_delivery_ms > s.m.max_gap_ms) {
+                    s.m.max_gap_ms = s.now_ms - last_delivery_ms;
+                }
+                last_delivery_ms = s.now_ms;
+                for (int i = 0; complete && i < scn->fault_count; i++) {
+                    if (fault_recovered[i] < 0 && s.now_ms - 1000 >= fault_clear_ms[i]) {
+                        fault_recovered[i] = s.now_ms - 1000 - fault_clear_ms[i];
+                    }
+                }
+                sim_log(&s, "publish: reading %s (%u/%d registers)", complete ? "complete" : "partial",
+                        result.registers_ok, profile->reg_count);
+            } else {
+                sim_log(&s, "publish: MQTT down, reading dropped");
+            }
+        } else {
+            sim_log(&s, "acquisition: all blocks failed, recovery delay");
+            sim_advance(&s, POLL_ALL_FAILED_DELAY_MS);
+        }
+
+        // vTaskDelayUntil(): returns at once when the next cycle is already due
+        const int64_t next_ms = cycle_start_ms + interval_ms;
+        if (s.now_ms > next_ms) {
+            s.m.overruns++;
+            sim_log(&s, "acquisition: cycle overran by %" PRId64 " ms", s.now_ms - next_ms);
+        } else {
+            sim_advance(&s, next_ms - s.now_ms);
+        }
+    }
+
+    if (end_ms - last_delivery_ms > s.m.max_gap_ms) {
+        s.m.max_gap_ms = end_ms - last_delivery_ms;
+    }
+    for (int i = 0; i < scn->fault_count; i++) {
+        const int64_t recovery_ms = fault_recovered[i] >= 0 ? fault_recovered[i] : scn->duration_ms;
+        if (recovery_ms > s.m.recovery_ms) {
+            s.m.recovery_ms = recovery_ms;
+        }
+    }
+    s.m.expected = scn->duration_ms / interval_ms;
+    s.m.lost = s.m.expected > s.m.delivered ? s.m.expected - s.m.delivered : 0;
+    *out = s.m;
+}
+
+/* Scenario parsing */
+
+static void scenario_defaults(scenario_t* scn)
+{
+    memset(scn, 0, sizeof(*scn));
+    snprintf(scn->name, sizeof(scn->name), "unnamed");
+    scn->duration_ms = 600000;
+    for (int i = 0; i < PARAM_COUNT; i++) {
+        scn->param[i] = PARAM_DEFAULTS[i].value;
+    }
+}
+
+static int metric_index(const char* name)
+{
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        if (strcmp(METRICS[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool parse_line(scenario_t* scn, char* line, const char* where)
+{
+    char* comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+    char* argv[8];
+    int argc = 0;
+    for (char* tok = strtok(line, " \t\r\n"); tok != NULL && argc < 8; tok = strtok(NULL, " \t\r\n")) {
+        argv[argc++] = tok;
+    }
+    if (argc == 0) {
+        return true;
+    }
+
+    if (strcmp(argv[0], "name") == 0 && argc == 2) {
+        snprintf(scn->name, sizeof(scn->name), "%s", argv[1]);
+        return true;
+    }
+    if (strcmp(argv[0], "duration") == 0 && argc == 2) {
+        scn->duration_ms = (int64_t)(atof(argv[1]) * 1000);
+        return scn->duration_ms > 0;
+    }
+    if (strcmp(argv[0], "set") == 0 && argc == 3) {
+        for (int i = 0; i < PARAM_COUNT; i++) {
+            if (strcmp(PARAM_DEFAULTS[i].name, argv[1]) == 0) {
+                scn->param[i] = (uint32_t)strtoul(argv[2], NULL, 0);
+                return scn->param[P_INTERVAL_MS] > 0;
+            }
+        }
+        fprintf(stderr, "%s: unknown parameter '%s'\n", where, argv[1]);
+        return false;
+    }
+    if (strcmp(argv[0], "at") == 0 && (argc == 5 || argc == 6) && strcmp(argv[2], "for") == 0) {
+        if (scn->fault_count >= MAX_FAULTS) {
+            fprintf(stderr, "%s: more than %d faults\n", where, MAX_FAULTS);
+            return false;
+        }
+        fault_t* f = &scn->faults[scn->fault_count];
+        f->start_ms = (int64_t)(atof(argv[1]) * 1000);
+        f->end_ms = f->start_ms + (int64_t)(atof(argv[3]) * 1000);
+        f->block = (argc == 6 && strcmp(argv[5], "*") != 0) ? atoi(argv[5]) : -1;
+        for (int k = 0; k < FAULT_KIND_COUNT; k++) {
+            if (strcmp(FAULT_NAMES[k], argv[4]) == 0) {
+                f->kind = (fault_kind_t)k;
+                scn->fault_count++;
+                return f->end_ms > f->start_ms;
+            }
+        }
+        fprintf(stderr, "%s: unknown fault '%s'\n", where, argv[4]);
+        return false;
+    }
+    if (strcmp(argv[0], "expect") == 0 && argc == 4 && scn->expect_count < MAX_EXPECTS) {
+        expect_t* e = &scn->expects[scn->expect_count];
+        if (metric_index(argv[1]) < 0) {
+            fprintf(stderr, "%s: unknown metric '%s'\n", where, argv[1]);
+            return false;
+        }
+        if (strcmp(argv[2], "<=") != 0 && strcmp(argv[2], ">=") != 0) {
+            fprintf(stderr, "%s: comparison must be <= or >=\n", where);
+            return false;
+        }
+        snprintf(e->metric, sizeof(e->metric), "%s", argv[1]);
+        e->cmp = argv[2][0] == '<' ? CMP_LE : CMP_GE;
+        e->bound = strtoll(argv[3], NULL, 10);
+        scn->expect_count++;
+        return true;
+    }
+    fprintf(stderr, "%s: cannot parse directive '%s'\n", where, argv[0]);
+    return false;
+}
+
+static bool parse_text(scenario_t* scn, const char* text, const char* source)
+{
+    scenario_defaults(scn);
+    int line_no = 0;
+    while (*text != '\0') {
+        const char* nl = strchr(text, '\n');
+        const size_t len = nl != NULL ? (size_t)(nl - text) : strlen(text);
+        char line[MAX_LINE];
+        char where[MAX_LINE];
+        snprintf(line, sizeof(line), "%.*s", (int)len, text);
+        snprintf(where, sizeof(where), "%s:%d", source, ++line_no);
+        if (!parse_line(scn, line, where)) {
+            return false;
+        }
+        text += len + (nl != NULL);
+    }
+    return true;
+}
+
+static char* read_file(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (text == NULL || fread(text, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "%s: read failed\n", path);
+        free(text);
+        fclose(f);
+        return NULL;
+    }
+    text[size] = '\0';
+    fclose(f);
+    return text;
+}
+
+/**
+ * @brief Run one scenario, print its metrics and check its bounds
+ *
+ * @return Number of violated bounds
+ */
+static int run_scenario(const scenario_t* scn, const meter_profile_t* profile, bool verbose)
+{
+    metrics_t m;
+    if (verbose) {
+        printf("%s:\n", scn->name);
+    }
+    sim_run(scn, profile, verbose, &m);
+
+    int failed = 0;
+    char detail[1024] = "";
+    size_t len = 0;
+    for (int i = 0; i < scn->expect_count; i++) {
+        const expect_t* e = &scn->expects[i];
+        const int64_t value = *(const int64_t*)((const char*)&m + METRICS[metric_index(e->metric)].offset);
+        const bool ok = e->cmp == CMP_LE ? value <= e->bound : value >= e->bound;
+        if (!ok && len < sizeof(detail)) {
+            len += snprintf(detail + len, sizeof(detail) - len, "\n    violated: %s %s %" PRId64 " (got %" PRId64 ")",
+                            e->metric, e->cmp == CMP_LE ? "<=" : ">=", e->bound, value);
+            failed++;
+        }
+    }
+
+    printf("%-20s %s  delivered %" PRId64 "/%" PRId64 " partial %" PRId64 " overruns %" PRId64
+           " recovery %.1f s max_gap %.1f s link_checks %" PRId64 " retries %" PRId64
+           " wifi_attempts %" PRId64 " mqtt_attempts %" PRId64 "%s\n",
+           scn->name, failed ? "FAIL" : "ok  ", m.delivered, m.expected, m.partial, m.overruns,
+           m.recovery_ms / 1000.0, m.max_gap_ms / 1000.0, m.link_checks, m.retries,
+           m.wifi_attempts, m.mqtt_attempts, detail);
+    return failed;
+}
+
+static int usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-v] [--model NAME] [--only TEXT] [scenario.scn ...]\n"
+                    "       %s --list\n", argv0, argv0);
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    const meter_profile_t* profile = meter_profile_default();
+    const char* only = NULL;
+    bool verbose = false;
+    int file_count = 0;
+    const char* files[64];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            profile = meter_profile_find(argv[++i]);
+            if (profile == NULL) {
+                fprintf(stderr, "unknown model '%s'\n", argv[i]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--only") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (int b = 0; b < BUILTIN_COUNT; b++) {
+                printf("%s%s", b ? "\n" : "", BUILTIN_SCENARIOS[b]);
+            }
+            printf("\n# Parameters (set NAME VALUE) and their defaults:\n");
+            for (int p = 0; p < PARAM_COUNT; p++) {
+                printf("#   %-18s %6" PRIu32 "  %s\n", PARAM_DEFAULTS[p].name, PARAM_DEFAULTS[p].value,
+                       PARAM_DEFAULTS[p].help);
+            }
+            return 0;
+        } else if (argv[i][0] == '-' || file_count >= 64) {
+            return usage(argv[0]);
+        } else {
+            files[file_count++] = argv[i];
+        }
+    }
+
+    static scenario_t scn;
+    int failed = 0;
+    int run = 0;
+    if (file_count == 0) {
+        for (int b = 0; b < BUILTIN_COUNT; b++) {
+            if (!parse_text(&scn, BUILTIN_SCENARIOS[b], "built-in")) {
+                return 2;
+            }
+            if (only == NULL || strstr(scn.name, only) != NULL) {
+                failed += run_scenario(&scn, profile, verbose) != 0;
+                run++;
+            }
+        }
+    }
+    for (int f = 0; f < file_count; f++) {
+        char* text = read_file(files[f]);
+        if (text == NULL || !parse_text(&scn, text, files[f])) {
+            free(text);
+            return 2;
+        }
+        free(text);
+        failed += run_scenario(&scn, profile, verbose) != 0;
+        run++;
+    }
+
+    printf("%d of %d scenarios passed\n", run - failed, run);
+    return failed ? 1 : 0;
+}
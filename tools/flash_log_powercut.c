@@ -0,0 +1,527 @@
+/**
+ * @file flash_log_powercut.c
+ * @brief Power cuts against the flash log ring on a simulated NOR flash
+ *
+ * Build from the repository root:
+ *
+ *   gcc -O2 -Wall -Imain -Itools/host -o flash_log_powercut tools/flash_log_powercut.c \
+ *       main/flash_log.c
+ *
+ * Usage:
+ *
+ *   ./flash_log_powercut                  # 2000 power cuts, exit status 1 on a violation
+ *   ./flash_log_powercut --cycles 100000  # longer run
+ *   ./flash_log_powercut --sectors 64     # larger ring (default 8, so it wraps often)
+ *   ./flash_log_powercut --seed 7 -v      # another sequence, logging every cycle
+ *
+ * main/flash_log.c runs unchanged over a RAM partition that behaves like NOR
+ * flash: erase sets a sector to 0xFF, programming can only clear bits. Each
+ * cycle mounts the log, checks it, then appends records until the power fails
+ * after a random number of flash operations. A cut in the middle of a program
+ * leaves a prefix of the bytes written and the next byte half programmed; a
+ * cut in the middle of an erase leaves every byte of the sector either erased
+ * or with some of its bits set. Every eighth cycle ends in a clean reboot
+ * instead.
+ *
+ * After every mount:
+ *
+ *   - every acknowledged record is read back with its times and payload,
+ *     unless its sector has since been erased for reuse;
+ *   - nothing else is read back, except the record a cut interrupted (torn
+ *     writes may or may not survive) or records of a sector whose erase was cut;
+ *   - records come back in append order;
+ *   - flash_log_extent() spans exactly the records read back;
+ *   - flash_log_seek() and flash_log_next() return exactly the records
+ *     overlapping random time ranges;
+ *   - after a clean reboot appending continues at the same place;
+ *   - the log never programs a bit that is not erased (that would corrupt
+ *     data on real flash instead of being caught by a CRC).
+ */
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "flash_log.h"
+
+#define RANGE_CHECKS        4           // Random range queries per mount
+#define CUT_WINDOW          64          // A cut comes within this many flash operations
+#define CLEAN_REBOOT_EVERY  8
+#define BUDGET_PER_HOUR     (1u << 20)  // Never the limit: appends are an hour apart
+#define MAX_FAILURES_SHOWN  10
+
+typedef enum {
+    REC_ACKED = 0,                      // flash_log_append() returned ESP_OK: must be read back
+    REC_TORN,                           // Append cut short: may be read back
+    REC_ERASED,                         // Its sector was erased, or its erase was cut: may be read back
+} record_state_t;
+
+typedef struct {
+    int64_t first_ms;
+    int64_t last_ms;
+    uint32_t sector;
+    uint16_t len;
+    uint8_t state;
+} oracle_record_t;
+
+// Simulated flash
+static uint8_t* s_flash;
+static esp_partition_t s_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = ESP_PARTITION_SUBTYPE_ANY,
+    .erase_size = FLASH_LOG_SECTOR_SIZE,
+    .label = "sdmlog",
+};
+static bool s_powered = true;
+static int s_ops_until_cut = 0;         // Flash operations before the cut, 0 for none
+static bool s_cut_in_erase = false;
+static uint32_t* s_erase_count;
+static uint64_t s_overprogrammed = 0;   // Bytes programmed over bits that were not erased
+
+// Records appended so far, indexed by record number
+static oracle_record_t* s_records;
+static size_t s_record_count = 0;
+static size_t s_record_capacity = 0;
+
+static uint32_t s_rng = 1;
+static bool s_verbose = false;
+static int s_cycle = 0;
+static int s_failures = 0;
+
+static uint32_t rnd(void)
+{
+    // xorshift32
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static void fail(const char* fmt, ...)
+{
+    if (s_failures++ < MAX_FAILURES_SHOWN) {
+        va_list args;
+        va_start(args, fmt);
+        fprintf(stderr, "cycle %d: ", s_cycle);
+        vfprintf(stderr, fmt, args);
+        fputc('\n', stderr);
+        va_end(args);
+    }
+}
+
+/* ===== ESP-IDF stand-ins ===== */
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label)
+{
+    (void)subtype;
+    return type == s_partition.type && strcmp(label, s_partition.label) == 0 ? &s_partition : NULL;
+}
+
+/**
+ * @brief Count down to the power cut
+ *
+ * @return true if this operation is the one cut short
+ */
+static bool cut_now(void)
+{
+    return s_ops_until_cut > 0 && --s_ops_until_cut == 0;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if (!s_powered || src_offset + size > partition->size) {
+        return ESP_FAIL;
+    }
+    memcpy(dst, s_flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if (!s_powered || dst_offset + size > partition->size) {
+        return ESP_FAIL;
+    }
+    const uint8_t* bytes = src;
+    uint8_t* flash = s_flash + dst_offset;
+    for (size_t i = 0; i < size; i++) {
+        if ((flash[i] & bytes[i]) != bytes[i]) {
+            s_overprogrammed++;
+        }
+    }
+    if (cut_now()) {
+        const size_t done = rnd() % size;
+        for (size_t i = 0; i < done; i++) {
+            flash[i] &= bytes[i];
+        }
+        flash[done] &= bytes[done] | (uint8_t)rnd();    // Some of its bits made it
+        s_powered = false;
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        flash[i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if (!s_powered || offset + size > partition->size ||
+        offset % FLASH_LOG_SECTOR_SIZE != 0 || size % FLASH_LOG_SECTOR_SIZE != 0) {
+        return ESP_FAIL;
+    }
+    for (size_t sector = offset / FLASH_LOG_SECTOR_SIZE; sector < (offset + size) / FLASH_LOG_SECTOR_SIZE; sector++) {
+        s_erase_count[sector]++;
+    }
+    if (cut_now()) {
+        for (size_t i = offset; i < offset + size; i++) {
+            s_flash[i] = rnd() & 1 ? 0xFF : s_flash[i] | (uint8_t)rnd();
+        }
+        s_powered = false;
+        s_cut_in_erase = true;
+        return ESP_FAIL;
+    }
+    memset(s_flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+/* ===== Records ===== */
+
+/**
+ * @brief Deterministic payload of a record number
+ */
+static void record_payload(size_t n, uint16_t len, uint8_t* out)
+{
+    uint32_t x = (uint32_t)n * 2654435761u + 1;
+    for (uint16_t i = 0; i < len; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        out[i] = (uint8_t)x;
+    }
+}
+
+/**
+ * @brief Record number of a record read back, checking its times and payload
+ *
+ * @return Record number, or -1 if it matches none
+ */
+static long record_identify(const flash_log_record_t* record, const uint8_t* payload)
+{
+    if (record->first_ms < 0 || record->first_ms % 1000 != 0) {
+        return -1;
+    }
+    const size_t n = (size_t)(record->first_ms / 1000);
+    if (n >= s_record_count || s_records[n].first_ms != record->first_ms ||
+        s_records[n].last_ms != record->last_ms || s_records[n].len != record->len) {
+        return -1;
+    }
+    uint8_t expected[FLASH_LOG_MAX_PAYLOAD];
+    record_payload(n, record->len, expected);
+    return memcmp(expected, payload, record->len) == 0 ? (long)n : -1;
+}
+
+/**
+ * @brief Mark the records of a sector that was erased for reuse
+ */
+static void sector_forget(uint32_t sector)
+{
+    for (size_t n = 0; n < s_record_count; n++) {
+        if (s_records[n].sector == sector) {
+            s_records[n].state = REC_ERASED;
+        }
+    }
+}
+
+/**
+ * @brief Append the next record number; tracks which sector it went to
+ *
+ * @return Result of flash_log_append()
+ */
+static esp_err_t append_next(flash_log_t* log)
+{
+    if (s_record_count == s_record_capacity) {
+        s_record_capacity = s_record_capacity ? 2 * s_record_capacity : 1024;
+        s_records = realloc(s_records, s_record_capacity * sizeof(*s_records));
+        if (s_records == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+    }
+    const size_t n = s_record_count++;
+    // Mostly full-size records as the firmware writes them, some short ones
+    const uint16_t len = rnd() % 4 == 0 ? (uint16_t)(1 + rnd() % FLASH_LOG_MAX_PAYLOAD) : FLASH_LOG_MAX_PAYLOAD;
+    oracle_record_t* record = &s_records[n];
+    record->first_ms = (int64_t)n * 1000;
+    record->last_ms = record->first_ms + len;
+    record->len = len;
+
+    const bool opens = log->head_used + FLASH_LOG_RECORD_HEADER + len > FLASH_LOG_SECTOR_SIZE;
+    const uint32_t next = (log->head + 1) % log->sector_count;
+    if (opens) {
+        sector_forget(next);            // Erased, or its erase cut short
+    }
+    record->sector = opens ? next : log->head;
+    record->state = REC_TORN;
+
+    uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+    record_payload(n, len, payload);
+    const int64_t now_ms = (int64_t)n * 3600000;
+    esp_err_t err = flash_log_append(log, payload, len, record->first_ms, record->last_ms, now_ms);
+    if (err == ESP_OK) {
+        record->state = REC_ACKED;
+        if (log->head != record->sector) {
+            fail("record %zu went to sector %" PRIu32 ", expected %" PRIu32, n, log->head, record->sector);
+        }
+    }
+    return err;
+}
+
+/* ===== Checks ===== */
+
+typedef struct {
+    size_t n;
+    int64_t first_ms;
+    int64_t last_ms;
+} present_t;
+
+/**
+ * @brief Read a range through seek and next
+ *
+ * @return Records read, or -1 on a read error or an unknown record
+ */
+static long read_range(const flash_log_t* log, int64_t from_ms, int64_t to_ms, present_t* out, size_t max)
+{
+    flash_log_cursor_t cursor;
+    flash_log_record_t record;
+    uint8_t payload[FLASH_LOG_MAX_PAYLOAD];
+    size_t count = 0;
+    flash_log_seek(log, from_ms, to_ms, &cursor);
+    esp_err_t err;
+    while ((err = flash_log_next(log, &cursor, &record, payload)) == ESP_OK) {
+        const long n = record_identify(&record, payload);
+        if (n < 0) {
+            fail("unknown or corrupted record read back (first %" PRId64 ", %u bytes)", record.first_ms, record.len);
+            return -1;
+        }
+        if (count == max) {
+            fail("more records read back than appended");
+            return -1;
+        }
+        out[count++] = (present_t){ .n = (size_t)n, .first_ms = record.first_ms, .last_ms = record.last_ms };
+    }
+    if (err != ESP_ERR_NOT_FOUND) {
+        fail("flash_log_next() failed: 0x%x", err);
+        return -1;
+    }
+    return (long)count;
+}
+
+/**
+ * @brief Check a freshly mounted log against the records appended
+ *
+ * @return Records read back
+ */
+static size_t verify(const flash_log_t* log)
+{
+    present_t* all = malloc((s_record_count + 1) * sizeof(*all));
+    present_t* range = malloc((s_record_count + 1) * sizeof(*range));
+    if (all == NULL || range == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+
+    const long count = read_range(log, INT64_MIN, INT64_MAX, all, s_record_count);
+    if (count < 0) {
+        free(all);
+        free(range);
+        return 0;
+    }
+
+    // In order, and nothing acknowledged missing
+    size_t next_expected = 0;
+    for (long i = 0; i < count; i++) {
+        if (i > 0 && all[i].n <= all[i - 1].n) {
+            fail("record %zu read back after record %zu", all[i].n, all[i - 1].n);
+        }
+        for (; next_expected < all[i].n; next_expected++) {
+            if (s_records[next_expected].state == REC_ACKED) {
+                fail("acknowledged record %zu lost", next_expected);
+            }
+        }
+        next_expected = all[i].n + 1;
+    }
+    for (; next_expected < s_record_count; next_expected++) {
+        if (s_records[next_expected].state == REC_ACKED) {
+            fail("acknowledged record %zu lost", next_expected);
+        }
+    }
+
+    int64_t oldest_ms, newest_ms;
+    const bool extent = flash_log_extent(log, &oldest_ms, &newest_ms);
+    if (extent != (count > 0)) {
+        fail("flash_log_extent() says %s, %ld records read back", extent ? "not empty" : "empty", count);
+    } else if (extent && (oldest_ms != all[0].first_ms || newest_ms != all[count - 1].last_ms)) {
+        fail("extent %" PRId64 "..%" PRId64 ", records span %" PRId64 "..%" PRId64,
+             oldest_ms, newest_ms, all[0].first_ms, all[count - 1].last_ms);
+    }
+
+    // Range queries: exactly the records overlapping [from, to]
+    const int64_t span_ms = (int64_t)(s_record_count + 2) * 1000;
+    for (int q = 0; q < RANGE_CHECKS && count > 0; q++) {
+        int64_t from_ms = (int64_t)(rnd() % (uint32_t)span_ms) - 1000;
+        int64_t to_ms = from_ms + (int64_t)(rnd() % 20000);
+        const long got = read_range(log, from_ms, to_ms, range, s_record_count);
+        if (got < 0) {
+            break;
+        }
+        long expected = 0;
+        for (long i = 0; i < count; i++) {
+            if (all[i].last_ms < from_ms || all[i].first_ms > to_ms) {
+                continue;
+            }
+            if (expected >= got || range[expected].n != all[i].n) {
+                fail("range %" PRId64 "..%" PRId64 " misses record %zu", from_ms, to_ms, all[i].n);
+                expected = -1;
+                break;
+            }
+            expected++;
+        }
+        if (expected >= 0 && got != expected) {
+            fail("range %" PRId64 "..%" PRId64 " returned %ld records, expected %ld", from_ms, to_ms, got, expected);
+        }
+    }
+
+    free(all);
+    free(range);
+    return (size_t)count;
+}
+
+static void usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [--cycles N] [--sectors N] [--seed N] [-v]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    int cycles = 2000;
+    uint32_t sectors = 8;
+    uint32_t seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            cycles = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sectors") == 0 && i + 1 < argc) {
+            sectors = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            s_verbose = true;
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (cycles <= 0 || sectors < 2 || seed == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    s_rng = seed;
+
+    s_partition.size = sectors * FLASH_LOG_SECTOR_SIZE;
+    s_flash = malloc(s_partition.size);
+    s_erase_count = calloc(sectors, sizeof(*s_erase_count));
+    if (s_flash == NULL || s_erase_count == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    for (uint32_t i = 0; i < s_partition.size; i++) {
+        s_flash[i] = (uint8_t)rnd();    // Never-erased flash: whatever was there before
+    }
+
+    unsigned long cuts_in_write = 0, cuts_in_erase = 0, clean_reboots = 0, torn = 0;
+    unsigned long long read_back = 0;
+    flash_log_t log = { 0 };
+    bool clean = false;                 // The previous cycle ended in a clean reboot
+    for (s_cycle = 1; s_cycle <= cycles; s_cycle++) {
+        s_powered = true;
+        s_cut_in_erase = false;
+        const flash_log_t before = log;
+        free(log.first_ms);
+        esp_err_t err = flash_log_mount(&log, "sdmlog", BUDGET_PER_HOUR, 0);
+        if (err != ESP_OK) {
+            fail("mount failed: 0x%x", err);
+            break;
+        }
+        if (clean &&
+            (log.head != before.head || log.head_used != before.head_used || log.used != before.used)) {
+            fail("clean reboot moved the head from sector %" PRIu32 "+%" PRIu32 " to %" PRIu32 "+%" PRIu32,
+                 before.head, before.head_used, log.head, log.head_used);
+        }
+        const size_t present = verify(&log);
+        read_back += present;
+
+        // Append until the power fails, or stop cleanly now and then
+        clean = s_cycle % CLEAN_REBOOT_EVERY == 0;
+        const uint32_t clean_appends = 1 + rnd() % CUT_WINDOW;
+        s_ops_until_cut = clean ? 0 : (int)(1 + rnd() % CUT_WINDOW);
+        for (uint32_t appended = 0; s_powered && (!clean || appended < clean_appends); appended++) {
+            err = append_next(&log);
+            if (err != ESP_OK && s_powered) {
+                fail("append of record %zu failed with power on: 0x%x", s_record_count - 1, err);
+                s_powered = false;
+            }
+        }
+        if (clean) {
+            clean_reboots++;
+        } else if (s_cut_in_erase) {
+            cuts_in_erase++;
+        } else {
+            cuts_in_write++;
+            torn++;
+        }
+        if (s_verbose) {
+            printf("cycle %d: mounted %" PRIu32 " sectors (head %" PRIu32 " at %" PRIu32 "), %zu records read back, "
+                   "%s after record %zu\n", s_cycle, log.used, log.head, log.head_used, present,
+                   clean ? "clean reboot" : s_cut_in_erase ? "cut during erase" : "cut during write",
+                   s_record_count - 1);
+        }
+        if (s_failures > 0) {
+            break;
+        }
+    }
+    if (s_overprogrammed > 0) {
+        fail("%llu bytes programmed over bits that were not erased", (unsigned long long)s_overprogrammed);
+    }
+
+    uint32_t min_erases = UINT32_MAX, max_erases = 0;
+    for (uint32_t i = 0; i < sectors; i++) {
+        min_erases = s_erase_count[i] < min_erases ? s_erase_count[i] : min_erases;
+        max_erases = s_erase_count[i] > max_erases ? s_erase_count[i] : max_erases;
+    }
+    printf("%" PRIu32 " sectors, seed %" PRIu32 ": %lu cuts during a write, %lu during an erase, %lu clean reboots\n",
+           sectors, seed, cuts_in_write, cuts_in_erase, clean_reboots);
+    printf("%zu records appended, %lu torn, %llu read back and verified over all mounts\n",
+           s_record_count, torn, read_back);
+    printf("erases per sector: %" PRIu32 "..%" PRIu32 "\n", min_erases, max_erases);
+    if (s_failures > 0) {
+        printf("FAILED: %d violation(s)\n", s_failures);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,12 @@
+/**
+ * @file esp_rom_crc.h
+ * @brief ROM CRC32 for host builds; the host program defines it
+ *
+ * Same convention as the ROM: the CRC-32 of zlib, chained through crc
+ * (0 to start).
+ */
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len);
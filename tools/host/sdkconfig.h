@@ -0,0 +1,16 @@
+/**
+ * @file sdkconfig.h
+ * @brief Menuconfig stand-in for host builds of the pure firmware modules
+ *
+ * Only the options those modules read; the defaults match Kconfig.projbuild.
+ */
+#pragma once
+
+#define CONFIG_SDM_METER_MODEL "SDM120"
+#define CONFIG_SDM_BLOCK_MAX_REGS 80
+#define CONFIG_SDM_BLOCK_MAX_GAP 8
+#define CONFIG_SDM_BATCH_READINGS 12
+#define CONFIG_SDM120_MQTT5_TOPIC_ALIASES 24
+#define CONFIG_SDM120_MQTT5_TELEMETRY_EXPIRY_S 300
+#define CONFIG_SDM120_MQTT_QOS_TELEMETRY 0
+#define CONFIG_SDM120_MQTT_QOS_ENERGY 1
@@ -0,0 +1,502 @@
+/**
+ * @file modbus_replay.c
+ * @brief Replay a Modbus trace through the firmware's register decoder on Linux
+ *
+ * Build from the repository root:
+ *
+ *   gcc -O2 -Wall -Imain -Itools/host -o modbus_replay tools/modbus_replay.c \
+ *       main/modbus_trace.c main/meter_profiles.c
+ *
+ * Usage:
+ *
+ *   curl -o trace.pcapng http://<device>/api/trace.pcapng
+ *   ./modbus_replay trace.pcapng                  # readings as CSV, retry summary on stderr
+ *   ./modbus_replay trace.pcapng --bits           # values as raw IEEE754 bits
+ *   ./modbus_replay trace.pcapng --model SDM630   # profile other than SDM120
+ *   ./modbus_replay trace.pcapng --bench 10000    # time the decoder over the trace
+ *   ./modbus_replay --selftest [out.pcapng]       # dump and replay a synthetic trace
+ *
+ * Every response is decoded with meter_decode_block() from main/meter_profiles.c,
+ * the code the firmware runs, so the output matches what the device computed
+ * bit for bit. A row starts at each first attempt of CID 0, the first block of
+ * a poll cycle; registers whose block failed every attempt stay empty, as the
+ * firmware leaves them invalid. The summary lists every CID's attempts,
+ * errors, retries and latency as recorded on the device.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "meter_profiles.h"
+#include "modbus_trace.h"
+
+#define MAX_FILE_SIZE       (16 * 1024 * 1024)
+#define MAX_TRANSACTIONS    65536
+#define MAX_CIDS            (METER_MAX_BLOCKS + 1)
+#define PENDING_SLOTS       64
+
+typedef struct {
+    int64_t time_us;
+    uint32_t duration_us;
+    int32_t error;
+    uint16_t transaction;
+    uint16_t cid;
+    uint16_t reg_start;
+    uint16_t reg_count;
+    uint8_t attempt;
+    uint8_t response_regs;
+    bool answered;
+    uint16_t regs[MODBUS_TRACE_MAX_REGS];
+} transaction_t;
+
+static transaction_t* s_transactions;
+static size_t s_count = 0;
+
+static uint16_t get_u16_be(const uint8_t* p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint16_t get_u16_le(const uint8_t* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t get_u32_le(const uint8_t* p) { return (uint32_t)get_u16_le(p) | (uint32_t)get_u16_le(p + 2) << 16; }
+
+static const char* error_name(int32_t error)
+{
+    switch (error) {
+        case 0:      return "ESP_OK";
+        case -1:     return "ESP_FAIL";
+        case 0x101:  return "ESP_ERR_NO_MEM";
+        case 0x102:  return "ESP_ERR_INVALID_ARG";
+        case 0x103:  return "ESP_ERR_INVALID_STATE";
+        case 0x106:  return "ESP_ERR_NOT_SUPPORTED";
+        case 0x107:  return "ESP_ERR_TIMEOUT";
+        case 0x108:  return "ESP_ERR_INVALID_RESPONSE";
+        case 0x109:  return "ESP_ERR_INVALID_CRC";
+        default:     return "?";
+    }
+}
+
+/**
+ * @brief Handle one IPv4/TCP packet carrying a Modbus ADU
+ */
+static void take_packet(const uint8_t* ip, size_t len, int64_t time_us, const char* comment, size_t* pending)
+{
+    if (len < 20 || (ip[0] >> 4) != 4 || ip[9] != 6) {
+        return;
+    }
+    const size_t ip_header = (size_t)(ip[0] & 0x0F) * 4;
+    if (len < ip_header + 20) {
+        return;
+    }
+    const uint8_t* tcp = ip + ip_header;
+    const size_t tcp_header = (size_t)(tcp[12] >> 4) * 4;
+    if (len < ip_header + tcp_header + 8) {
+        return;
+    }
+    const uint8_t* adu = tcp + tcp_header;
+    const size_t adu_len = len - ip_header - tcp_header;
+    const uint16_t transaction = get_u16_be(adu);
+
+    if (get_u16_be(tcp + 2) == MODBUS_TRACE_PORT && adu_len >= 12 && s_count < MAX_TRANSACTIONS) {
+        transaction_t* t = &s_transactions[s_count];
+        memset(t, 0, sizeof(*t));
+        unsigned cid = 0, attempt = 0;
+        unsigned long error = 0, us = 0;
+        if (comment == NULL ||
+            sscanf(comment, "cid=%u attempt=%u err=0x%lx us=%lu", &cid, &attempt, &error, &us) != 4) {
+            fprintf(stderr, "request %u without a trace comment, skipped\n", transaction);
+            return;
+        }
+        t->time_us = time_us;
+        t->duration_us = (uint32_t)us;
+        t->error = (int32_t)(uint32_t)error;
+        t->transaction = transaction;
+        t->cid = (uint16_t)cid;
+        t->attempt = (uint8_t)attempt;
+        t->reg_start = get_u16_be(adu + 8);
+        t->reg_count = get_u16_be(adu + 10);
+        pending[transaction % PENDING_SLOTS] = s_count++;
+    } else if (get_u16_be(tcp) == MODBUS_TRACE_PORT && adu_len >= 9) {
+        const size_t index = pending[transaction % PENDING_SLOTS];
+        if (index >= s_count || s_transactions[index].transaction != transaction) {
+            fprintf(stderr, "response %u without its request, skipped\n", transaction);
+            return;
+        }
+        transaction_t* t = &s_transactions[index];
+        const size_t regs = (adu_len - 9) / 2 < adu[8] / 2 ? (adu_len - 9) / 2 : adu[8] / 2;
+        t->response_regs = (uint8_t)(regs < MODBUS_TRACE_MAX_REGS ? regs : MODBUS_TRACE_MAX_REGS);
+        for (int i = 0; i < t->response_regs; i++) {
+            t->regs[i] = get_u16_be(adu + 9 + 2 * i);
+        }
+        t->answered = true;
+    }
+}
+
+/**
+ * @brief Collect the transactions of a pcapng file (little-endian sections, one raw IPv4 interface)
+ */
+static bool load_pcapng(const uint8_t* buf, size_t len)
+{
+    size_t pending[PENDING_SLOTS];
+    for (int i = 0; i < PENDING_SLOTS; i++) {
+        pending[i] = SIZE_MAX;
+    }
+    if (len < 12 || get_u32_le(buf) != 0x0A0D0D0A || get_u32_le(buf + 8) != 0x1A2B3C4D) {
+        fprintf(stderr, "not a little-endian pcapng file\n");
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos + 12 <= len) {
+        const uint32_t type = get_u32_le(buf + pos);
+        const uint32_t block_len = get_u32_le(buf + pos + 4);
+        if (block_len < 12 || block_len % 4 != 0 || pos + block_len > len) {
+            fprintf(stderr, "truncated block at offset %zu\n", pos);
+            return s_count > 0;
+        }
+        if (type == 0x00000006 && block_len >= 32) {
+            const uint8_t* b = buf + pos;
+            const int64_t time_us = (int64_t)((uint64_t)get_u32_le(b + 12) << 32 | get_u32_le(b + 16));
+            const uint32_t captured = get_u32_le(b + 20);
+            const size_t options = 28 + ((captured + 3) & ~3u);
+            if (options > block_len - 4) {
+                return false;
+            }
+
+            char comment[128];
+            const char* found = NULL;
+            for (size_t o = options; o + 4 <= block_len - 4;) {
+                const uint16_t code = get_u16_le(b + o);
+                const uint16_t opt_len = get_u16_le(b + o + 2);
+                if (code == 0 || o + 4 + opt_len > block_len - 4) {
+                    break;
+                }
+                if (code == 1) {
+                    snprintf(comment, sizeof(comment), "%.*s", (int)opt_len, (const char*)(b + o + 4));
+                    found = comment;
+                }
+                o += 4 + ((opt_len + 3u) & ~3u);
+            }
+            take_packet(b + 28, captured, time_us, found, pending);
+        }
+        pos += block_len;
+    }
+    return true;
+}
+
+/**
+ * @brief The profile registers a read covers, as a block for meter_decode_block()
+ *
+ * @return false if the read covers none of them
+ */
+static bool block_for(const meter_profile_t* profile, const transaction_t* t, meter_block_t* block)
+{
+    block->reg_start = t->reg_start;
+    block->reg_size = t->response_regs & ~1;
+    block->count = 0;
+    for (int i = 0; i < profile->reg_count; i++) {
+        const uint16_t reg = profile->regs[i].reg;
+        if (reg >= block->reg_start && reg + 2 <= block->reg_start + block->reg_size) {
+            if (block->count == 0) {
+                block->first = (uint8_t)i;
+            }
+            block->count++;
+        }
+    }
+    return block->count > 0;
+}
+
+static void print_row(const meter_profile_t* profile, int64_t time_us, const float* values, uint64_t valid, bool bits)
+{
+    printf("%" PRId64, time_us);
+    for (int i = 0; i < profile->reg_count; i++) {
+        if (!(valid & (1ULL << i))) {
+            printf(",");
+        } else if (bits) {
+            uint32_t word;
+            memcpy(&word, &values[i], sizeof(word));
+            printf(",0x%08" PRIX32, word);
+        } else {
+            printf(",%.*f", profile->regs[i].precision + 2, values[i]);
+        }
+    }
+    printf("\n");
+}
+
+static void replay(const meter_profile_t* profile, bool bits)
+{
+    printf("time_us");
+    for (int i = 0; i < profile->reg_count; i++) {
+        printf(",%s", profile->regs[i].topic);
+    }
+    printf("\n");
+
+    float values[METER_MAX_REGISTERS];
+    uint64_t valid = 0;
+    int64_t row_time = 0;
+    for (size_t n = 0; n < s_count; n++) {
+        const transaction_t* t = &s_transactions[n];
+        if (t->cid == 0 && t->attempt == 0) {
+            if (valid != 0) {
+                print_row(profile, row_time, values, valid, bits);
+            }
+            valid = 0;
+            row_time = t->time_us;
+        }
+        meter_block_t block;
+        if (t->answered && t->error == 0 && block_for(profile, t, &block)) {
+            if (valid == 0) {
+                row_time = t->time_us;      // Trace starts mid-cycle
+            }
+            meter_decode_block(profile, &block, t->regs, values, &valid);
+        }
+    }
+    if (valid != 0) {
+        print_row(profile, row_time, values, valid, bits);
+    }
+}
+
+static int compare_u32(const void* a, const void* b)
+{
+    const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Per-CID attempts, errors, retries and latency
+ */
+static void summary(void)
+{
+    static uint32_t latency[MAX_TRANSACTIONS];
+    fprintf(stderr, "%zu transactions\n", s_count);
+    fprintf(stderr, "cid  attempts  ok  retried_ok  gave_up  p50_ms  p99_ms  max_ms  errors\n");
+    for (int cid = 0; cid < MAX_CIDS; cid++) {
+        size_t attempts = 0, ok = 0, retried_ok = 0, gave_up = 0, samples = 0;
+        int32_t errors[8] = { 0 };
+        size_t error_counts[8] = { 0 };
+        for (size_t n = 0; n < s_count; n++) {
+            const transaction_t* t = &s_transactions[n];
+            if (t->cid != cid) {
+                continue;
+            }
+            attempts++;
+            if (t->error == 0) {
+                ok++;
+                retried_ok += t->attempt > 0;
+                latency[samples++] = t->duration_us;
+            } else {
+                for (int e = 0; e < 8; e++) {
+                    if (error_counts[e] == 0 || errors[e] == t->error) {
+                        errors[e] = t->error;
+                        error_counts[e]++;
+                        break;
+                    }
+                }
+                // Gave up: no later attempt of this CID in the same retry sequence
+                const bool last = n + 1 >= s_count || s_transactions[n + 1].cid != cid ||
+                                  s_transactions[n + 1].attempt <= t->attempt;
+                gave_up += last;
+            }
+        }
+        if (attempts == 0) {
+            continue;
+        }
+        qsort(latency, samples, sizeof(latency[0]), compare_u32);
+        const double p50 = samples ? latency[samples / 2] / 1000.0 : 0;
+        const double p99 = samples ? latency[(samples * 99) / 100 < samples ? (samples * 99) / 100 : samples - 1] / 1000.0 : 0;
+        const double max = samples ? latency[samples - 1] / 1000.0 : 0;
+        fprintf(stderr, "%3d  %8zu  %2zu  %10zu  %7zu  %6.1f  %6.1f  %6.1f  ", cid, attempts, ok, retried_ok,
+                gave_up, p50, p99, max);
+        for (int e = 0; e < 8 && error_counts[e] > 0; e++) {
+            fprintf(stderr, "%s%s x%zu", e > 0 ? ", " : "", error_name(errors[e]), error_counts[e]);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+/**
+ * @brief Time meter_decode_block() over every answered read of the trace
+ */
+static void bench(const meter_profile_t* profile, long rounds)
+{
+    float values[METER_MAX_REGISTERS];
+    uint64_t valid = 0;
+    size_t reads = 0, decoded = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (long r = 0; r < rounds; r++) {
+        for (size_t n = 0; n < s_count; n++) {
+            meter_block_t block;
+            if (s_transactions[n].answered && block_for(profile, &s_transactions[n], &block)) {
+                meter_decode_block(profile, &block, s_transactions[n].regs, values, &valid);
+                reads++;
+                decoded += block.count;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    const double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    volatile float sink = values[0];
+    (void)sink;
+    fprintf(stderr, "bench: %zu block decodes, %.1f ns/read, %.2f ns/value\n", reads,
+            reads ? ns / reads : 0, decoded ? ns / decoded : 0);
+}
+
+/**
+ * @brief Record a synthetic session in a small ring, dump it and replay the dump
+ *
+ * Covers ring wrap-around, a timeout followed by a successful retry and a
+ * CID that gives up; the decoded values must equal the encoded ones exactly.
+ * With a path the synthetic trace is also written there.
+ */
+static int selftest(const meter_profile_t* profile, const char* out)
+{
+    static uint8_t ring[4096];
+    modbus_trace_t trace;
+    modbus_trace_init(&trace, ring, sizeof(ring));
+
+    meter_block_t blocks[METER_MAX_BLOCKS];
+    const size_t block_count = meter_plan_blocks(profile, 80, 8, blocks, METER_MAX_BLOCKS);
+    float expected[METER_MAX_REGISTERS];
+    const int cycles = 40;
+    int64_t now_us = 1000000;
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        for (size_t b = 0; b < block_count; b++) {
+            uint16_t regs[METER_MODBUS_MAX_REGS];
+            for (int r = 0; r < blocks[b].reg_size; r += 2) {
+                float v = 230.0f + cycle + r * 0.25f;
+                uint32_t word;
+                memcpy(&word, &v, sizeof(word));
+                regs[r] = (uint16_t)(word >> 16);
+                regs[r + 1] = (uint16_t)word;
+            }
+            for (int i = blocks[b].first; i < blocks[b].first + blocks[b].count; i++) {
+                expected[i] = 230.0f + cycle + (profile->regs[i].reg - blocks[b].reg_start) * 0.25f;
+            }
+            if (b == 1 && cycle % 11 == 5) {
+                // Meter stops answering this block: every attempt times out
+                for (uint8_t attempt = 0; attempt < 3; attempt++) {
+                    modbus_trace_entry_t failed = {
+                        .start_us = now_us, .duration_us = 1000000, .error = 0x107, .cid = (uint16_t)b,
+                        .unit = 1, .function = 4, .reg_start = blocks[b].reg_start,
+                        .reg_count = blocks[b].reg_size, .attempt = attempt,
+                    };
+                    modbus_trace_add(&trace, &failed, NULL);
+                    now_us += 1500000;
+                }
+                continue;
+            }
+            const bool timeout_first = b == 0 && cycle % 7 == 3;
+            modbus_trace_entry_t entry = {
+                .start_us = now_us, .duration_us = 12000, .cid = (uint16_t)b, .unit = 1, .function = 4,
+                .reg_start = blocks[b].reg_start, .reg_count = blocks[b].reg_size,
+            };
+            if (timeout_first) {
+                entry.error = 0x107;
+                entry.duration_us = 1000000;
+                modbus_trace_add(&trace, &entry, NULL);
+                now_us += 1500000;
+                entry.attempt = 1;
+                entry.error = 0;
+                entry.duration_us = 12000;
+                entry.start_us = now_us;
+            }
+            entry.response_regs = (uint8_t)blocks[b].reg_size;
+            modbus_trace_add(&trace, &entry, regs);
+            now_us += 20000;
+        }
+        now_us += 5000000;
+    }
+
+    // Dump like the firmware, then replay the dump
+    static uint8_t file[256 * 1024];
+    size_t len = modbus_trace_pcapng_header(file);
+    modbus_trace_pcap_t pcap = { .client_ip = 0xC0A80164, .server_ip = 0xC0A80165 };
+    modbus_trace_entry_t entry;
+    uint16_t regs[MODBUS_TRACE_MAX_REGS];
+    uint32_t entries = 0;
+    for (uint32_t cursor = modbus_trace_oldest(&trace); modbus_trace_read(&trace, &cursor, &entry, regs);) {
+        len += modbus_trace_pcapng_entry(&pcap, &entry, regs, file + len);
+        entries++;
+    }
+    if (!load_pcapng(file, len) || s_count != entries || entries != trace.count) {
+        fprintf(stderr, "selftest: %u entries in the ring, %u dumped, %zu replayed\n",
+                trace.count, entries, s_count);
+        return 1;
+    }
+
+    // The last cycle must decode to exactly what was encoded
+    float values[METER_MAX_REGISTERS];
+    uint64_t valid = 0;
+    for (size_t n = 0; n < s_count; n++) {
+        meter_block_t block;
+        if (s_transactions[n].answered && block_for(profile, &s_transactions[n], &block)) {
+            meter_decode_block(profile, &block, s_transactions[n].regs, values, &valid);
+        }
+    }
+    int mismatches = 0;
+    for (int i = 0; i < profile->reg_count; i++) {
+        if (!(valid & (1ULL << i)) || memcmp(&values[i], &expected[i], sizeof(float)) != 0) {
+            mismatches++;
+        }
+    }
+    fprintf(stderr, "selftest: %u of %d transactions kept (%u dropped), %zu bytes of pcapng, %d mismatches\n",
+            trace.count, trace.next_transaction, trace.dropped, len, mismatches);
+    summary();
+    FILE* f = out != NULL ? fopen(out, "wb") : NULL;
+    if (f != NULL) {
+        fwrite(file, 1, len, f);
+        fclose(f);
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    const char* model = "SDM120";
+    bool bits = false;
+    bool self = false;
+    long rounds = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bits") == 0) {
+            bits = true;
+        } else if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) {
+            model = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            rounds = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--selftest") == 0) {
+            self = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    const meter_profile_t* profile = meter_profile_find(model);
+    s_transactions = calloc(MAX_TRANSACTIONS, sizeof(transaction_t));
+    if (profile == NULL || s_transactions == NULL || (path == NULL && !self)) {
+        fprintf(stderr, "usage: %s trace.pcapng [--model SDM120] [--bits] [--bench rounds]\n"
+                        "       %s --selftest [out.pcapng]\n", argv[0], argv[0]);
+        return 2;
+    }
+    if (self) {
+        return selftest(profile, path);
+    }
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    uint8_t* buf = malloc(MAX_FILE_SIZE);
+    const size_t len = buf != NULL ? fread(buf, 1, MAX_FILE_SIZE, f) : 0;
+    fclose(f);
+    if (!load_pcapng(buf, len)) {
+        return 1;
+    }
+    replay(profile, bits);
+    summary();
+    if (rounds > 0) {
+        bench(profile, rounds);
+    }
+    free(buf);
+    free(s_transactions);
+    return 0;
+}
@@ -0,0 +1,1614 @@
+/**
+ * @file sdm_bench.c
+ * @brief End-to-end benchmark of the poll and publish path on Linux
+ *
+ * Build from the repository root:
+ *
+ *   gcc -O2 -Wall -pthread -Imain -Itools/host -o sdm_bench tools/sdm_bench.c \
+ *       main/meter_profiles.c main/sample_codec.c main/reading_json.c main/data_quality.c -lm
+ *
+ * Usage:
+ *
+ *   ./sdm_bench                                   # full sweep, CSV on stdout
+ *   ./sdm_bench --quick                           # short sweep (about 15 s)
+ *   ./sdm_bench --format json > bench.json
+ *   ./sdm_bench --broker 127.0.0.1:1883           # through a real broker, e.g. mosquitto
+ *   ./sdm_bench --mqtt 5 --publish individual     # MQTT 5 topic aliases and expiry, as CONFIG_SDM120_MQTT_V5
+ *   ./sdm_bench --quick --compare baseline.csv    # exit status 2 on a regression
+ *   ./sdm_bench --meters 1,8 --interval-ms 100,0 --read block --publish json,binary --duration-s 5
+ *
+ * Every point of the sweep starts N simulated meters, Modbus/TCP servers on
+ * loopback answering from an SDM120 register image whose values drift like a
+ * real load, and N devices, each polling its own meter and publishing over its
+ * own MQTT connection like a fleet of boards. A device runs the firmware's
+ * code for everything but the transports: meter_plan_blocks() and
+ * meter_decode_block() and dq_filter_apply() for the reads, reading_json_format() for <prefix>/data
+ * and the sample_codec.c encoder for <prefix>/batch. The broker is an
+ * embedded single-threaded stand-in unless --broker is given, in which case a
+ * subscriber on <prefix>/# takes its place.
+ *
+ * With --mqtt 5 the devices connect with MQTT 5 and publish as mqtt5_publish()
+ * does: telemetry topics carry the message expiry, QoS 0 classes a topic alias
+ * up to the CONNACK topic alias maximum, sent alias-only once announced. The
+ * embedded broker grants 10 aliases, Mosquitto's default max_topic_alias. Every
+ * message still goes out at QoS 0, so the packet id the firmware adds to
+ * energy topics (QoS 1) is missing from both versions alike.
+ *
+ * Swept dimensions:
+ *
+ *   --meters       devices and simulated meters
+ *   --interval-ms  poll interval, 0 polls back to back (the meters are started
+ *                  staggered over one interval)
+ *   --read         block: the firmware's block plan; per-cid: one read per register
+ *   --publish      json: the <prefix>/data document; individual: json plus a
+ *                  topic per register; binary: a batch every --batch readings
+ *
+ * Columns of the result (one row per point):
+ *
+ *   samples_per_s            readings delivered to the broker per second
+ *   age_p50/p99/max_ms       from the reading's timestamp (midpoint of its Modbus
+ *                            reads, as the firmware stamps it) to the broker
+ *                            receiving the message that completes it; a batch
+ *                            completes all of its readings
+ *   cpu_us_per_sample        CPU time (user + system) of the device threads per
+ *                            reading: Modbus I/O, decoding, formatting and MQTT
+ *                            writes, not the meters or the broker
+ *   mqtt_bytes_per_sample    MQTT PUBLISH bytes on the wire per reading
+ *   modbus_bytes_per_sample  Modbus/TCP request and response bytes per reading
+ *   errors                   failed Modbus reads and MQTT writes
+ *
+ * With --compare, rows matching a previous CSV run on meters, interval, read
+ * and publish are checked: CPU time, p99 age and throughput may move by the
+ * --tolerance percentage (default 25), bytes per sample by 1%.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "meter_profiles.h"
+#include "reading_json.h"
+#include "sample_codec.h"
+#include "data_quality.h"
+
+#define MAX_METERS          64
+#define MAX_LIST            16
+#define MAX_BASELINE_ROWS   1024
+#define PENDING_CAPACITY    4096            // Readings published but not yet delivered, per device
+#define SINK_BUFFER_SIZE    (64 * 1024)     // Per broker connection
+#define JSON_BUFFER_SIZE    2048            // MQTT_JSON_BUFFER_SIZE of the firmware
+#define MODBUS_UNIT         1
+#define MODBUS_ADU_MAX      260
+#define IO_TIMEOUT_MS       2000
+#define DRAIN_MS            500             // Wait for in-flight readings after a run
+#define SINK_TOPIC_ALIAS_MAX 10             // Mosquitto's default max_topic_alias
+#define MQTT5_ALIAS_TOPIC_LEN 96            // As the firmware: longer topics are always sent in full
+
+typedef enum { READ_BLOCK = 0, READ_PER_CID, READ_MODE_COUNT } read_mode_t;
+typedef enum { PUBLISH_JSON = 0, PUBLISH_INDIVIDUAL, PUBLISH_BINARY, PUBLISH_MODE_COUNT } publish_mode_t;
+
+static const char* const READ_NAMES[READ_MODE_COUNT] = { "block", "per-cid" };
+static const char* const PUBLISH_NAMES[PUBLISH_MODE_COUNT] = { "json", "individual", "binary" };
+
+typedef struct {
+    int meters;
+    int interval_ms;
+    read_mode_t read;
+    publish_mode_t publish;
+} bench_point_t;
+
+typedef struct {
+    bench_point_t point;
+    double duration_s;
+    uint64_t samples;                   // Delivered during the run
+    double samples_per_s;
+    double target_per_s;                // 0 when polling back to back
+    double age_p50_ms;
+    double age_p99_ms;
+    double age_max_ms;
+    double cpu_us_per_sample;
+    double mqtt_bytes_per_sample;
+    double modbus_bytes_per_sample;
+    uint64_t errors;
+} bench_result_t;
+
+/* ===== OPTIONS ===== */
+
+static const meter_profile_t* s_profile = NULL;
+static double s_duration_s = 2.0;
+static uint32_t s_meter_delay_us = 0;
+static int s_batch_readings = CONFIG_SDM_BATCH_READINGS;
+static char s_broker_host[128] = "";
+static char s_broker_port[8] = "1883";
+static char s_prefix[64];
+static uint8_t s_mqtt_level = 4;                // CONNECT protocol level: 4 is MQTT 3.1.1, 5 is MQTT 5
+
+/* ===== SOCKET HELPERS ===== */
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint16_t get_u16_be(const uint8_t* p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static void put_u16_be(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+
+static bool send_all(int fd, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    while (len > 0) {
+        const ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Send a header and a payload as one segment where the kernel allows
+ */
+static bool send_two(int fd, const void* head, size_t head_len, const void* body, size_t body_len)
+{
+    struct iovec iov[2] = { { (void*)head, head_len }, { (void*)body, body_len } };
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+    ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+        return false;
+    }
+    if ((size_t)n < head_len) {
+        return send_all(fd, (const uint8_t*)head + n, head_len - n) && send_all(fd, body, body_len);
+    }
+    n -= (ssize_t)head_len;
+    return send_all(fd, (const uint8_t*)body + n, body_len - n);
+}
+
+static bool recv_all(int fd, void* data, size_t len)
+{
+    uint8_t* p = data;
+    while (len > 0) {
+        const ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void socket_tune(int fd)
+{
+    const int one = 1;
+    const struct timeval timeout = { .tv_sec = IO_TIMEOUT_MS / 1000, .tv_usec = (IO_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/**
+ * @brief Listen on an ephemeral loopback port
+ */
+static int listen_loopback(uint16_t* port)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, MAX_METERS + 2) != 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &addr_len) != 0) {
+        perror("listen");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int connect_to(const char* host, const char* port)
+{
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        fprintf(stderr, "cannot resolve %s:%s\n", host, port);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        fprintf(stderr, "cannot connect to %s:%s\n", host, port);
+        return -1;
+    }
+    socket_tune(fd);
+    return fd;
+}
+
+/* ===== MQTT ===== */
+
+/**
+ * @brief Write an MQTT fixed header
+ *
+ * @return Header length (2 to 5 bytes)
+ */
+static size_t mqtt_fixed_header(uint8_t* out, uint8_t type_flags, uint32_t remaining)
+{
+    size_t len = 0;
+    out[len++] = type_flags;
+    do {
+        uint8_t b = remaining & 0x7F;
+        remaining >>= 7;
+        out[len++] = remaining > 0 ? (b | 0x80) : b;
+    } while (remaining > 0);
+    return len;
+}
+
+/**
+ * @brief Read one packet (blocking)
+ *
+ * @return Packet type, or -1 on error; the body is truncated to size
+ */
+static int mqtt_read_packet(int fd, uint8_t* body, size_t size, size_t* body_len)
+{
+    uint8_t b;
+    if (!recv_all(fd, &b, 1)) {
+        return -1;
+    }
+    const int type = b >> 4;
+    uint32_t remaining = 0;
+    for (int shift = 0;; shift += 7) {
+        if (shift > 21 || !recv_all(fd, &b, 1)) {
+            return -1;
+        }
+        remaining |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    uint8_t discard[256];
+    size_t kept = 0;
+    while (remaining > 0) {
+        const size_t n = kept < size ? (remaining < size - kept ? remaining : size - kept)
+                                     : (remaining < sizeof(discard) ? remaining : sizeof(discard));
+        if (!recv_all(fd, kept < size ? body + kept : discard, n)) {
+            return -1;
+        }
+        if (kept < size) {
+            kept += n;
+        }
+        remaining -= (uint32_t)n;
+    }
+    *body_len = kept;
+    return type;
+}
+
+/**
+ * @brief Topic Alias Maximum (0x22) of an MQTT 5 CONNACK's properties, 0 without one
+ */
+static uint16_t connack_alias_maximum(const uint8_t* p, size_t len)
+{
+    uint32_t props_len = 0;
+    size_t pos = 0;
+    for (int shift = 0; shift <= 21 && pos < len; shift += 7) {
+        const uint8_t b = p[pos++];
+        props_len |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    const size_t end = props_len < len - pos ? pos + props_len : len;
+    while (pos < end) {
+        const uint8_t id = p[pos++];
+        size_t size;
+        switch (id) {
+        case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:             // Bytes
+            size = 1;
+            break;
+        case 0x13: case 0x21: case 0x22:                                    // Two byte integers
+            size = 2;
+            break;
+        case 0x11: case 0x27:                                               // Four byte integers
+            size = 4;
+            break;
+        case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:   // Strings and binary data
+            size = end - pos >= 2 ? 2 + (size_t)get_u16_be(p + pos) : end - pos;
+            break;
+        case 0x26:                                                          // User property: two strings
+            size = end - pos >= 2 ? 2 + (size_t)get_u16_be(p + pos) : end - pos;
+            size += end - pos >= size + 2 ? 2 + (size_t)get_u16_be(p + pos + size) : 0;
+            break;
+        default:
+            return 0;
+        }
+        if (id == 0x22 && end - pos >= 2) {
+            return get_u16_be(p + pos);
+        }
+        if (size > end - pos) {
+            break;
+        }
+        pos += size;
+    }
+    return 0;
+}
+
+/**
+ * @brief CONNECT with a clean session, waiting for the CONNACK
+ *
+ * @param level       Protocol level: 4 for MQTT 3.1.1, 5 for MQTT 5 (no CONNECT properties)
+ * @param alias_limit Receives the CONNACK topic alias maximum, 0 for MQTT 3.1.1; may be NULL
+ */
+static bool mqtt_connect(int fd, const char* client_id, uint8_t level, uint16_t* alias_limit)
+{
+    uint8_t packet[136];
+    uint8_t body[128];
+    const size_t id_len = strnlen(client_id, 64);
+    size_t len = 0;
+    const uint8_t variable[] = { 0, 4, 'M', 'Q', 'T', 'T', level, 0x02, 0, 60, 0 };
+    len = level == 5 ? sizeof(variable) : sizeof(variable) - 1;     // MQTT 5 adds the property length
+    memcpy(body, variable, len);
+    put_u16_be(body + len, (uint16_t)id_len);
+    memcpy(body + len + 2, client_id, id_len);
+    len += 2 + id_len;
+
+    const size_t head = mqtt_fixed_header(packet, 0x10, (uint32_t)len);
+    memcpy(packet + head, body, len);
+    if (!send_all(fd, packet, head + len)) {
+        return false;
+    }
+    size_t ack_len = 0;
+    if (mqtt_read_packet(fd, body, sizeof(body), &ack_len) != 2 || ack_len < 2 || body[1] != 0) {
+        return false;
+    }
+    if (alias_limit != NULL) {
+        *alias_limit = level == 5 ? connack_alias_maximum(body + 2, ack_len - 2) : 0;
+    }
+    return true;
+}
+
+/**
+ * @brief SUBSCRIBE to one filter at QoS 0, waiting for the SUBACK
+ */
+static bool mqtt_subscribe(int fd, const char* filter)
+{
+    uint8_t packet[160];
+    const size_t filter_len = strlen(filter);
+    const uint32_t remaining = (uint32_t)(2 + 2 + filter_len + 1);
+    size_t len = mqtt_fixed_header(packet, 0x82, remaining);
+    put_u16_be(packet + len, 1);                        // Packet id
+    put_u16_be(packet + len + 2, (uint16_t)filter_len);
+    memcpy(packet + len + 4, filter, filter_len);
+    len += 4 + filter_len;
+    packet[len++] = 0;                                  // QoS 0
+    if (!send_all(fd, packet, len)) {
+        return false;
+    }
+    uint8_t body[16];
+    size_t body_len = 0;
+    return mqtt_read_packet(fd, body, sizeof(body), &body_len) == 9 && body_len >= 3 && body[2] != 0x80;
+}
+
+/* ===== SIMULATED METER ===== */
+
+typedef struct {
+    int listen_fd;
+    uint16_t port;
+    pthread_t thread;
+    bool started;
+    uint16_t* image;                    // Input register image
+    uint32_t image_regs;
+    float values[METER_MAX_REGISTERS];
+    uint32_t rng;
+} sim_meter_t;
+
+static uint32_t xorshift32(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * @brief Plausible starting value of a register on a lightly loaded circuit
+ */
+static float sim_initial_value(const meter_register_t* reg)
+{
+    switch ((meter_quantity_t)reg->quantity) {
+        case QTY_VOLTAGE:                   return 230.0f;
+        case QTY_LINE_VOLTAGE:              return 400.0f;
+        case QTY_CURRENT:                   return 5.2f;
+        case QTY_NEUTRAL_CURRENT:           return 0.3f;
+        case QTY_ACTIVE_POWER:              return 1150.0f;
+        case QTY_APPARENT_POWER:            return 1196.0f;
+        case QTY_REACTIVE_POWER:            return 330.0f;
+        case QTY_POWER_FACTOR:              return 0.96f;
+        case QTY_PHASE_ANGLE:               return 16.0f;
+        case QTY_FREQUENCY:                 return 50.0f;
+        case QTY_IMPORT_ACTIVE_ENERGY:
+        case QTY_TOTAL_ACTIVE_ENERGY:       return 12345.678f;
+        case QTY_EXPORT_ACTIVE_ENERGY:      return 12.345f;
+        default:                            return 100.0f;
+    }
+}
+
+static void sim_store(sim_meter_t* m, int i)
+{
+    uint32_t bits;
+    memcpy(&bits, &m->values[i], sizeof(bits));
+    const uint16_t reg = s_profile->regs[i].reg;
+    m->image[reg] = (uint16_t)(bits >> 16);
+    m->image[reg + 1] = (uint16_t)bits;
+}
+
+static bool sim_meter_init(sim_meter_t* m, uint32_t seed)
+{
+    memset(m, 0, sizeof(*m));
+    m->rng = seed * 2654435761u + 1;
+    m->image_regs = s_profile->regs[s_profile->reg_count - 1].reg + 2 + METER_MODBUS_MAX_REGS;
+    m->image = calloc(m->image_regs, sizeof(uint16_t));
+    if (m->image == NULL) {
+        return false;
+    }
+    for (int i = 0; i < s_profile->reg_count; i++) {
+        m->values[i] = sim_initial_value(&s_profile->regs[i]);
+        sim_store(m, i);
+    }
+    m->listen_fd = listen_loopback(&m->port);
+    return m->listen_fd >= 0;
+}
+
+/**
+ * @brief Move the values a read covers by up to +-0.1%, so the codec sees real deltas
+ */
+static void sim_drift(sim_meter_t* m, uint16_t start, uint16_t count)
+{
+    for (int i = 0; i < s_profile->reg_count; i++) {
+        const uint16_t reg = s_profile->regs[i].reg;
+        if (reg >= start && reg + 2 <= start + count) {
+            const float step = ((float)(xorshift32(&m->rng) % 2001) - 1000.0f) * 1e-6f;
+            m->values[i] *= 1.0f + step;
+            sim_store(m, i);
+        }
+    }
+}
+
+/**
+ * @brief Serve one device: read holding/input registers, exceptions for anything else
+ */
+static void* sim_meter_task(void* arg)
+{
+    sim_meter_t* m = arg;
+    const int fd = accept(m->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return NULL;
+    }
+    socket_tune(fd);
+    uint8_t req[MODBUS_ADU_MAX];
+    uint8_t resp[MODBUS_ADU_MAX];
+    for (;;) {
+        if (!recv_all(fd, req, 7)) {
+            break;
+        }
+        const uint16_t len = get_u16_be(req + 4);
+        if (len < 2 || len > MODBUS_ADU_MAX - 6 || !recv_all(fd, req + 7, len - 1)) {
+            break;
+        }
+        memcpy(resp, req, 7);
+        const uint8_t function = req[7];
+        size_t resp_len;
+        if ((function == 3 || function == 4) && len == 6) {
+            const uint16_t start = get_u16_be(req + 8);
+            const uint16_t count = get_u16_be(req + 10);
+            if (count >= 1 && count <= 125 && (uint32_t)start + count <= m->image_regs) {
+                sim_drift(m, start, count);
+                resp[7] = function;
+                resp[8] = (uint8_t)(2 * count);
+                for (int i = 0; i < count; i++) {
+                    put_u16_be(resp + 9 + 2 * i, m->image[start + i]);
+                }
+                resp_len = 9 + 2 * (size_t)count;
+            } else {
+                resp[7] = function | 0x80;
+                resp[8] = 0x02;                     // Illegal data address
+                resp_len = 9;
+            }
+        } else {
+            resp[7] = function | 0x80;
+            resp[8] = 0x01;                         // Illegal function
+            resp_len = 9;
+        }
+        put_u16_be(resp + 4, (uint16_t)(resp_len - 6));
+        if (s_meter_delay_us > 0) {
+            usleep(s_meter_delay_us);
+        }
+        if (!send_all(fd, resp, resp_len)) {
+            break;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+/* ===== DEVICE ===== */
+
+typedef struct {
+    int64_t time_ns;                    // Reading timestamp
+    uint64_t last_message;              // Number of the message that completes the reading
+} pending_t;
+
+typedef struct {
+    int index;
+    const bench_point_t* point;
+    pthread_t thread;
+    bool started;
+    int modbus_fd;
+    int mqtt_fd;
+    char topic_base[96];                // <prefix>/m<index>
+    uint16_t transaction;
+    uint16_t alias_limit;               // CONNACK topic alias maximum, 0 for MQTT 3.1.1
+    int alias_count;
+    char alias_topics[CONFIG_SDM120_MQTT5_TOPIC_ALIASES][MQTT5_ALIAS_TOPIC_LEN];
+    bool alias_announced[CONFIG_SDM120_MQTT5_TOPIC_ALIASES];
+
+    // Device thread only, read after it is joined
+    uint64_t readings;
+    uint64_t errors;
+    uint64_t modbus_bytes;
+    uint64_t mqtt_bytes;
+    uint64_t messages_sent;
+    int64_t cpu_ns;
+
+    // Shared with the broker thread
+    pthread_mutex_t lock;
+    pending_t pending[PENDING_CAPACITY];
+    uint32_t pending_head;
+    uint32_t pending_count;
+    uint64_t messages_received;
+} device_t;
+
+static atomic_bool s_stop;
+static int64_t s_run_start_ns;
+static int64_t s_utc_offset_ns;         // CLOCK_REALTIME minus CLOCK_MONOTONIC
+
+/**
+ * @brief One Modbus/TCP read of a block
+ */
+static bool modbus_read(device_t* d, const meter_block_t* block, uint16_t* regs)
+{
+    uint8_t req[12];
+    uint8_t resp[MODBUS_ADU_MAX];
+    const uint16_t transaction = ++d->transaction;
+    put_u16_be(req, transaction);
+    put_u16_be(req + 2, 0);
+    put_u16_be(req + 4, 6);
+    req[6] = MODBUS_UNIT;
+    req[7] = 4;                                     // Read input registers
+    put_u16_be(req + 8, block->reg_start);
+    put_u16_be(req + 10, block->reg_size);
+    if (!send_all(d->modbus_fd, req, sizeof(req)) || !recv_all(d->modbus_fd, resp, 7)) {
+        return false;
+    }
+    const uint16_t len = get_u16_be(resp + 4);
+    if (len < 2 || len > MODBUS_ADU_MAX - 6 || !recv_all(d->modbus_fd, resp + 7, len - 1)) {
+        return false;
+    }
+    d->modbus_bytes += sizeof(req) + 6 + len;
+    if (get_u16_be(resp) != transaction || resp[7] != 4 || resp[8] != 2 * block->reg_size ||
+        len != 3 + 2 * block->reg_size) {
+        return false;
+    }
+    for (int i = 0; i < block->reg_size; i++) {
+        regs[i] = get_u16_be(resp + 9 + 2 * i);
+    }
+    return true;
+}
+
+typedef enum { CLASS_TELEMETRY = 0, CLASS_ENERGY } topic_class_t;    // As the firmware's mqtt_topic_class_t
+
+/**
+ * @brief Alias number of a topic, as mqtt5_alias_for(): the next free one on first use, 0 for none
+ */
+static uint16_t mqtt5_alias_for(device_t* d, const char* topic)
+{
+    const int limit = d->alias_limit < CONFIG_SDM120_MQTT5_TOPIC_ALIASES ? d->alias_limit
+                                                                         : CONFIG_SDM120_MQTT5_TOPIC_ALIASES;
+    for (int i = 0; i < d->alias_count; i++) {
+        if (strcmp(d->alias_topics[i], topic) == 0) {
+            return (uint16_t)(i + 1);
+        }
+    }
+    if (d->alias_count >= limit || strlen(topic) >= MQTT5_ALIAS_TOPIC_LEN) {
+        return 0;
+    }
+    strcpy(d->alias_topics[d->alias_count], topic);
+    d->alias_announced[d->alias_count] = false;
+    return (uint16_t)++d->alias_count;
+}
+
+/**
+ * @brief QoS 0 PUBLISH; with --mqtt 5 the properties mqtt5_publish() sets for the topic class
+ */
+static bool mqtt_publish(device_t* d, topic_class_t topic_class, const char* topic, const void* payload, size_t len)
+{
+    uint8_t head[8 + 128 + 9];
+    uint8_t props[8];
+    size_t props_len = 0;
+    uint16_t alias = 0;
+    const char* wire_topic = topic;
+    if (s_mqtt_level == 5) {
+        if (topic_class == CLASS_TELEMETRY && CONFIG_SDM120_MQTT5_TELEMETRY_EXPIRY_S > 0) {
+            props[0] = 0x02;                                // Message expiry interval
+            put_u16_be(props + 1, (uint16_t)((uint32_t)CONFIG_SDM120_MQTT5_TELEMETRY_EXPIRY_S >> 16));
+            put_u16_be(props + 3, (uint16_t)CONFIG_SDM120_MQTT5_TELEMETRY_EXPIRY_S);
+            props_len = 5;
+        }
+        const int qos = topic_class == CLASS_TELEMETRY ? CONFIG_SDM120_MQTT_QOS_TELEMETRY
+                                                       : CONFIG_SDM120_MQTT_QOS_ENERGY;
+        alias = qos == 0 ? mqtt5_alias_for(d, topic) : 0;
+        if (alias != 0) {
+            props[props_len] = 0x23;                        // Topic alias
+            put_u16_be(props + props_len + 1, alias);
+            props_len += 3;
+            if (d->alias_announced[alias - 1]) {
+                wire_topic = "";
+            }
+        }
+    }
+    const size_t topic_len = strlen(wire_topic);
+    if (topic_len > 128) {
+        return false;
+    }
+    const size_t props_field = s_mqtt_level == 5 ? 1 + props_len : 0;
+    size_t head_len = mqtt_fixed_header(head, 0x30, (uint32_t)(2 + topic_len + props_field + len));
+    put_u16_be(head + head_len, (uint16_t)topic_len);
+    memcpy(head + head_len + 2, wire_topic, topic_len);
+    head_len += 2 + topic_len;
+    if (s_mqtt_level == 5) {
+        head[head_len++] = (uint8_t)props_len;
+        memcpy(head + head_len, props, props_len);
+        head_len += props_len;
+    }
+    if (!send_two(d->mqtt_fd, head, head_len, payload, len)) {
+        d->errors++;
+        return false;
+    }
+    if (alias != 0) {
+        d->alias_announced[alias - 1] = true;
+    }
+    d->mqtt_bytes += head_len + len;
+    d->messages_sent++;
+    return true;
+}
+
+/**
+ * @brief Register readings before their messages go out, so the broker thread cannot see them first
+ */
+static void pending_push(device_t* d, const int64_t* times_ns, int count, uint64_t last_message)
+{
+    for (int i = 0; i < count; i++) {
+        for (;;) {
+            pthread_mutex_lock(&d->lock);
+            if (d->pending_count < PENDING_CAPACITY) {
+                pending_t* p = &d->pending[(d->pending_head + d->pending_count++) % PENDING_CAPACITY];
+                p->time_ns = times_ns[i];
+                p->last_message = last_message;
+                pthread_mutex_unlock(&d->lock);
+                break;
+            }
+            pthread_mutex_unlock(&d->lock);
+            if (atomic_load(&s_stop)) {
+                return;
+            }
+            usleep(100);                            // The broker is behind
+        }
+    }
+}
+
+/**
+ * @brief Wait for the next poll, waking early when the run stops
+ */
+static void wait_until(int64_t deadline_ns)
+{
+    for (;;) {
+        const int64_t remaining = deadline_ns - now_ns();
+        if (remaining <= 0 || atomic_load(&s_stop)) {
+            return;
+        }
+        const int64_t slice = remaining < 50000000 ? remaining : 50000000;
+        const struct timespec ts = { .tv_sec = 0, .tv_nsec = slice };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void* device_task(void* arg)
+{
+    device_t* d = arg;
+    const bench_point_t* p = d->point;
+    meter_block_t blocks[METER_MAX_BLOCKS];
+    const size_t block_count = p->read == READ_BLOCK
+        ? meter_plan_blocks(s_profile, CONFIG_SDM_BLOCK_MAX_REGS, CONFIG_SDM_BLOCK_MAX_GAP, blocks, METER_MAX_BLOCKS)
+        : meter_plan_blocks(s_profile, 2, 0, blocks, METER_MAX_BLOCKS);
+
+    // Columns as the firmware's without energy integration: the registers, then the quality flags
+    uint8_t precision[SAMPLE_CODEC_MAX_COLUMNS];
+    for (int i = 0; i < s_profile->reg_count; i++) {
+        precision[i] = s_profile->regs[i].precision;
+    }
+    const uint8_t columns = s_profile->reg_count + 1;
+    precision[s_profile->reg_count] = 0;
+    const size_t batch_size = SAMPLE_CODEC_HEADER_SIZE(columns) +
+                              (size_t)s_batch_readings * SAMPLE_CODEC_MAX_SAMPLE_SIZE(columns);
+    dq_filter_t dq;
+    dq_filter_init(&dq, s_profile, false, 0, 3);
+    uint8_t* batch_buf = malloc(batch_size);
+    int64_t* batch_times = malloc(sizeof(int64_t) * s_batch_readings);
+    sample_encoder_t enc;
+    bool batch_open = false;
+
+    char json[JSON_BUFFER_SIZE];
+    char topic[160];
+    char data_topic[160];
+    char batch_topic[160];
+    snprintf(data_topic, sizeof(data_topic), "%s/data", d->topic_base);
+    snprintf(batch_topic, sizeof(batch_topic), "%s/batch", d->topic_base);
+
+    const int64_t cpu_start = thread_cpu_ns();
+    const int64_t interval_ns = (int64_t)p->interval_ms * 1000000;
+    int64_t next_ns = s_run_start_ns + interval_ns * d->index / p->meters;
+    wait_until(s_run_start_ns);
+
+    while (!atomic_load(&s_stop) && batch_buf != NULL && batch_times != NULL) {
+        if (interval_ns > 0) {
+            wait_until(next_ns);
+            if (atomic_load(&s_stop)) {
+                break;
+            }
+            next_ns += interval_ns;
+            const int64_t now = now_ns();
+            if (next_ns < now) {
+                next_ns = now;                      // Overrun: no catch-up burst
+            }
+        }
+
+        // Acquisition: as read_sdm120_data(), one read per block, stamped at the midpoint
+        float values[METER_MAX_REGISTERS] = { 0 };
+        uint64_t valid = 0;
+        int64_t first_ns = 0;
+        int64_t last_ns = 0;
+        bool connected = true;
+        for (size_t b = 0; b < block_count && connected; b++) {
+            uint16_t regs[METER_MODBUS_MAX_REGS];
+            const int64_t start_ns = now_ns();
+            if (modbus_read(d, &blocks[b], regs)) {
+                meter_decode_block(s_profile, &blocks[b], regs, values, &valid);
+                first_ns = first_ns == 0 ? start_ns : first_ns;
+                last_ns = now_ns();
+            } else {
+                d->errors++;
+                connected = false;                  // The stream is out of step; give up this device
+            }
+        }
+        if (!connected) {
+            break;
+        }
+        const int64_t stamp_ns = first_ns + (last_ns - first_ns) / 2;
+        uint8_t quality[METER_MAX_REGISTERS];
+        dq_filter_apply(&dq, values, &valid, quality);
+        d->readings++;
+
+        // Publishing: as mqtt_publish_sdm120_data() or batch_add()
+        if (p->publish == PUBLISH_BINARY) {
+            int64_t quantised[SAMPLE_CODEC_MAX_COLUMNS];
+            uint64_t column_valid = 0;
+            for (int i = 0; i < s_profile->reg_count; i++) {
+                if ((valid & (1ULL << i)) && sample_codec_quantise(values[i], precision[i], &quantised[i])) {
+                    column_valid |= 1ULL << i;
+                }
+            }
+            quantised[s_profile->reg_count] = (int64_t)dq_flag_mask(quality, s_profile->reg_count);
+            column_valid |= 1ULL << s_profile->reg_count;
+            if (!batch_open) {
+                sample_encoder_begin(&enc, batch_buf, batch_size, precision, columns, true);
+                batch_open = true;
+            }
+            batch_times[enc.sample_count] = stamp_ns;
+            sample_encoder_add(&enc, (stamp_ns + s_utc_offset_ns) / 1000000, quantised, column_valid);
+            if (enc.sample_count >= s_batch_readings) {
+                pending_push(d, batch_times, enc.sample_count, d->messages_sent + 1);
+                mqtt_publish(d, CLASS_TELEMETRY, batch_topic, batch_buf, sample_encoder_len(&enc));
+                batch_open = false;
+            }
+            continue;
+        }
+
+        const reading_json_time_t json_time = {
+            .utc = true,
+            .time_us = (stamp_ns + s_utc_offset_ns) / 1000,
+            .uncertainty_us = (uint32_t)((last_ns - first_ns) / 2000),
+            .sync = "synced",
+        };
+        const int len = reading_json_format(json, sizeof(json), s_profile, values, quality, &json_time, NULL,
+                                            "127.0.0.1");
+        if (len >= (int)sizeof(json)) {
+            d->errors++;
+            continue;
+        }
+        const int messages = p->publish == PUBLISH_INDIVIDUAL ? 2 + s_profile->reg_count : 1;
+        pending_push(d, &stamp_ns, 1, d->messages_sent + messages);
+        mqtt_publish(d, CLASS_TELEMETRY, data_topic, json, (size_t)len);
+        if (p->publish == PUBLISH_INDIVIDUAL) {
+            char value_str[32];
+            char quality_str[METER_MAX_REGISTERS + 1];
+            for (int i = 0; i < s_profile->reg_count; i++) {
+                const meter_register_t* reg = &s_profile->regs[i];
+                quality_str[i] = dq_quality_letter((dq_quality_t)quality[i]);
+                snprintf(topic, sizeof(topic), "%s/%s", d->topic_base, reg->topic);
+                const int value_len = snprintf(value_str, sizeof(value_str), "%.*f", reg->precision, values[i]);
+                const topic_class_t topic_class = reg->quantity >= QTY_IMPORT_ACTIVE_ENERGY &&
+                                                  reg->quantity <= QTY_TOTAL_REACTIVE_ENERGY
+                                                  ? CLASS_ENERGY : CLASS_TELEMETRY;
+                mqtt_publish(d, topic_class, topic, value_str, (size_t)value_len);
+            }
+            quality_str[s_profile->reg_count] = '\0';
+            snprintf(topic, sizeof(topic), "%s/quality", d->topic_base);
+            mqtt_publish(d, CLASS_TELEMETRY, topic, quality_str, (size_t)s_profile->reg_count);
+        }
+    }
+
+    d->cpu_ns = thread_cpu_ns() - cpu_start;
+    free(batch_buf);
+    free(batch_times);
+    return NULL;
+}
+
+/* ===== BROKER STAND-IN / SUBSCRIBER ===== */
+
+typedef struct {
+    int fd;
+    uint8_t* buf;
+    size_t len;
+    uint8_t level;                      // Protocol level of the CONNECT, 0 for the subscriber
+    int device;                         // Device of the last full topic, for alias-only publishes; -1 before
+} sink_conn_t;
+
+static struct {
+    device_t* devices;
+    int device_count;
+    int listen_fd;                      // -1 when reading from a real broker
+    sink_conn_t conns[MAX_METERS + 1];
+    int conn_count;
+    double* ages_ms;
+    size_t age_count;
+    size_t age_capacity;
+    uint64_t delivered_in_run;
+    atomic_llong stop_ns;               // End of the measured run, 0 while running
+    atomic_bool quit;
+} s_sink;
+
+/**
+ * @brief A message of a device reached the broker: complete the readings it finishes
+ */
+static void sink_deliver(device_t* d)
+{
+    const int64_t now = now_ns();
+    const int64_t stop = atomic_load(&s_sink.stop_ns);
+    pthread_mutex_lock(&d->lock);
+    d->messages_received++;
+    while (d->pending_count > 0 && d->pending[d->pending_head].last_message <= d->messages_received) {
+        const pending_t* p = &d->pending[d->pending_head];
+        if (s_sink.age_count == s_sink.age_capacity) {
+            const size_t capacity = s_sink.age_capacity > 0 ? 2 * s_sink.age_capacity : 65536;
+            double* ages = realloc(s_sink.ages_ms, capacity * sizeof(double));
+            if (ages != NULL) {
+                s_sink.ages_ms = ages;
+                s_sink.age_capacity = capacity;
+            }
+        }
+        if (s_sink.age_count < s_sink.age_capacity) {
+            s_sink.ages_ms[s_sink.age_count++] = (now - p->time_ns) / 1e6;
+        }
+        if (stop == 0 || now < stop) {
+            s_sink.delivered_in_run++;
+        }
+        d->pending_head = (d->pending_head + 1) % PENDING_CAPACITY;
+        d->pending_count--;
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+static void sink_publish(sink_conn_t* c, const uint8_t* body, size_t len)
+{
+    if (len < 2) {
+        return;
+    }
+    const size_t topic_len = get_u16_be(body);
+    if (topic_len == 0 && c->level == 5) {
+        if (c->device >= 0) {
+            sink_deliver(&s_sink.devices[c->device]);       // Alias-only: each device has its own connection
+        }
+        return;
+    }
+    const size_t prefix_len = strlen(s_prefix);
+    if (topic_len > len - 2 || topic_len < prefix_len + 3 || memcmp(body + 2, s_prefix, prefix_len) != 0 ||
+        memcmp(body + 2 + prefix_len, "/m", 2) != 0) {
+        return;
+    }
+    int index = 0;
+    for (size_t i = 2 + prefix_len + 2; i < 2 + topic_len && body[i] >= '0' && body[i] <= '9'; i++) {
+        index = index * 10 + (body[i] - '0');
+    }
+    if (index < s_sink.device_count) {
+        c->device = index;
+        sink_deliver(&s_sink.devices[index]);
+    }
+}
+
+/**
+ * @brief Handle every complete packet in a connection's buffer
+ *
+ * @return false on a protocol error
+ */
+static bool sink_parse(sink_conn_t* c)
+{
+    size_t pos = 0;
+    while (c->len - pos >= 2) {
+        uint32_t remaining = 0;
+        size_t i = pos + 1;
+        bool complete = false;
+        for (int shift = 0; shift <= 21 && i < c->len; shift += 7) {
+            const uint8_t b = c->buf[i++];
+            remaining |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete) {
+            if (i - pos > 4) {
+                return false;
+            }
+            break;
+        }
+        if (remaining > SINK_BUFFER_SIZE - 5) {
+            return false;
+        }
+        if (c->len - i < remaining) {
+            break;
+        }
+        const uint8_t type = c->buf[pos] >> 4;
+        if (type == 1) {
+            c->level = remaining >= 7 ? c->buf[i + 6] : 0;
+            static const uint8_t connack[] = { 0x20, 2, 0, 0 };
+            static const uint8_t connack5[] = { 0x20, 6, 0, 0, 3, 0x22, 0, SINK_TOPIC_ALIAS_MAX };
+            if (c->level == 5) {
+                send_all(c->fd, connack5, sizeof(connack5));
+            } else {
+                send_all(c->fd, connack, sizeof(connack));
+            }
+        } else if (type == 3) {
+            sink_publish(c, c->buf + i, remaining);
+        } else if (type == 12) {
+            static const uint8_t pingresp[] = { 0xD0, 0 };
+            send_all(c->fd, pingresp, sizeof(pingresp));
+        }
+        pos = i + remaining;
+    }
+    memmove(c->buf, c->buf + pos, c->len - pos);
+    c->len -= pos;
+    return true;
+}
+
+static void sink_add_conn(int fd)
+{
+    if (s_sink.conn_count >= MAX_METERS + 1) {
+        close(fd);
+        return;
+    }
+    sink_conn_t* c = &s_sink.conns[s_sink.conn_count];
+    c->buf = malloc(SINK_BUFFER_SIZE);
+    if (c->buf == NULL) {
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    c->len = 0;
+    c->level = 0;
+    c->device = -1;
+    s_sink.conn_count++;
+}
+
+static void sink_close_conn(int i)
+{
+    close(s_sink.conns[i].fd);
+    free(s_sink.conns[i].buf);
+    s_sink.conns[i] = s_sink.conns[--s_sink.conn_count];
+}
+
+static void* sink_task(void* arg)
+{
+    (void)arg;
+    struct pollfd fds[MAX_METERS + 2];
+    while (!atomic_load(&s_sink.quit)) {
+        int n = 0;
+        for (int i = 0; i < s_sink.conn_count; i++) {
+            fds[n++] = (struct pollfd){ .fd = s_sink.conns[i].fd, .events = POLLIN };
+        }
+        if (s_sink.listen_fd >= 0) {
+            fds[n++] = (struct pollfd){ .fd = s_sink.listen_fd, .events = POLLIN };
+        }
+        if (poll(fds, n, 20) <= 0) {
+            continue;
+        }
+        if (s_sink.listen_fd >= 0 && (fds[n - 1].revents & POLLIN)) {
+            const int fd = accept(s_sink.listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                socket_tune(fd);
+                sink_add_conn(fd);
+            }
+        }
+        for (int i = s_sink.conn_count - 1; i >= 0; i--) {
+            if (i >= n - (s_sink.listen_fd >= 0 ? 1 : 0) || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            sink_conn_t* c = &s_sink.conns[i];
+            const ssize_t got = recv(c->fd, c->buf + c->len, SINK_BUFFER_SIZE - c->len, 0);
+            if (got <= 0) {
+                sink_close_conn(i);
+                continue;
+            }
+            c->len += (size_t)got;
+            if (!sink_parse(c)) {
+                sink_close_conn(i);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* ===== RUN ===== */
+
+static int compare_double(const void* a, const void* b)
+{
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t count, double p)
+{
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(p * count + 0.999999);
+    return sorted[index > 0 ? index - 1 : 0];
+}
+
+/**
+ * @brief Run one point of the sweep
+ */
+static bool run_point(const bench_point_t* p, bench_result_t* r)
+{
+    bool ok = false;
+    sim_meter_t* sims = calloc(p->meters, sizeof(sim_meter_t));
+    device_t* devices = calloc(p->meters, sizeof(device_t));
+    pthread_t sink_thread;
+    bool sink_started = false;
+    uint16_t sink_port = 0;
+    char port_str[8];
+
+    memset(&s_sink, 0, sizeof(s_sink));
+    s_sink.devices = devices;
+    s_sink.device_count = p->meters;
+    s_sink.listen_fd = -1;
+    atomic_store(&s_stop, false);
+    if (sims == NULL || devices == NULL) {
+        goto done;
+    }
+    for (int i = 0; i < p->meters; i++) {
+        sims[i].listen_fd = -1;
+        devices[i].modbus_fd = -1;
+        devices[i].mqtt_fd = -1;
+        pthread_mutex_init(&devices[i].lock, NULL);
+    }
+
+    if (s_broker_host[0] != '\0') {
+        char filter[80];
+        char client_id[48];
+        snprintf(filter, sizeof(filter), "%s/#", s_prefix);
+        snprintf(client_id, sizeof(client_id), "sdm_bench_%d_sub", (int)getpid());
+        const int fd = connect_to(s_broker_host, s_broker_port);
+        if (fd < 0 || !mqtt_connect(fd, client_id, 4, NULL) || !mqtt_subscribe(fd, filter)) {
+            fprintf(stderr, "broker %s:%s refused the subscriber\n", s_broker_host, s_broker_port);
+            if (fd >= 0) {
+                close(fd);
+            }
+            goto done;
+        }
+        sink_add_conn(fd);
+    } else {
+        s_sink.listen_fd = listen_loopback(&sink_port);
+        if (s_sink.listen_fd < 0) {
+            goto done;
+        }
+        snprintf(port_str, sizeof(port_str), "%u", sink_port);
+    }
+    if (pthread_create(&sink_thread, NULL, sink_task, NULL) != 0) {
+        goto done;
+    }
+    sink_started = true;
+
+    for (int i = 0; i < p->meters; i++) {
+        if (!sim_meter_init(&sims[i], (uint32_t)i + 1) ||
+            pthread_create(&sims[i].thread, NULL, sim_meter_task, &sims[i]) != 0) {
+            goto done;
+        }
+        sims[i].started = true;
+
+        device_t* d = &devices[i];
+        char meter_port[8];
+        char client_id[48];
+        snprintf(meter_port, sizeof(meter_port), "%u", sims[i].port);
+        snprintf(client_id, sizeof(client_id), "sdm_bench_%d_m%d", (int)getpid(), i);
+        d->index = i;
+        d->point = p;
+        snprintf(d->topic_base, sizeof(d->topic_base), "%s/m%d", s_prefix, i);
+        d->modbus_fd = connect_to("127.0.0.1", meter_port);
+        d->mqtt_fd = s_broker_host[0] != '\0' ? connect_to(s_broker_host, s_broker_port)
+                                              : connect_to("127.0.0.1", port_str);
+        if (d->modbus_fd < 0 || d->mqtt_fd < 0 || !mqtt_connect(d->mqtt_fd, client_id, s_mqtt_level, &d->alias_limit)) {
+            fprintf(stderr, "device %d could not connect\n", i);
+            goto done;
+        }
+    }
+
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    s_utc_offset_ns = (int64_t)realtime.tv_sec * 1000000000LL + realtime.tv_nsec - now_ns();
+    s_run_start_ns = now_ns() + 20000000;           // Every device starts from the same instant
+    for (int i = 0; i < p->meters; i++) {
+        if (pthread_create(&devices[i].thread, NULL, device_task, &devices[i]) != 0) {
+            goto done;
+        }
+        devices[i].started = true;
+    }
+    const int64_t stop_at_ns = s_run_start_ns + (int64_t)(s_duration_s * 1e9);
+    while (now_ns() < stop_at_ns) {
+        usleep(10000);
+    }
+    atomic_store(&s_sink.stop_ns, now_ns());
+    atomic_store(&s_stop, true);
+    ok = true;
+
+done:
+    atomic_store(&s_stop, true);
+    for (int i = 0; i < p->meters && devices != NULL; i++) {
+        if (devices[i].started) {
+            pthread_join(devices[i].thread, NULL);
+        }
+    }
+    // Let the broker catch up with what was published
+    for (int64_t deadline = now_ns() + (int64_t)DRAIN_MS * 1000000; ok && now_ns() < deadline;) {
+        uint32_t in_flight = 0;
+        for (int i = 0; i < p->meters; i++) {
+            pthread_mutex_lock(&devices[i].lock);
+            in_flight += devices[i].pending_count;
+            pthread_mutex_unlock(&devices[i].lock);
+        }
+        if (in_flight == 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    atomic_store(&s_sink.quit, true);
+    if (sink_started) {
+        pthread_join(sink_thread, NULL);
+    }
+    while (s_sink.conn_count > 0) {
+        sink_close_conn(s_sink.conn_count - 1);
+    }
+    if (s_sink.listen_fd >= 0) {
+        close(s_sink.listen_fd);
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->point = *p;
+    uint64_t readings = 0;
+    int64_t cpu_ns = 0;
+    uint64_t mqtt_bytes = 0;
+    uint64_t modbus_bytes = 0;
+    for (int i = 0; i < p->meters && devices != NULL; i++) {
+        device_t* d = &devices[i];
+        if (d->modbus_fd >= 0) {
+            close(d->modbus_fd);                    // Ends the simulated meter
+        }
+        if (d->mqtt_fd >= 0) {
+            close(d->mqtt_fd);
+        }
+        readings += d->readings;
+        cpu_ns += d->cpu_ns;
+        mqtt_bytes += d->mqtt_bytes;
+        modbus_bytes += d->modbus_bytes;
+        r->errors += d->errors;
+        pthread_mutex_destroy(&d->lock);
+    }
+    for (int i = 0; i < p->meters && sims != NULL; i++) {
+        if (sims[i].listen_fd >= 0) {
+            shutdown(sims[i].listen_fd, SHUT_RDWR);    // Unblocks an accept() that never got a device
+        }
+        if (sims[i].started) {
+            pthread_join(sims[i].thread, NULL);
+        }
+        if (sims[i].listen_fd >= 0) {
+            close(sims[i].listen_fd);
+        }
+        free(sims[i].image);
+    }
+
+    if (ok) {
+        r->duration_s = (atomic_load(&s_sink.stop_ns) - s_run_start_ns) / 1e9;
+        r->samples = s_sink.delivered_in_run;
+        r->samples_per_s = r->duration_s > 0 ? r->samples / r->duration_s : 0;
+        r->target_per_s = p->interval_ms > 0 ? p->meters * 1000.0 / p->interval_ms : 0;
+        qsort(s_sink.ages_ms, s_sink.age_count, sizeof(double), compare_double);
+        r->age_p50_ms = percentile(s_sink.ages_ms, s_sink.age_count, 0.50);
+        r->age_p99_ms = percentile(s_sink.ages_ms, s_sink.age_count, 0.99);
+        r->age_max_ms = s_sink.age_count > 0 ? s_sink.ages_ms[s_sink.age_count - 1] : 0;
+        if (readings > 0) {
+            r->cpu_us_per_sample = cpu_ns / 1e3 / readings;
+            r->mqtt_bytes_per_sample = (double)mqtt_bytes / readings;
+            r->modbus_bytes_per_sample = (double)modbus_bytes / readings;
+        }
+    }
+    free(s_sink.ages_ms);
+    free(sims);
+    free(devices);
+    return ok;
+}
+
+/* ===== OUTPUT AND COMPARISON ===== */
+
+static const char* const CSV_HEADER =
+    "meters,interval_ms,read,publish,duration_s,samples,samples_per_s,target_per_s,"
+    "age_p50_ms,age_p99_ms,age_max_ms,cpu_us_per_sample,mqtt_bytes_per_sample,modbus_bytes_per_sample,errors";
+
+static void print_result(const bench_result_t* r, bool json, bool first)
+{
+    const bench_point_t* p = &r->point;
+    if (json) {
+        printf("%s  {\"meters\":%d,\"interval_ms\":%d,\"read\":\"%s\",\"publish\":\"%s\",\"duration_s\":%.3f,"
+               "\"samples\":%llu,\"samples_per_s\":%.1f,\"target_per_s\":%.1f,\"age_p50_ms\":%.3f,"
+               "\"age_p99_ms\":%.3f,\"age_max_ms\":%.3f,\"cpu_us_per_sample\":%.2f,"
+               "\"mqtt_bytes_per_sample\":%.1f,\"modbus_bytes_per_sample\":%.1f,\"errors\":%llu}",
+               first ? "" : ",\n", p->meters, p->interval_ms, READ_NAMES[p->read], PUBLISH_NAMES[p->publish],
+               r->duration_s, (unsigned long long)r->samples, r->samples_per_s, r->target_per_s, r->age_p50_ms,
+               r->age_p99_ms, r->age_max_ms, r->cpu_us_per_sample, r->mqtt_bytes_per_sample,
+               r->modbus_bytes_per_sample, (unsigned long long)r->errors);
+    } else {
+        printf("%d,%d,%s,%s,%.3f,%llu,%.1f,%.1f,%.3f,%.3f,%.3f,%.2f,%.1f,%.1f,%llu\n", p->meters, p->interval_ms,
+               READ_NAMES[p->read], PUBLISH_NAMES[p->publish], r->duration_s, (unsigned long long)r->samples,
+               r->samples_per_s, r->target_per_s, r->age_p50_ms, r->age_p99_ms, r->age_max_ms,
+               r->cpu_us_per_sample, r->mqtt_bytes_per_sample, r->modbus_bytes_per_sample,
+               (unsigned long long)r->errors);
+    }
+    fflush(stdout);
+}
+
+typedef struct {
+    bench_point_t point;
+    double samples_per_s;
+    double age_p99_ms;
+    double cpu_us_per_sample;
+    double mqtt_bytes_per_sample;
+    double modbus_bytes_per_sample;
+} baseline_row_t;
+
+static baseline_row_t* s_baseline = NULL;
+static int s_baseline_count = 0;
+
+static int name_index(const char* const* names, int count, const char* name)
+{
+    for (int i = 0; i < count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Load the rows of a previous CSV run
+ */
+static bool load_baseline(const char* path)
+{
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    s_baseline = calloc(MAX_BASELINE_ROWS, sizeof(baseline_row_t));
+    char line[512];
+    while (s_baseline != NULL && fgets(line, sizeof(line), f) != NULL && s_baseline_count < MAX_BASELINE_ROWS) {
+        char read[16];
+        char publish[16];
+        bench_result_t r;
+        unsigned long long samples;
+        unsigned long long errors;
+        if (sscanf(line, "%d,%d,%15[^,],%15[^,],%lf,%llu,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%llu",
+                   &r.point.meters, &r.point.interval_ms, read, publish, &r.duration_s, &samples,
+                   &r.samples_per_s, &r.target_per_s, &r.age_p50_ms, &r.age_p99_ms, &r.age_max_ms,
+                   &r.cpu_us_per_sample, &r.mqtt_bytes_per_sample, &r.modbus_bytes_per_sample, &errors) != 15) {
+            continue;                               // Header or foreign line
+        }
+        const int read_mode = name_index(READ_NAMES, READ_MODE_COUNT, read);
+        const int publish_mode = name_index(PUBLISH_NAMES, PUBLISH_MODE_COUNT, publish);
+        if (read_mode < 0 || publish_mode < 0) {
+            continue;
+        }
+        baseline_row_t* b = &s_baseline[s_baseline_count++];
+        b->point = r.point;
+        b->point.read = (read_mode_t)read_mode;
+        b->point.publish = (publish_mode_t)publish_mode;
+        b->samples_per_s = r.samples_per_s;
+        b->age_p99_ms = r.age_p99_ms;
+        b->cpu_us_per_sample = r.cpu_us_per_sample;
+        b->mqtt_bytes_per_sample = r.mqtt_bytes_per_sample;
+        b->modbus_bytes_per_sample = r.modbus_bytes_per_sample;
+    }
+    fclose(f);
+    fprintf(stderr, "baseline: %d rows from %s\n", s_baseline_count, path);
+    return s_baseline != NULL;
+}
+
+/**
+ * @brief Check a result against its baseline row
+ *
+ * @return Number of regressed metrics
+ */
+static int compare_result(const bench_result_t* r, double tolerance)
+{
+    const bench_point_t* p = &r->point;
+    const baseline_row_t* b = NULL;
+    for (int i = 0; i < s_baseline_count && b == NULL; i++) {
+        const bench_point_t* q = &s_baseline[i].point;
+        if (q->meters == p->meters && q->interval_ms == p->interval_ms && q->read == p->read &&
+            q->publish == p->publish) {
+            b = &s_baseline[i];
+        }
+    }
+    if (b == NULL) {
+        return 0;
+    }
+
+    struct {
+        const char* name;
+        double now;
+        double base;
+        bool higher_is_worse;
+        double tolerance;
+    } checks[] = {
+        { "samples_per_s", r->samples_per_s, b->samples_per_s, false, tolerance },
+        { "age_p99_ms", r->age_p99_ms, b->age_p99_ms, true, tolerance },
+        { "cpu_us_per_sample", r->cpu_us_per_sample, b->cpu_us_per_sample, true, tolerance },
+        { "mqtt_bytes_per_sample", r->mqtt_bytes_per_sample, b->mqtt_bytes_per_sample, true, 0.01 },
+        { "modbus_bytes_per_sample", r->modbus_bytes_per_sample, b->modbus_bytes_per_sample, true, 0.01 },
+    };
+    int regressions = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        const bool worse = checks[i].higher_is_worse ? checks[i].now > checks[i].base * (1 + checks[i].tolerance)
+                                                     : checks[i].now < checks[i].base * (1 - checks[i].tolerance);
+        if (worse) {
+            fprintf(stderr, "REGRESSION meters=%d interval_ms=%d read=%s publish=%s: %s %.2f -> %.2f\n",
+                    p->meters, p->interval_ms, READ_NAMES[p->read], PUBLISH_NAMES[p->publish], checks[i].name,
+                    checks[i].base, checks[i].now);
+            regressions++;
+        }
+    }
+    return regressions;
+}
+
+/* ===== MAIN ===== */
+
+static int parse_ints(const char* arg, int* out, int min, int max)
+{
+    int count = 0;
+    char* copy = strdup(arg);
+    char* save = NULL;
+    for (char* tok = strtok_r(copy, ",", &save); tok != NULL && count < MAX_LIST; tok = strtok_r(NULL, ",", &save)) {
+        char* end;
+        const long v = strtol(tok, &end, 10);
+        if (*end != '\0' || v < min || v > max) {
+            count = 0;
+            break;
+        }
+        out[count++] = (int)v;
+    }
+    free(copy);
+    return count;
+}
+
+static int parse_names(const char* arg, const char* const* names, int name_count, int* out)
+{
+    int count = 0;
+    char* copy = strdup(arg);
+    char* save = NULL;
+    for (char* tok = strtok_r(copy, ",", &save); tok != NULL && count < MAX_LIST; tok = strtok_r(NULL, ",", &save)) {
+        const int index = name_index(names, name_count, tok);
+        if (index < 0) {
+            count = 0;
+            break;
+        }
+        out[count++] = index;
+    }
+    free(copy);
+    return count;
+}
+
+static int usage(const char* argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--quick] [--meters 1,8,32] [--interval-ms 100,10,0] [--read block,per-cid]\n"
+            "          [--publish json,individual,binary] [--duration-s 2] [--batch %d] [--meter-delay-us 0]\n"
+            "          [--model SDM120] [--broker host[:port]] [--mqtt 3.1.1|5] [--format csv|json]\n"
+            "          [--compare baseline.csv] [--tolerance 25]\n",
+            argv0, CONFIG_SDM_BATCH_READINGS);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    int meters[MAX_LIST] = { 1, 8, 32 };
+    int meter_count = 3;
+    int intervals[MAX_LIST] = { 100, 10, 0 };
+    int interval_count = 3;
+    int reads[MAX_LIST] = { READ_BLOCK, READ_PER_CID };
+    int read_count = 2;
+    int publishes[MAX_LIST] = { PUBLISH_JSON, PUBLISH_INDIVIDUAL, PUBLISH_BINARY };
+    int publish_count = 3;
+    bool json = false;
+    const char* compare = NULL;
+    double tolerance = 0.25;
+
+    s_profile = meter_profile_default();
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--quick") == 0) {
+            meters[0] = 1;
+            meters[1] = 4;
+            meter_count = 2;
+            intervals[0] = 10;
+            intervals[1] = 0;
+            interval_count = 2;
+            s_duration_s = 0.5;
+            continue;
+        }
+        if (value == NULL) {
+            return usage(argv[0]);
+        }
+        i++;
+        if (strcmp(arg, "--meters") == 0) {
+            meter_count = parse_ints(value, meters, 1, MAX_METERS);
+        } else if (strcmp(arg, "--interval-ms") == 0) {
+            interval_count = parse_ints(value, intervals, 0, 60000);
+        } else if (strcmp(arg, "--read") == 0) {
+            read_count = parse_names(value, READ_NAMES, READ_MODE_COUNT, reads);
+        } else if (strcmp(arg, "--publish") == 0) {
+            publish_count = parse_names(value, PUBLISH_NAMES, PUBLISH_MODE_COUNT, publishes);
+        } else if (strcmp(arg, "--duration-s") == 0) {
+            s_duration_s = atof(value);
+        } else if (strcmp(arg, "--batch") == 0) {
+            s_batch_readings = atoi(value);
+        } else if (strcmp(arg, "--meter-delay-us") == 0) {
+            s_meter_delay_us = (uint32_t)atoi(value);
+        } else if (strcmp(arg, "--model") == 0) {
+            s_profile = meter_profile_find(value);
+        } else if (strcmp(arg, "--broker") == 0) {
+            snprintf(s_broker_host, sizeof(s_broker_host), "%s", value);
+            char* colon = strrchr(s_broker_host, ':');
+            if (colon != NULL) {
+                *colon = '\0';
+                snprintf(s_broker_port, sizeof(s_broker_port), "%s", colon + 1);
+            }
+        } else if (strcmp(arg, "--mqtt") == 0) {
+            s_mqtt_level = strcmp(value, "5") == 0 ? 5 : strcmp(value, "3.1.1") == 0 ? 4 : 0;
+        } else if (strcmp(arg, "--format") == 0) {
+            json = strcmp(value, "json") == 0;
+        } else if (strcmp(arg, "--compare") == 0) {
+            compare = value;
+        } else if (strcmp(arg, "--tolerance") == 0) {
+            tolerance = atof(value) / 100.0;
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (s_profile == NULL || meter_count == 0 || interval_count == 0 || read_count == 0 || publish_count == 0 ||
+        s_mqtt_level == 0 || s_duration_s <= 0 || s_batch_readings < 2 || s_batch_readings > 240) {
+        return usage(argv[0]);
+    }
+    if (compare != NULL && !load_baseline(compare)) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    snprintf(s_prefix, sizeof(s_prefix), "sdm_bench/%d", (int)getpid());
+
+    fprintf(stderr, "%s profile (%u registers), %.1f s per point, MQTT %s, %s\n", s_profile->model,
+            s_profile->reg_count, s_duration_s, s_mqtt_level == 5 ? "5" : "3.1.1",
+            s_broker_host[0] != '\0' ? s_broker_host : "embedded broker");
+    printf("%s\n", json ? "[" : CSV_HEADER);
+    int regressions = 0;
+    bool first = true;
+    for (int m = 0; m < meter_count; m++) {
+        for (int iv = 0; iv < interval_count; iv++) {
+            for (int rd = 0; rd < read_count; rd++) {
+                for (int pb = 0; pb < publish_count; pb++) {
+                    const bench_point_t point = {
+                        .meters = meters[m],
+                        .interval_ms = intervals[iv],
+                        .read = (read_mode_t)reads[rd],
+                        .publish = (publish_mode_t)publishes[pb],
+                    };
+                    bench_result_t result;
+                    if (!run_point(&point, &result)) {
+                        fprintf(stderr, "point meters=%d interval_ms=%d read=%s publish=%s failed\n",
+                                point.meters, point.interval_ms, READ_NAMES[point.read],
+                                PUBLISH_NAMES[point.publish]);
+                        return 1;
+                    }
+                    print_result(&result, json, first);
+                    first = false;
+                    if (compare != NULL) {
+                        regressions += compare_result(&result, tolerance);
+                    }
+                }
+            }
+        }
+    }
+    if (json) {
+        printf("\n]\n");
+    }
+    free(s_baseline);
+    if (regressions > 0) {
+        fprintf(stderr, "%d regressions against %s\n", regressions, compare);
+        return 2;
+    }
+    return 0;
+}
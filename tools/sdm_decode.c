@@ -0,0 +1,346 @@
+/**
+ * @file sdm_decode.c
+ * @brief Host reference decoder for the binary batch, log and burst payloads
+ *
+ * Build on Linux from the repository root:
+ *
+ *   gcc -O2 -Wall -Imain -o sdm_decode tools/sdm_decode.c main/sample_codec.c -lm
+ *
+ * Usage:
+ *
+ *   mosquitto_sub -t energy/sdm120/batch -C 1 > batch.bin
+ *   mosquitto_sub -t energy/sdm120/batch/schema -C 1 > schema.json
+ *   ./sdm_decode batch.bin schema.json      # <prefix>/batch      (SDMQ) to CSV
+ *   ./sdm_decode log.bin schema.json        # <prefix>/log/data   (SDMR) to CSV
+ *   ./sdm_decode burst.bin                  # <prefix>/burst/data (SDMB) to CSV
+ *   ./sdm_decode --selftest [rounds]        # round-trip check + size comparison
+ *
+ * The batch decoder uses main/sample_codec.c, the same code the firmware
+ * encodes with. Without a schema the batch columns are named c0, c1, ...
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sample_codec.h"
+
+#define MAX_FILE_SIZE   (1024 * 1024)
+#define MAX_NAME_LEN    48
+
+static uint8_t* read_file(const char* path, size_t* len)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return NULL;
+    }
+    uint8_t* buf = malloc(MAX_FILE_SIZE);
+    *len = buf != NULL ? fread(buf, 1, MAX_FILE_SIZE, f) : 0;
+    fclose(f);
+    return buf;
+}
+
+/**
+ * @brief Pick the column names out of a batch/schema document, in order
+ *
+ * Only looks for "topic":"..." pairs, which is all the schema needs to be
+ * read for; no JSON library required.
+ */
+static int schema_names(const char* schema, char names[][MAX_NAME_LEN], int max)
+{
+    int count = 0;
+    for (const char* p = schema; count < max && (p = strstr(p, "\"topic\":\"")) != NULL; count++) {
+        p += strlen("\"topic\":\"");
+        const char* end = strchr(p, '"');
+        if (end == NULL) {
+            break;
+        }
+        snprintf(names[count], MAX_NAME_LEN, "%.*s", (int)(end - p), p);
+        p = end;
+    }
+    return count;
+}
+
+static char s_names[SAMPLE_CODEC_MAX_COLUMNS][MAX_NAME_LEN];
+static int s_named = 0;
+
+static int load_schema(const char* schema_path)
+{
+    size_t schema_len;
+    uint8_t* schema = read_file(schema_path, &schema_len);
+    if (schema == NULL) {
+        return 1;
+    }
+    schema[schema_len < MAX_FILE_SIZE ? schema_len : MAX_FILE_SIZE - 1] = '\0';
+    s_named = schema_names((const char*)schema, s_names, SAMPLE_CODEC_MAX_COLUMNS);
+    free(schema);
+    return 0;
+}
+
+/**
+ * @brief Decode one SDMQ batch to CSV rows, optionally preceded by the header row
+ */
+static int decode_batch(const uint8_t* buf, size_t len, bool header)
+{
+    sample_decoder_t dec;
+    if (!sample_decoder_begin(&dec, buf, len)) {
+        fprintf(stderr, "not a version 1 or %d batch\n", SAMPLE_CODEC_VERSION);
+        return 1;
+    }
+    if (s_named > 0 && s_named != dec.columns) {
+        fprintf(stderr, "schema names %d columns, batch has %u\n", s_named, dec.columns);
+    }
+
+    if (header) {
+        printf("%s", dec.utc ? "utc_ms" : "uptime_ms");
+        for (int i = 0; i < dec.columns; i++) {
+            if (i < s_named) {
+                printf(",%s", s_names[i]);
+            } else {
+                printf(",c%d", i);
+            }
+        }
+        printf("\n");
+    }
+
+    int64_t time_ms;
+    int64_t values[SAMPLE_CODEC_MAX_COLUMNS];
+    uint64_t valid;
+    int decoded = 0;
+    while (sample_decoder_next(&dec, &time_ms, values, &valid)) {
+        printf("%" PRId64, time_ms);
+        for (int i = 0; i < dec.columns; i++) {
+            if (valid & (1ULL << i)) {
+                printf(",%.*f", dec.precision[i], sample_codec_value(values[i], dec.precision[i]));
+            } else {
+                printf(",");
+            }
+        }
+        printf("\n");
+        decoded++;
+    }
+    if (decoded != dec.sample_count || dec.pos != dec.len) {
+        fprintf(stderr, "malformed batch: %d of %u samples, %zu of %zu bytes\n",
+                decoded, dec.sample_count, dec.pos, dec.len);
+        return 1;
+    }
+    fprintf(stderr, "%d samples x %u columns in %zu bytes\n", decoded, dec.columns, len);
+    return 0;
+}
+
+/**
+ * @brief Decode a <prefix>/log/data message: "SDMR" | u8 version | { u16 length | SDMQ batch }...
+ */
+static int decode_log_records(const uint8_t* buf, size_t len)
+{
+    if (len < 5 || buf[4] != 1) {
+        fprintf(stderr, "not a version 1 log message\n");
+        return 1;
+    }
+    int records = 0;
+    for (size_t pos = 5; pos < len; records++) {
+        const size_t record_len = pos + 2 <= len ? (size_t)(buf[pos] | (buf[pos + 1] << 8)) : len;
+        if (pos + 2 + record_len > len || decode_batch(buf + pos + 2, record_len, records == 0) != 0) {
+            fprintf(stderr, "malformed log message at byte %zu\n", pos);
+            return 1;
+        }
+        pos += 2 + record_len;
+    }
+    fprintf(stderr, "%d records in %zu bytes\n", records, len);
+    return 0;
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Decode a burst blob (layout in main/burst_capture.h)
+ */
+static int decode_burst(const uint8_t* buf, size_t len)
+{
+    if (len < 18 || buf[4] != 1) {
+        fprintf(stderr, "not a version 1 burst\n");
+        return 1;
+    }
+    const int regs = buf[5];
+    const uint32_t samples = get_u32(buf + 6);
+    const int64_t start_ms = (int64_t)((uint64_t)get_u32(buf + 10) | ((uint64_t)get_u32(buf + 14) << 32));
+    size_t pos = 18;
+
+    printf("%s", start_ms != 0 ? "utc_ms" : "offset_ms");
+    for (int i = 0; i < regs; i++) {
+        const uint8_t* end = memchr(buf + pos, '\0', len - pos);
+        if (end == NULL) {
+            fprintf(stderr, "truncated register names\n");
+            return 1;
+        }
+        printf(",%s", (const char*)buf + pos);
+        pos = end - buf + 1;
+    }
+    printf("\n");
+
+    uint32_t prev_bits[256] = { 0 };
+    uint64_t offset_ms = 0;
+    for (uint32_t s = 0; s < samples; s++) {
+        uint64_t delta = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (pos >= len || shift > 28) {
+                fprintf(stderr, "truncated at sample %u\n", s);
+                return 1;
+            }
+            const uint8_t byte = buf[pos++];
+            delta |= (uint64_t)(byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                break;
+            }
+        }
+        offset_ms += delta;
+        printf("%" PRId64, start_ms + (int64_t)offset_ms);
+
+        for (int i = 0; i < regs; i += 2) {
+            if (pos >= len) {
+                fprintf(stderr, "truncated at sample %u\n", s);
+                return 1;
+            }
+            const uint8_t counts = buf[pos++];
+            for (int j = i; j < i + 2 && j < regs; j++) {
+                const int n = j == i ? counts >> 4 : counts & 0x0F;
+                if (n > 4 || pos + n > len) {
+                    fprintf(stderr, "malformed value at sample %u\n", s);
+                    return 1;
+                }
+                uint32_t x = 0;
+                for (int b = 0; b < n; b++) {
+                    x |= (uint32_t)buf[pos++] << (8 * b);
+                }
+                prev_bits[j] ^= x;
+                float value;
+                memcpy(&value, &prev_bits[j], sizeof(value));
+                printf(",%.9g", value);
+            }
+        }
+        printf("\n");
+    }
+    fprintf(stderr, "%u samples x %d registers in %zu bytes\n", samples, regs, len);
+    return pos == len ? 0 : 1;
+}
+
+/**
+ * @brief Compare the sizes of one realistic SDM120 series as JSON, CBOR and a batch
+ *
+ * The series is readings 5 s apart of the 22 SDM120 registers drifting like a
+ * real household load. JSON is the firmware's <prefix>/data document per
+ * reading; CBOR is the same maps with float32 values.
+ */
+static void compare_sizes(int readings)
+{
+    static const struct {
+        const char* topic;
+        uint8_t precision;
+        double base;
+        double step;
+    } regs[] = {
+        { "voltage", 2, 231.4, 0.4 }, { "current", 3, 4.2, 0.3 }, { "active_power", 2, 960, 60 },
+        { "apparent_power", 2, 990, 60 }, { "reactive_power", 2, 120, 15 }, { "power_factor", 3, 0.97, 0.01 },
+        { "phase_angle", 1, 12, 1 }, { "frequency", 2, 50.0, 0.02 }, { "import_energy", 3, 4312.117, 0 },
+        { "export_energy", 3, 12.5, 0 }, { "import_reactive_energy", 3, 233.2, 0 },
+        { "export_reactive_energy", 3, 80.1, 0 }, { "power_demand", 2, 900, 2 },
+        { "max_power_demand", 2, 3400, 0 }, { "import_power_demand", 2, 900, 2 },
+        { "max_import_power_demand", 2, 3400, 0 }, { "export_power_demand", 2, 0, 0 },
+        { "max_export_power_demand", 2, 0, 0 }, { "current_demand", 3, 4.1, 0.01 },
+        { "max_current_demand", 3, 15.2, 0 }, { "total_energy", 3, 4324.617, 0 },
+        { "total_reactive_energy", 3, 313.3, 0 },
+    };
+    enum { COLUMNS = sizeof(regs) / sizeof(regs[0]), MAX_READINGS = 24 };
+
+    uint8_t precision[COLUMNS];
+    for (int c = 0; c < COLUMNS; c++) {
+        precision[c] = regs[c].precision;
+    }
+    static uint8_t buf[SAMPLE_CODEC_HEADER_SIZE(COLUMNS) + MAX_READINGS * SAMPLE_CODEC_MAX_SAMPLE_SIZE(COLUMNS)];
+    sample_encoder_t enc;
+    sample_encoder_begin(&enc, buf, sizeof(buf), precision, COLUMNS, true);
+
+    size_t json_bytes = 0;
+    size_t cbor_bytes = 0;
+    srand(1);
+    for (int r = 0; r < readings && r < MAX_READINGS; r++) {
+        const int64_t time_ms = 1700000000000LL + r * 5000;
+        char json[2048];
+        int len = snprintf(json, sizeof(json), "{\"timestamp\":%" PRId64 ".000,\"time_uncertainty_ms\":1.250,"
+                           "\"time_sync\":\"synced\"", time_ms);
+        cbor_bytes += 1 + 10 + 9 + 19 + 5 + 10 + 7;     // map header, 3 keys + uint64, float32, "synced"
+        int64_t values[COLUMNS];
+        for (int c = 0; c < COLUMNS; c++) {
+            // Drifting load; energy counters advance with the integrated power
+            const double noise = regs[c].step * ((rand() % 2001) / 1000.0 - 1.0);
+            const double energy = regs[c].step == 0 && strstr(regs[c].topic, "energy") != NULL ? r * 0.0013 : 0;
+            const float value = (float)(regs[c].base + noise + energy);
+            sample_codec_quantise(value, regs[c].precision, &values[c]);
+            len += snprintf(json + len, sizeof(json) - len, ",\"%s\":%.*f", regs[c].topic, regs[c].precision, value);
+            cbor_bytes += 1 + strlen(regs[c].topic) + 5;
+        }
+        len += snprintf(json + len, sizeof(json) - len, ",\"model\":\"SDM120\",\"device_ip\":\"192.168.1.100\"}");
+        cbor_bytes += 6 + 7 + 10 + 14;
+        json_bytes += len;
+        sample_encoder_add(&enc, time_ms, values, (1ULL << COLUMNS) - 1);
+    }
+
+    const size_t batch_bytes = sample_encoder_len(&enc);
+    printf("%d SDM120 readings: JSON %zu bytes, CBOR %zu bytes, delta batch %zu bytes\n",
+           readings, json_bytes, cbor_bytes, batch_bytes);
+    printf("delta batch is %.1fx smaller than JSON, %.1fx smaller than CBOR\n",
+           (double)json_bytes / batch_bytes, (double)cbor_bytes / batch_bytes);
+}
+
+/**
+ * @brief Round-trip check, then compare sizes at the default batch size and twice that
+ */
+static int selftest(int rounds)
+{
+    const int failed = sample_codec_selftest(1, rounds);
+    if (failed != 0) {
+        fprintf(stderr, failed > 0 ? "round trip FAILED in round %d\n" : "round trip FAILED (%d)\n", failed);
+        return 1;
+    }
+    printf("round trip: %d random batches OK\n", rounds);
+    compare_sizes(12);
+    compare_sizes(24);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "--selftest") == 0) {
+        return selftest(argc >= 3 ? atoi(argv[2]) : 10000);
+    }
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s PAYLOAD.bin [SCHEMA.json] | --selftest [rounds]\n", argv[0]);
+        return 2;
+    }
+
+    size_t len;
+    uint8_t* buf = read_file(argv[1], &len);
+    if (buf == NULL) {
+        return 1;
+    }
+    int result = argc == 3 ? load_schema(argv[2]) : 0;
+    if (result != 0) {
+        // read_file() reported it
+    } else if (len >= 4 && memcmp(buf, "SDMQ", 4) == 0) {
+        result = decode_batch(buf, len, true);
+    } else if (len >= 4 && memcmp(buf, "SDMR", 4) == 0) {
+        result = decode_log_records(buf, len);
+    } else if (len >= 4 && memcmp(buf, "SDMB", 4) == 0) {
+        result = decode_burst(buf, len);
+    } else {
+        fprintf(stderr, "%s: unknown payload\n", argv[1]);
+        result = 1;
+    }
+    free(buf);
+    return result;
+}